@@ -0,0 +1,34 @@
+-- calls.lua: vararg calls and tail calls.
+-- Times calls of a vararg function that ignores its extra arguments
+-- (with LUA_COMPAT_VARARG each one used to build an `arg' table),
+-- a tail-recursive loop and a chain of tail calls between functions
+-- with large frames.
+--
+-- usage: lua calls.lua [n]   (default 1e7)
+
+local n = tonumber(arg and arg[1]) or 1e7
+local clock = os.clock
+
+local function handler(ev, ...) return ev end
+local c = clock()
+for i = 1, n do handler(i, "x", i) end
+print(string.format("vararg     %8.2f s", clock() - c))
+
+local function loop(k, acc)
+  if k == 0 then return acc end
+  return loop(k - 1, acc + k)
+end
+c = clock()
+for i = 1, n / 1e4 do loop(1e4, 0) end
+print(string.format("tailrec    %8.2f s", clock() - c))
+
+local ping
+local function pong(k, a, b, c, d, e, f, g, h)
+  local x1, x2, x3, x4, x5, x6, x7, x8 = a, b, c, d, e, f, g, h
+  if k == 0 then return x1 end
+  return ping(k - 1, x2, x3, x4, x5, x6, x7, x8, x1)
+end
+function ping(k, ...) return pong(k, ...) end
+c = clock()
+for i = 1, n / 1e4 do pong(1e4, 1, 2, 3, 4, 5, 6, 7, 8) end
+print(string.format("tailchain  %8.2f s", clock() - c))
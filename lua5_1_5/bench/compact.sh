@@ -0,0 +1,46 @@
+#!/bin/sh
+# compact.sh: compare the size of a big precompiled chunk and the time
+# to load it in the official format (luac, luac -s) and in the compact
+# one (luac -c, -z, with -n keeping only line information). Loads go
+# through `loadfile' (the whole file in memory) and through `loadstring'
+# (a stream reader).
+#
+# usage: sh compact.sh [functions] [loads]   (defaults 20000 and 20;
+#        needs lua and luac built in ../src)
+
+SRC=`dirname $0`/../src
+N=${1:-20000}
+LOADS=${2:-20}
+TMP=${TMPDIR:-/tmp}/lua-compact.$$
+
+$SRC/lua -e "
+  local f = io.open('$TMP.lua', 'w')
+  for i = 1, $N do
+    if i % 150 == 1 then f:write('do\\n') end  -- locals per block are limited
+    f:write('local function f', i, '(alpha, beta, gamma)\\n',
+            '  local sum, i = 0, 1\\n',
+            '  while i <= alpha do sum = sum + beta * i; i = i + 1 end\\n',
+            '  if sum > gamma then return sum - gamma, [[big]] end\\n',
+            '  return sum, [[small]]\\n',
+            'end\\n')
+    if i % 150 == 0 or i == $N then f:write('end\\n') end
+  end
+  f:close()
+" || exit 1
+printf '%-12s %10s %10s %10s\n' options bytes loadfile loadstring
+for opts in "" "-s" "-c" "-c -n" "-z" "-z -n" "-z -s"; do
+  $SRC/luac $opts -o $TMP.out $TMP.lua || exit 1
+  $SRC/lua -e "
+    local file, loads = '$TMP.out', $LOADS
+    local s = io.open(file, 'rb'):read('*a')
+    local function time(load, arg)
+      collectgarbage()
+      local c = os.clock()
+      for i = 1, loads do assert(load(arg)) end
+      return (os.clock() - c) / loads
+    end
+    print(string.format('%-12s %10d %8.4f s %8.4f s', '$opts' == '' and '(none)' or '$opts',
+          #s, time(loadfile, file), time(loadstring, s)))
+  " || exit 1
+done
+rm -f $TMP.lua $TMP.out
@@ -0,0 +1,57 @@
+-- coro.lua: coroutine switches and Lua metamethod calls.
+-- Times a resume/yield ping-pong, a pipeline of `depth' coroutine.wrap
+-- filters (each value goes through every level; a depth much past 60
+-- used to fail with "C stack overflow") and calls of a Lua `__index'.
+-- Also times the creation of short-lived coroutines (one per request)
+-- and prints the memory taken by each suspended one.
+--
+-- usage: lua coro.lua [n] [depth]   (defaults 2e6 and 50)
+
+local n = tonumber(arg and arg[1]) or 2e6
+local depth = tonumber(arg and arg[2]) or 50
+local clock = os.clock
+local create, resume, yield, wrap =
+  coroutine.create, coroutine.resume, coroutine.yield, coroutine.wrap
+
+local c = clock()
+local co = create(function() while true do yield() end end)
+for i = 1, n do resume(co) end
+print(string.format("resume/yield  %8.2f s", clock() - c))
+
+local m = math.floor(n / depth)
+c = clock()
+local p = wrap(function() for i = 1, m do yield(i) end end)
+for d = 1, depth do
+  local src = p
+  p = wrap(function() for v in src do yield(v) end end)
+end
+local s = 0
+for v in p do s = s + v end
+assert(s == m * (m + 1) / 2)
+print(string.format("pipeline %3d  %8.2f s", depth, clock() - c))
+
+c = clock()
+local t = setmetatable({}, {__index = function(t, k) return k end})
+for i = 1, n do s = t[i] end
+print(string.format("__index      %8.2f s", clock() - c))
+
+c = clock()
+local function handler(x) local y = yield(x) return x + y end
+for i = 1, n / 4 do
+  local h = create(handler)
+  resume(h, i)
+  resume(h, 1)
+end
+print(string.format("spawn        %8.2f s", clock() - c))
+
+local k = n / 20
+local idle = {}
+collectgarbage()
+local before = collectgarbage("count")
+for i = 1, k do
+  idle[i] = create(handler)
+  resume(idle[i], i)
+end
+collectgarbage()
+print(string.format("idle         %8.0f bytes each",
+                    (collectgarbage("count") - before) * 1024 / k))
@@ -0,0 +1,23 @@
+#!/bin/sh
+# dispatch.sh: build the interpreter with and without LUA_USE_JUMPTABLE
+# and run opcodes.lua with both, side by side.
+#
+# usage: sh dispatch.sh [scale]   (run from lua5_1_5/bench)
+
+SRC=`dirname $0`/../src
+TMP=${TMPDIR:-/tmp}/lua-dispatch.$$
+SCALE=${1:-1}
+
+for mode in 0 1; do
+  mkdir -p $TMP/$mode
+  cp $SRC/*.c $SRC/*.h $SRC/Makefile $TMP/$mode
+  (cd $TMP/$mode && make -s all MYCFLAGS="-DLUA_USE_POSIX -DLUA_USE_JUMPTABLE=$mode" >/dev/null 2>&1) || exit 1
+  $TMP/$mode/lua `dirname $0`/opcodes.lua $SCALE > $TMP/out.$mode || exit 1
+done
+
+echo "kernel                   switch   jumptab"
+paste $TMP/out.0 $TMP/out.1 | awk -F'\t' '{
+  n = split($1, a, " "); split($2, b, " ");
+  name = $1; sub(/ +[0-9.]+$/, "", name);
+  printf "%-22s %8s  %8s\n", name, a[n], b[n] }'
+rm -rf $TMP
@@ -0,0 +1,37 @@
+-- gc.lua: collector benchmark for a large long-lived heap.
+-- Builds `n' records that stay alive for the whole run (think config
+-- tables and loaded modules) and then allocates short-lived tables
+-- and strings, timing the churn in incremental and in generational
+-- mode. Also prints the number of collector steps and the peak heap.
+--
+-- usage: lua gc.lua [n] [churn]   (defaults 1e6 and 2e7)
+
+local n = tonumber(arg and arg[1]) or 1e6
+local churn = tonumber(arg and arg[2]) or 2e7
+local clock = os.clock
+
+local heap = {}
+for i = 1, n do
+  heap[i] = {id = i, name = "item" .. i, tags = {i, i + 1}}
+end
+
+local function run(mode)
+  collectgarbage(mode)
+  collectgarbage()
+  local peak = 0
+  local c = clock()
+  local keep
+  for i = 1, churn do
+    keep = {i, tostring(i % 1000)}
+    if i % 100000 == 0 then
+      local k = collectgarbage("count")
+      if k > peak then peak = k end
+    end
+  end
+  local t = clock() - c
+  print(string.format("%-12s %8.2f s   peak %8.1f MB", mode, t, peak / 1024))
+end
+
+run("incremental")
+run("generational")
+collectgarbage("incremental")
@@ -0,0 +1,31 @@
+-- gcpause.lua: pause times of collectgarbage("steptime", us).
+-- Builds a heap with one huge array, one huge map and many small
+-- tables, stops the automatic collector and runs a whole cycle in
+-- steps of the given budget, printing the number of steps and the
+-- mean and worst wall time of a step.
+--
+-- usage: lua gcpause.lua [n]   (default 2e6 entries per big table)
+
+local n = tonumber(arg and arg[1]) or 2e6
+local clock = os.clock
+
+local arr, map, small = {}, {}, {}
+for i = 1, n do arr[i] = i end
+for i = 1, n do map["k" .. i] = i end
+for i = 1, n / 10 do small[i] = {i, i + 1} end
+
+collectgarbage()
+collectgarbage("stop")
+for _, us in ipairs{100, 500, 2000} do
+  local steps, total, worst = 0, 0, 0
+  repeat
+    local c = clock()
+    local done = collectgarbage("steptime", us)
+    c = clock() - c
+    steps, total = steps + 1, total + c
+    if c > worst then worst = c end
+  until done
+  print(string.format("budget %5d us: %6d steps, mean %8.1f us, worst %8.1f us",
+                      us, steps, total / steps * 1e6, worst * 1e6))
+end
+collectgarbage("restart")
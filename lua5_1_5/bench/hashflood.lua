@@ -0,0 +1,29 @@
+-- hashflood.lua: keys built to collide under a hash that skips chars.
+-- Makes `n' distinct 40-char keys that differ only in their even
+-- positions (the old hash sampled every other char of such strings),
+-- then uses them as table keys, as a JSON decoder would.
+--
+-- usage: lua hashflood.lua [n]   (default 2e4)
+
+local n = tonumber(arg and arg[1]) or 2e4
+local clock = os.clock
+local char, concat = string.char, table.concat
+
+local keys = {}
+for i = 1, n do
+  local b, x = {}, i
+  for j = 1, 40 do
+    if j % 2 == 1 then  -- even 0-based positions carry the counter
+      b[j] = char(97 + x % 26); x = math.floor(x / 26)
+    else
+      b[j] = "_"
+    end
+  end
+  keys[i] = concat(b)
+end
+
+local c = clock()
+local t = {}
+for i = 1, n do t[keys[i]] = i end
+for i = 1, n do assert(t[keys[i]] == i) end
+print(string.format("%d keys  %6.2f s", n, clock() - c))
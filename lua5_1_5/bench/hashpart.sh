@@ -0,0 +1,19 @@
+#!/bin/sh
+# hashpart.sh: build the interpreter with chained scatter and with
+# LUA_USE_SWISSTABLE and run tables.lua with both, one after the other.
+#
+# usage: sh hashpart.sh [maxexp]   (run from lua5_1_5/bench)
+
+SRC=`dirname $0`/../src
+TMP=${TMPDIR:-/tmp}/lua-hashpart.$$
+
+for mode in chained swiss; do
+  flags="-DLUA_USE_POSIX"
+  [ $mode = swiss ] && flags="$flags -DLUA_USE_SWISSTABLE"
+  mkdir -p $TMP/$mode
+  cp $SRC/*.c $SRC/*.h $SRC/Makefile $TMP/$mode
+  (cd $TMP/$mode && make -s all MYCFLAGS="$flags" >/dev/null 2>&1) || exit 1
+  echo "== $mode"
+  $TMP/$mode/lua `dirname $0`/tables.lua $1 || exit 1
+done
+rm -rf $TMP
@@ -0,0 +1,53 @@
+#!/bin/sh
+# image.sh: compare loading a big precompiled chunk written by plain
+# `luac' (copied into the heap) and by `luac -m' (code and line
+# information left in the mapped file, names and nested functions
+# loaded on demand). Prints the time of `loadfile' and the heap it
+# leaves allocated, then the same after running the chunk once, which
+# makes a closure of every function.
+#
+# usage: sh image.sh [functions] [loads]   (defaults 20000 and 20;
+#        needs lua and luac built in ../src)
+
+SRC=`dirname $0`/../src
+N=${1:-20000}
+LOADS=${2:-20}
+TMP=${TMPDIR:-/tmp}/lua-image.$$
+
+$SRC/lua -e "
+  local f = io.open('$TMP.lua', 'w')
+  for i = 1, $N do
+    if i % 150 == 1 then f:write('do\\n') end  -- locals per block are limited
+    f:write('local function f', i, '(alpha, beta, gamma)\\n',
+            '  local sum, i = 0, 1\\n',
+            '  while i <= alpha do sum = sum + beta * i; i = i + 1 end\\n',
+            '  if sum > gamma then return sum - gamma, [[big]] end\\n',
+            '  return sum, [[small]]\\n',
+            'end\\n')
+    if i % 150 == 0 or i == $N then f:write('end\\n') end
+  end
+  f:close()
+" || exit 1
+$SRC/luac -o $TMP.out $TMP.lua || exit 1
+$SRC/luac -m -o $TMP.img $TMP.lua || exit 1
+for file in $TMP.out $TMP.img; do
+  $SRC/lua -e "
+    local file, loads = '$file', $LOADS
+    collectgarbage(); collectgarbage('stop')
+    local k0 = collectgarbage('count')
+    local c = os.clock()
+    local keep = {}
+    for i = 1, loads do keep[i] = assert(loadfile(file)) end
+    c = os.clock() - c
+    local name = file:match('%.(%w+)\$') == 'img' and 'luac -m' or 'luac'
+    print(string.format('%-7s load %8.4f s %10.0f KB', name,
+          c / loads, (collectgarbage('count') - k0) / loads))
+    c = os.clock()
+    for i = 1, loads do keep[i]() end
+    c = os.clock() - c
+    print(string.format('%-7s run  %8.4f s %10.0f KB', name,
+          c / loads, (collectgarbage('count') - k0) / loads))
+  " || exit 1
+done
+ls -l $TMP.out $TMP.img | awk '{print $5, $9}'
+rm -f $TMP.lua $TMP.out $TMP.img
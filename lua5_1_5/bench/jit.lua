@@ -0,0 +1,50 @@
+-- jit.lua: numeric loops for LUA_USE_JIT.
+-- Times a particle simulation over arrays of numbers, a sum over a
+-- table with a branch in the loop, and a loop that calls a function
+-- (which the loop compiler leaves to the interpreter), so that builds
+-- with and without the JIT can be compared.
+--
+-- usage: lua jit.lua [n] [steps]   (defaults 1000 and 20000)
+
+local n = tonumber(arg and arg[1]) or 1000
+local steps = tonumber(arg and arg[2]) or 20000
+local clock = os.clock
+
+local x, y, vx, vy = {}, {}, {}, {}
+for i = 1, n do
+  x[i], y[i] = i % 17, i % 23
+  vx[i], vy[i] = (i % 7) - 3, (i % 5) - 2
+end
+
+local function step(dt)
+  for i = 1, n do
+    local nvy = vy[i] - 9.81 * dt
+    local nx, ny = x[i] + vx[i] * dt, y[i] + nvy * dt
+    if ny < 0 then ny = -ny; nvy = -nvy * 0.9 end
+    x[i], y[i], vy[i] = nx, ny, nvy
+  end
+end
+
+local c = clock()
+for s = 1, steps do step(0.001) end
+local e = 0
+for i = 1, n do e = e + vx[i] * vx[i] + vy[i] * vy[i] end
+print(string.format("particles  %8.2f s   (energy %.6g)", clock() - c, e))
+
+local t = {}
+for i = 1, 1000 do t[i] = i % 10 end
+c = clock()
+local s = 0
+for r = 1, steps do
+  for i = 1, #t do
+    local v = t[i]
+    if v > 4 then s = s + v else s = s - 1 end
+  end
+end
+print(string.format("branchy    %8.2f s   (%d)", clock() - c, s))
+
+local abs = math.abs
+c = clock()
+s = 0
+for i = 1, steps * 500 do s = s + abs(i % 3 - 1) end
+print(string.format("calls      %8.2f s   (%d)", clock() - c, s))
@@ -0,0 +1,43 @@
+-- jitfunc.lua: small hot functions for LUA_USE_JIT.
+-- Times functions that are called many times but whose loops are too
+-- short (or are `while' loops) for the loop compiler: a vector helper,
+-- a gcd with a `while' loop, and a bounds check, so that builds with
+-- and without the JIT can be compared.
+--
+-- usage: lua jitfunc.lua [n]   (default 2000000)
+
+local n = tonumber(arg and arg[1]) or 2000000
+local clock = os.clock
+
+local function dot3(a, b)
+  return a[1] * b[1] + a[2] * b[2] + a[3] * b[3]
+end
+
+local function gcd(a, b)
+  while b ~= 0 do
+    a, b = b, a % b
+  end
+  return a
+end
+
+local function clamp(v, lo, hi)
+  if v < lo then return lo
+  elseif v > hi then return hi
+  else return v end
+end
+
+local u, v = {1.5, 2, -3}, {0.25, 4, 2}
+local c = clock()
+local s = 0
+for i = 1, n do s = s + dot3(u, v) end
+print(string.format("dot3       %8.2f s   (%g)", clock() - c, s))
+
+c = clock()
+s = 0
+for i = 1, n do s = s + gcd(i, 360) end
+print(string.format("gcd        %8.2f s   (%d)", clock() - c, s))
+
+c = clock()
+s = 0
+for i = 1, n do s = s + clamp(i % 100, 10, 90) end
+print(string.format("clamp      %8.2f s   (%d)", clock() - c, s))
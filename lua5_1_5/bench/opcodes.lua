@@ -0,0 +1,148 @@
+-- opcodes.lua: micro-benchmark for the interpreter dispatch loop.
+-- Each kernel is a loop whose body is dominated by one group of the
+-- opcodes listed in lopcodes.h. Prints one line per kernel with the
+-- CPU time it took (see dispatch.sh to compare two builds).
+--
+-- usage: lua opcodes.lua [scale]
+
+local N = (tonumber(arg and arg[1]) or 1) * 2000000
+
+local kernels = {}
+local function kernel(name, f) kernels[#kernels+1] = {name, f} end
+
+kernel("MOVE/LOADK/LOADNIL", function(n)
+  local a, b, c
+  for i = 1, n do
+    a = 1; b = a; c = b; a = nil; b = "x"; c = a
+  end
+  return c
+end)
+
+kernel("LOADBOOL/NOT/TEST", function(n)
+  local x, y = true, 0
+  for i = 1, n do
+    x = not x
+    if x then y = y + 1 end
+    local z = (x == false)
+  end
+  return y
+end)
+
+kernel("ADD/SUB/MUL/DIV", function(n)
+  local x = 0
+  for i = 1, n do
+    x = (x + i) * 0.5 - i / 3
+  end
+  return x
+end)
+
+kernel("MOD/POW/UNM", function(n)
+  local x = 0
+  for i = 1, n do
+    x = -(i % 7) ^ 2 + x
+  end
+  return x
+end)
+
+kernel("EQ/LT/LE/JMP", function(n)
+  local c = 0
+  for i = 1, n do
+    if i == 3 then c = c + 1 end
+    if i < 10 then c = c + 1 end
+    if i <= 20 then c = c + 1 end
+  end
+  return c
+end)
+
+kernel("GETUPVAL/SETUPVAL", function(n)
+  local u = 0
+  local function f() u = u + 1 end
+  for i = 1, n do u = u + 1 end
+  f()
+  return u
+end)
+
+kernel("GETGLOBAL/SETGLOBAL", function(n)
+  for i = 1, n do BENCH_G = i; local x = BENCH_G end
+  BENCH_G = nil
+end)
+
+kernel("GETTABLE/SETTABLE", function(n)
+  local t = {1, 2, 3, x = 1, y = 2}
+  for i = 1, n do
+    t.x = t.y + t[2]; t[1] = t.x
+  end
+  return t[1]
+end)
+
+kernel("NEWTABLE/SETLIST", function(n)
+  local t
+  for i = 1, n / 8 do t = {i, i, i} end
+  return t
+end)
+
+kernel("SELF/CALL/RETURN", function(n)
+  local obj = {v = 1}
+  function obj:get() return self.v end
+  local s = 0
+  for i = 1, n / 2 do s = s + obj:get() end
+  return s
+end)
+
+kernel("TAILCALL", function(n)
+  local function g(x) return x end
+  local function f(x) return g(x) end
+  local s = 0
+  for i = 1, n / 2 do s = s + f(i) end
+  return s
+end)
+
+kernel("LEN/CONCAT", function(n)
+  local s, l = "ab", 0
+  for i = 1, n / 4 do l = l + #(s .. s) end
+  return l
+end)
+
+kernel("TESTSET (and/or)", function(n)
+  local a, b, c = nil, false, 1
+  for i = 1, n do c = a or b or c; c = c and i end
+  return c
+end)
+
+kernel("FORLOOP/FORPREP", function(n)
+  local s = 0
+  for i = 1, n / 10 do for j = 1, 10 do s = s + j end end
+  return s
+end)
+
+kernel("TFORLOOP", function(n)
+  local t = {}
+  for i = 1, 100 do t[i] = i end
+  local s = 0
+  for r = 1, n / 100 do for _, v in ipairs(t) do s = s + v end end
+  return s
+end)
+
+kernel("CLOSURE/CLOSE", function(n)
+  local f
+  for i = 1, n / 4 do f = function() return i end end
+  return f()
+end)
+
+kernel("VARARG", function(n)
+  local function va(...) local a, b = ...; return a end
+  local s = 0
+  for i = 1, n / 2 do s = s + va(i, i) end
+  return s
+end)
+
+local total = 0
+for _, k in ipairs(kernels) do
+  collectgarbage()
+  local t0 = os.clock()
+  k[2](N)
+  local dt = os.clock() - t0
+  total = total + dt
+  io.write(string.format("%-22s %8.3f\n", k[1], dt))
+end
+io.write(string.format("%-22s %8.3f\n", "total", total))
@@ -0,0 +1,45 @@
+-- opt.lua: code compiled with and without `luac -O'.
+-- Times a loop written the usual way around feature flags and named
+-- constants (DEBUG checks, scale factors, a disabled trace) and prints
+-- the size of its bytecode. The optimized version is made by running
+-- the `luac' found next to the interpreter.
+--
+-- usage: lua opt.lua [n]   (default 2e7)
+
+local n = tonumber(arg and arg[1]) or 2e7
+local luac = string.gsub(arg and arg[-1] or "lua", "lua$", "luac")
+local clock = os.clock
+
+local src = [[
+local n = ...
+local DEBUG, TRACE = false, false
+local SCALE, OFFSET, LIMIT = 4, 2 * 8 + 1, 1e9
+local s = 0
+for i = 1, n do
+  if DEBUG then assert(s >= 0) end
+  local v = i * SCALE + OFFSET
+  if TRACE and v > LIMIT then print(i, v) end
+  if not DEBUG then s = s + v % (SCALE * 2) end
+end
+return s
+]]
+
+local file, out = os.tmpname(), os.tmpname()
+local f = assert(io.open(file, "w"))
+f:write(src)
+f:close()
+
+local function run(name, opt)
+  assert(os.execute(luac .. opt .. " -s -o " .. out .. " " .. file) == 0)
+  local size = #assert(io.open(out, "rb")):read("*a")
+  local chunk = assert(loadfile(out))
+  local c = clock()
+  local s = chunk(n)
+  print(string.format("%-10s %8.2f s   %5d bytes   (%.0f)",
+                      name, clock() - c, size, s))
+end
+
+run("plain", "")
+run("optimized", " -O")
+os.remove(file)
+os.remove(out)
@@ -0,0 +1,32 @@
+-- stack.lua: stack growth in deep recursion.
+-- Each round starts a fresh coroutine (small stack) that recurses
+-- `depth' levels, keeping a closure over a local of every level open
+-- (so every reallocation has to fix `depth' upvalues and CallInfos),
+-- and then the main thread does the same after a full collection has
+-- shrunk its stack.
+--
+-- usage: lua stack.lua [rounds] [depth]   (defaults 2000 and 15000)
+
+local rounds = tonumber(arg and arg[1]) or 2000
+local depth = tonumber(arg and arg[2]) or 15000
+local clock = os.clock
+
+local function rec(n, a, b, c)
+  if n == 0 then return 0 end
+  local f = function() return a end
+  return rec(n - 1, b, c, f) + 1
+end
+
+local c = clock()
+for i = 1, rounds do
+  local co = coroutine.wrap(rec)
+  assert(co(depth) == depth)
+end
+print(string.format("coroutines  %8.2f s", clock() - c))
+
+c = clock()
+for i = 1, rounds / 10 do
+  collectgarbage()
+  assert(rec(depth) == depth)
+end
+print(string.format("main        %8.2f s", clock() - c))
@@ -0,0 +1,31 @@
+-- strings.lua: cost of making strings that are never used as keys.
+-- Formats `n' log lines (about 80 chars each), rewrites them with
+-- gsub and splits them again, keeping the last `keep' of them alive so
+-- that the string table stays large; then uses some of them as keys.
+--
+-- usage: lua strings.lua [n] [keep]   (defaults 1e6 and 1e5)
+
+local n = tonumber(arg and arg[1]) or 1e6
+local keep = tonumber(arg and arg[2]) or 1e5
+local clock = os.clock
+local format, gsub, sub = string.format, string.gsub, string.sub
+
+local ring = {}
+local c = clock()
+for i = 1, n do
+  local line = format("2024-01-%02d 12:%02d:%02d INFO request %d from 10.0.%d.%d took %d ms",
+                      i % 28 + 1, i % 60, i % 59, i, i % 256, i % 199, i % 1000)
+  local masked = gsub(line, "%d+%.%d+%.%d+%.%d+", "x.x.x.x")
+  ring[i % keep + 1] = sub(masked, 1, -2) .. "!"
+end
+print(string.format("make    %6.2f s", clock() - c))
+
+c = clock()
+local t = {}
+for r = 1, 10 do
+  for i = 1, keep do
+    local s = ring[i]
+    t[s] = (t[s] or 0) + 1
+  end
+end
+print(string.format("keys    %6.2f s", clock() - c))
@@ -0,0 +1,19 @@
+-- strtpause.lua: worst pause while the string table grows.
+-- Interns `n' new strings, timing each batch of 1000, and prints the
+-- slowest batch (each resize of the string table used to rehash all
+-- strings within a single batch).
+--
+-- usage: lua strtpause.lua [n]   (default 4e6)
+
+local n = tonumber(arg and arg[1]) or 4e6
+local clock = os.clock
+collectgarbage("stop")  -- keeps all strings; time only the string table
+local worst, total = 0, clock()
+for b = 0, n / 1000 - 1 do
+  local c = clock()
+  for i = b * 1000 + 1, b * 1000 + 1000 do local s = "str" .. i end
+  c = clock() - c
+  if c > worst then worst = c end
+end
+print(string.format("%d strings  total %.2f s  worst batch %.2f ms",
+                    n, clock() - total, worst * 1000))
@@ -0,0 +1,50 @@
+-- tables.lua: micro-benchmark for the hash part of tables.
+-- For maps of 10^3 up to 10^maxexp keys, times inserting all keys,
+-- looking them all up, iterating over them with `next' and deleting
+-- them, for string keys and for non-integer number keys (which also
+-- live in the hash part). Prints nanoseconds per key for each case
+-- (see hashpart.sh to compare two builds).
+--
+-- usage: lua tables.lua [maxexp]   (default 6; 7 needs some GB of memory)
+
+local maxexp = tonumber(arg and arg[1]) or 6
+local clock = os.clock
+
+local function run(name, keys)
+  local n = #keys
+  local reps = math.max(1, math.floor(1e6 / n))
+  local tins, tget, tnext, tdel = 0, 0, 0, 0
+  for r = 1, reps do
+    local t = {}
+    local c = clock()
+    for i = 1, n do t[keys[i]] = i end
+    tins = tins + clock() - c
+    c = clock()
+    local s = 0
+    for i = 1, n do s = s + t[keys[i]] end
+    tget = tget + clock() - c
+    c = clock()
+    for k, v in next, t do s = s + v end
+    tnext = tnext + clock() - c
+    c = clock()
+    for i = 1, n do t[keys[i]] = nil end
+    tdel = tdel + clock() - c
+    assert(next(t) == nil)
+  end
+  local f = 1e9 / (n * reps)
+  print(string.format("%-8s %-9s %8.1f %8.1f %8.1f %8.1f", name,
+        string.format("1e%d", math.floor(math.log10(n) + 0.5)),
+        tins * f, tget * f, tnext * f, tdel * f))
+end
+
+print("keys     size        insert   lookup  iterate   delete  (ns/key)")
+for e = 3, maxexp do
+  local n = 10^e
+  local keys = {}
+  for i = 1, n do keys[i] = "k" .. i end
+  run("string", keys)
+  for i = 1, n do keys[i] = i + 0.5 end
+  run("number", keys)
+  keys = nil
+  collectgarbage()
+end
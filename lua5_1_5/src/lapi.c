@@ -107,6 +107,29 @@ LUA_API int lua_checkstack (lua_State *L, int size) {
 }
 
 
+/*
+** give the stack of `L' room for `nslots' values and `ncalls' nested
+** calls at once, instead of growing it step by step, and keep it that
+** big while the thread lives
+*/
+LUA_API int lua_reservestack (lua_State *L, int nslots, int ncalls) {
+  int res = 1;
+  lua_lock(L);
+  if (nslots > LUAI_MAXCALLS*MAXSTACK || ncalls > LUAI_MAXCALLS)
+    res = 0;  /* more than any stack overflow allows */
+  else {
+    if (nslots > L->stack_last - L->stack)
+      luaD_reallocstack(L, nslots);
+    if (ncalls > L->size_ci)
+      luaD_reallocCI(L, ncalls);
+    L->minstack = nslots + 1 + EXTRA_STACK;
+    L->minci = ncalls;
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
 LUA_API void lua_xmove (lua_State *from, lua_State *to, int n) {
   int i;
   if (from == to) return;
@@ -253,7 +276,7 @@ LUA_API const char *lua_typename (lua_State *L, int t) {
 
 LUA_API int lua_iscfunction (lua_State *L, int idx) {
   StkId o = index2adr(L, idx);
-  return iscfunction(o);
+  return iscfunction(o) != 0;
 }
 
 
@@ -323,7 +346,9 @@ LUA_API lua_Number lua_tonumber (lua_State *L, int idx) {
 LUA_API lua_Integer lua_tointeger (lua_State *L, int idx) {
   TValue n;
   const TValue *o = index2adr(L, idx);
-  if (tonumber(o, &n)) {
+  if (ttisint(o))
+    return ivalue(o);
+  else if (tonumber(o, &n)) {
     lua_Integer res;
     lua_Number num = nvalue(o);
     lua_number2integer(res, num);
@@ -428,7 +453,7 @@ LUA_API void lua_pushnil (lua_State *L) {
 
 LUA_API void lua_pushnumber (lua_State *L, lua_Number n) {
   lua_lock(L);
-  setnvalue(L->top, n);
+  luaO_setnumber(L->top, n);
   api_incr_top(L);
   lua_unlock(L);
 }
@@ -436,7 +461,7 @@ LUA_API void lua_pushnumber (lua_State *L, lua_Number n) {
 
 LUA_API void lua_pushinteger (lua_State *L, lua_Integer n) {
   lua_lock(L);
-  setnvalue(L->top, cast_num(n));
+  luaO_setnumber(L->top, cast_num(n));
   api_incr_top(L);
   lua_unlock(L);
 }
@@ -500,6 +525,21 @@ LUA_API void lua_pushcclosure (lua_State *L, lua_CFunction fn, int n) {
 }
 
 
+/*
+** a `leaf' is a C function that Lua code calls over the frame of the
+** caller, with no CallInfo of its own; so it must not yield, call Lua
+** functions or use upvalues or LUA_ENVIRONINDEX, and errors it raises
+** are reported as raised by its caller (metamethods it triggers are
+** fine: they get a frame of their own)
+*/
+LUA_API void lua_pushleaf (lua_State *L, lua_CFunction fn) {
+  lua_pushcclosure(L, fn, 0);
+  lua_lock(L);
+  clvalue(L->top - 1)->c.isC = CLEAF;
+  lua_unlock(L);
+}
+
+
 LUA_API void lua_pushboolean (lua_State *L, int b) {
   lua_lock(L);
   setbvalue(L->top, (b != 0));  /* ensure that true is 1 */
@@ -859,19 +899,42 @@ LUA_API int lua_cpcall (lua_State *L, lua_CFunction func, void *ud) {
 }
 
 
-LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
-                      const char *chunkname) {
+LUA_API int lua_loadopt (lua_State *L, lua_Reader reader, void *data,
+                         const char *chunkname, int opt) {
   ZIO z;
   int status;
   lua_lock(L);
   if (!chunkname) chunkname = "?";
   luaZ_init(L, &z, reader, data);
-  status = luaD_protectedparser(L, &z, chunkname);
+  status = luaD_protectedparser(L, &z, chunkname, opt);
+  lua_unlock(L);
+  return status;
+}
+
+
+LUA_API int lua_loadimage (lua_State *L, const void *p, size_t sz,
+                           const char *chunkname, lua_Release release,
+                           void *ud) {
+  Image img;
+  int status;
+  lua_lock(L);
+  if (!chunkname) chunkname = "?";
+  img.p = cast(const char *, p);
+  img.size = sz;
+  img.release = release;
+  img.ud = ud;
+  status = luaD_protectedimage(L, &img, chunkname);
   lua_unlock(L);
   return status;
 }
 
 
+LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
+                      const char *chunkname) {
+  return lua_loadopt(L, reader, data, chunkname, 0);
+}
+
+
 LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data) {
   int status;
   TValue *o;
@@ -879,7 +942,7 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data) {
   api_checknelems(L, 1);
   o = L->top - 1;
   if (isLfunction(o))
-    status = luaU_dump(L, clvalue(o)->l.p, writer, data, 0);
+    status = luaU_dump(L, clvalue(o)->l.p, writer, data, 0, 0);
   else
     status = 1;
   lua_unlock(L);
@@ -931,13 +994,17 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
         g->GCthreshold = 0;
       while (g->GCthreshold <= g->totalbytes) {
         luaC_step(L);
-        if (g->gcstate == GCSpause) {  /* end of cycle? */
+        if (g->gcstate == GCSpause || g->gckind == KGC_GEN) {  /* end of cycle? */
           res = 1;  /* signal it */
           break;
         }
       }
       break;
     }
+    case LUA_GCSTEPTIME: {
+      res = luaC_steptime(L, data);
+      break;
+    }
     case LUA_GCSETPAUSE: {
       res = g->gcpause;
       g->gcpause = data;
@@ -948,6 +1015,12 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       g->gcstepmul = data;
       break;
     }
+    case LUA_GCGEN:
+    case LUA_GCINC: {
+      res = (g->gckind == KGC_GEN) ? LUA_GCGEN : LUA_GCINC;
+      luaC_changemode(L, (what == LUA_GCGEN) ? KGC_GEN : KGC_NORMAL);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -991,9 +1064,10 @@ LUA_API void lua_concat (lua_State *L, int n) {
   lua_lock(L);
   api_checknelems(L, n);
   if (n >= 2) {
+    int last = cast_int(L->top - L->base) - 1;
     luaC_checkGC(L);
-    luaV_concat(L, n, cast_int(L->top - L->base) - 1);
-    L->top -= (n-1);
+    luaV_concat(L, n, last);
+    L->top = L->base + last - n + 2;  /* `luaV_concat' may move the top */
   }
   else if (n == 0) {  /* push empty string */
     setsvalue2s(L, L->top, luaS_newlstr(L, "", 0));
@@ -1036,7 +1110,8 @@ LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
 
 
 
-static const char *aux_upvalue (StkId fi, int n, TValue **val) {
+static const char *aux_upvalue (lua_State *L, StkId fi, int n,
+                                TValue **val) {
   Closure *f;
   if (!ttisfunction(fi)) return NULL;
   f = clvalue(fi);
@@ -1047,6 +1122,7 @@ static const char *aux_upvalue (StkId fi, int n, TValue **val) {
   }
   else {
     Proto *p = f->l.p;
+    luaU_checkdebug(L, p);
     if (!(1 <= n && n <= p->sizeupvalues)) return NULL;
     *val = f->l.upvals[n-1]->v;
     return getstr(p->upvalues[n-1]);
@@ -1058,7 +1134,7 @@ LUA_API const char *lua_getupvalue (lua_State *L, int funcindex, int n) {
   const char *name;
   TValue *val;
   lua_lock(L);
-  name = aux_upvalue(index2adr(L, funcindex), n, &val);
+  name = aux_upvalue(L, index2adr(L, funcindex), n, &val);
   if (name) {
     setobj2s(L, L->top, val);
     api_incr_top(L);
@@ -1075,7 +1151,7 @@ LUA_API const char *lua_setupvalue (lua_State *L, int funcindex, int n) {
   lua_lock(L);
   fi = index2adr(L, funcindex);
   api_checknelems(L, 1);
-  name = aux_upvalue(fi, n, &val);
+  name = aux_upvalue(L, fi, n, &val);
   if (name) {
     L->top--;
     setobj(L, val, L->top);
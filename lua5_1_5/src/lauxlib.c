@@ -24,6 +24,10 @@
 
 #include "lauxlib.h"
 
+#if defined(LUA_USE_MMAP)
+#include <sys/mman.h>
+#endif
+
 
 #define FREELIST_REF	0	/* free list of references */
 
@@ -226,9 +230,22 @@ LUALIB_API int luaL_callmeta (lua_State *L, int obj, const char *event) {
 }
 
 
+static void openlib (lua_State *L, const char *libname,
+                     const luaL_Reg *l, int nup, int leaf);
+
+
 LUALIB_API void (luaL_register) (lua_State *L, const char *libname,
                                 const luaL_Reg *l) {
-  luaI_openlib(L, libname, l, 0);
+  openlib(L, libname, l, 0, 0);
+}
+
+
+/*
+** like `luaL_register', but the functions are leaves (see `lua_pushleaf')
+*/
+LUALIB_API void (luaL_registerleaf) (lua_State *L, const char *libname,
+                                    const luaL_Reg *l) {
+  openlib(L, libname, l, 0, 1);
 }
 
 
@@ -241,6 +258,12 @@ static int libsize (const luaL_Reg *l) {
 
 LUALIB_API void luaI_openlib (lua_State *L, const char *libname,
                               const luaL_Reg *l, int nup) {
+  openlib(L, libname, l, nup, 0);
+}
+
+
+static void openlib (lua_State *L, const char *libname,
+                     const luaL_Reg *l, int nup, int leaf) {
   if (libname) {
     int size = libsize(l);
     /* check whether lib already exists */
@@ -261,7 +284,10 @@ LUALIB_API void luaI_openlib (lua_State *L, const char *libname,
     int i;
     for (i=0; i<nup; i++)  /* copy upvalues to the top */
       lua_pushvalue(L, -nup);
-    lua_pushcclosure(L, l->func, nup);
+    if (leaf)
+      lua_pushleaf(L, l->func);  /* (`nup' is 0) */
+    else
+      lua_pushcclosure(L, l->func, nup);
     lua_setfield(L, -(nup+2), l->name);
   }
   lua_pop(L, nup);  /* remove upvalues */
@@ -549,7 +575,58 @@ static int errfile (lua_State *L, const char *what, int fnameindex) {
 }
 
 
-LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
+static void releaseimage (void *ud, const void *p, size_t sz) {
+  (void)ud;
+#if defined(LUA_USE_MMAP)
+  munmap((void *)p, sz);
+#else
+  (void)sz;
+  free((void *)p);
+#endif
+}
+
+
+/*
+** loads a binary chunk with `lua_loadimage': mapped, so that processes
+** share its pages, or read whole in memory without LUA_USE_MMAP
+*/
+LUALIB_API int luaL_loadimage (lua_State *L, const char *filename) {
+  int fnameindex = lua_gettop(L) + 1;  /* index of filename on the stack */
+  FILE *f;
+  long sz = 0;
+  void *p = NULL;
+  int status;
+  lua_pushfstring(L, "@%s", filename);
+  f = fopen(filename, "rb");
+  if (f == NULL) return errfile(L, "open", fnameindex);
+  if (fseek(f, 0, SEEK_END) == 0 && (sz = ftell(f)) > 0) {
+#if defined(LUA_USE_MMAP)
+    p = mmap(NULL, (size_t)sz, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (p == MAP_FAILED) p = NULL;
+#else
+    p = malloc((size_t)sz);
+    if (p != NULL && (fseek(f, 0, SEEK_SET) != 0 ||
+                      fread(p, 1, (size_t)sz, f) != (size_t)sz)) {
+      free(p);
+      p = NULL;
+    }
+#endif
+  }
+  if (p == NULL) {
+    status = errfile(L, "read", fnameindex);
+    fclose(f);
+    return status;
+  }
+  fclose(f);
+  status = lua_loadimage(L, p, (size_t)sz, lua_tostring(L, -1),
+                         releaseimage, NULL);
+  lua_remove(L, fnameindex);
+  return status;
+}
+
+
+LUALIB_API int luaL_loadfileopt (lua_State *L, const char *filename,
+                                 int opt) {
   LoadF lf;
   int status, readstatus;
   int c;
@@ -571,6 +648,11 @@ LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
     if (c == '\n') c = getc(lf.f);
   }
   if (c == LUA_SIGNATURE[0] && filename) {  /* binary file? */
+    if (!lf.extraline) {  /* nothing before the chunk: load it in place */
+      fclose(lf.f);
+      lua_remove(L, fnameindex);
+      return luaL_loadimage(L, filename);
+    }
     lf.f = freopen(filename, "rb", lf.f);  /* reopen in binary mode */
     if (lf.f == NULL) return errfile(L, "reopen", fnameindex);
     /* skip eventual `#!...' */
@@ -578,7 +660,7 @@ LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
     lf.extraline = 0;
   }
   ungetc(c, lf.f);
-  status = lua_load(L, getF, &lf, lua_tostring(L, -1));
+  status = lua_loadopt(L, getF, &lf, lua_tostring(L, -1), opt);
   readstatus = ferror(lf.f);
   if (filename) fclose(lf.f);  /* close file (even in case of errors) */
   if (readstatus) {
@@ -590,6 +672,11 @@ LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
 }
 
 
+LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
+  return luaL_loadfileopt(L, filename, 0);
+}
+
+
 typedef struct LoadS {
   const char *s;
   size_t size;
@@ -606,12 +693,18 @@ static const char *getS (lua_State *L, void *ud, size_t *size) {
 }
 
 
-LUALIB_API int luaL_loadbuffer (lua_State *L, const char *buff, size_t size,
-                                const char *name) {
+LUALIB_API int luaL_loadbufferopt (lua_State *L, const char *buff,
+                                   size_t size, const char *name, int opt) {
   LoadS ls;
   ls.s = buff;
   ls.size = size;
-  return lua_load(L, getS, &ls, name);
+  return lua_loadopt(L, getS, &ls, name, opt);
+}
+
+
+LUALIB_API int luaL_loadbuffer (lua_State *L, const char *buff, size_t size,
+                                const char *name) {
+  return luaL_loadbufferopt(L, buff, size, name, 0);
 }
 
 
@@ -624,6 +717,19 @@ LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s) {
 /* }====================================================== */
 
 
+/*
+** `seed', when not NULL, gives the seed for string hashes; otherwise,
+** `lua_newstate' makes a random one
+*/
+static lua_State *newstate (lua_Alloc f, void *ud, const unsigned int *seed) {
+  if (seed != NULL)
+    return lua_newstateseed(f, ud, *seed);
+  else
+    return lua_newstate(f, ud);
+}
+
+
+#if !defined(LUA_USE_ARENA)
 static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
   (void)ud;
   (void)osize;
@@ -634,6 +740,193 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
   else
     return realloc(ptr, nsize);
 }
+#endif
+
+
+/*
+** {======================================================
+** Arena allocator
+** Blocks up to ARENA_MAXSMALL bytes come from free lists, one per size
+** class, refilled from chunks that all classes share; the classes are
+** fine enough to fit the structures in lobject.h (strings, tables,
+** nodes, closures, upvalues) with little waste. Bigger blocks go to
+** realloc/free. Each state has its own arena, so there is no contention
+** between states, and all chunks go back to the system at once when the
+** state is closed (the last block in use is the state itself). Memory
+** of small blocks is not returned before that.
+** =======================================================
+*/
+
+#if defined(LUA_USE_BGSWEEP)
+#include <pthread.h>  /* the collector frees from another thread */
+#define arenalock(a)	pthread_mutex_lock(&(a)->lock)
+#define arenaunlock(a)	pthread_mutex_unlock(&(a)->lock)
+#else
+#define arenalock(a)	((void)0)
+#define arenaunlock(a)	((void)0)
+#endif
+
+
+#define ARENA_CHUNK	(64*1024)
+#define ARENA_MAXSMALL	512
+#define ARENA_NCLASSES	32
+#define ARENA_HEADER	16  /* chunk header (keeps blocks aligned) */
+
+
+typedef struct Arena {
+  void *free[ARENA_NCLASSES];  /* free lists */
+  char *top;  /* unused part of the current chunk */
+  size_t left;  /* its size */
+  void *chunks;  /* list of all chunks */
+  size_t live;  /* blocks in use */
+  luaL_AllocClass stats[ARENA_NCLASSES + 1];  /* (last one: big blocks) */
+#if defined(LUA_USE_BGSWEEP)
+  pthread_mutex_t lock;
+#endif
+} Arena;
+
+
+/* classes: 8 to 128 by 8, to 256 by 16, to 512 by 32 */
+static int sizeclass (size_t size) {
+  if (size <= 128) return (int)((size + 7) >> 3) - 1;
+  else if (size <= 256) return 15 + (int)((size - 128 + 15) >> 4);
+  else return 23 + (int)((size - 256 + 31) >> 5);
+}
+
+
+static size_t classsize (int c) {
+  if (c < 16) return 8 * (size_t)(c + 1);
+  else if (c < 24) return 128 + 16 * (size_t)(c - 15);
+  else return 256 + 32 * (size_t)(c - 23);
+}
+
+
+static void *allocblock (Arena *a, size_t size) {
+  void *b;
+  if (size > ARENA_MAXSMALL) {
+    b = malloc(size);
+    if (b == NULL) return NULL;
+    a->stats[ARENA_NCLASSES].nused++;
+    a->stats[ARENA_NCLASSES].bytes += size;
+  }
+  else {
+    int c = sizeclass(size);
+    b = a->free[c];
+    if (b != NULL) {
+      a->free[c] = *(void **)b;
+      a->stats[c].nfree--;
+    }
+    else {
+      size_t sz = classsize(c);
+      if (a->left < sz) {  /* current chunk is exhausted? */
+        char *chunk = (char *)malloc(ARENA_CHUNK);
+        if (chunk == NULL) return NULL;
+        *(void **)chunk = a->chunks;
+        a->chunks = chunk;
+        a->top = chunk + ARENA_HEADER;
+        a->left = ARENA_CHUNK - ARENA_HEADER;
+      }
+      b = a->top;
+      a->top += sz;
+      a->left -= sz;
+    }
+    a->stats[c].nused++;
+    a->stats[c].bytes += size;
+  }
+  a->live++;
+  return b;
+}
+
+
+static void freeblock (Arena *a, void *b, size_t size) {
+  if (size > ARENA_MAXSMALL) {
+    free(b);
+    a->stats[ARENA_NCLASSES].nused--;
+    a->stats[ARENA_NCLASSES].bytes -= size;
+  }
+  else {
+    int c = sizeclass(size);
+    *(void **)b = a->free[c];
+    a->free[c] = b;
+    a->stats[c].nused--;
+    a->stats[c].nfree++;
+    a->stats[c].bytes -= size;
+  }
+  a->live--;
+}
+
+
+static void *arenarealloc (Arena *a, void *ptr, size_t osize, size_t nsize) {
+  void *b;
+  if (nsize == 0) {
+    if (ptr != NULL) freeblock(a, ptr, osize);
+    return NULL;
+  }
+  else if (ptr == NULL)
+    return allocblock(a, nsize);
+  else if (osize > ARENA_MAXSMALL && nsize > ARENA_MAXSMALL) {
+    b = realloc(ptr, nsize);
+    if (b != NULL)
+      a->stats[ARENA_NCLASSES].bytes += nsize - osize;
+    return b;
+  }
+  else if (osize <= ARENA_MAXSMALL && nsize <= ARENA_MAXSMALL &&
+           sizeclass(osize) == sizeclass(nsize)) {
+    a->stats[sizeclass(osize)].bytes += nsize - osize;
+    return ptr;  /* block is already good */
+  }
+  b = allocblock(a, nsize);
+  if (b != NULL) {
+    memcpy(b, ptr, (osize < nsize) ? osize : nsize);
+    freeblock(a, ptr, osize);
+  }
+  return b;
+}
+
+
+static void freearena (Arena *a) {
+  while (a->chunks != NULL) {
+    void *chunk = a->chunks;
+    a->chunks = *(void **)chunk;
+    free(chunk);
+  }
+#if defined(LUA_USE_BGSWEEP)
+  pthread_mutex_destroy(&a->lock);
+#endif
+  free(a);
+}
+
+
+static void *arena_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Arena *a = (Arena *)ud;
+  void *b;
+  arenalock(a);
+  b = arenarealloc(a, ptr, osize, nsize);
+  if (a->live == 0) {  /* state is gone? */
+    arenaunlock(a);
+    freearena(a);  /* release everything at once */
+  }
+  else
+    arenaunlock(a);
+  return b;
+}
+
+
+LUALIB_API int luaL_allocstats (lua_State *L, luaL_AllocClass *c, int n) {
+  void *ud;
+  int i;
+  Arena *a;
+  if (lua_getallocf(L, &ud) != arena_alloc)
+    return 0;  /* state does not use an arena */
+  a = (Arena *)ud;
+  arenalock(a);
+  for (i = 0; i < n && i <= ARENA_NCLASSES; i++)
+    c[i] = a->stats[i];
+  arenaunlock(a);
+  return ARENA_NCLASSES + 1;
+}
+
+/* }====================================================== */
 
 
 static int panic (lua_State *L) {
@@ -644,9 +937,51 @@ static int panic (lua_State *L) {
 }
 
 
-LUALIB_API lua_State *luaL_newstate (void) {
-  lua_State *L = lua_newstate(l_alloc, NULL);
+static lua_State *arenastate (const unsigned int *seed) {
+  lua_State *L;
+  int i;
+  Arena *a = (Arena *)malloc(sizeof(Arena));
+  if (a == NULL) return NULL;
+  memset(a, 0, sizeof(Arena));
+  for (i = 0; i < ARENA_NCLASSES; i++)
+    a->stats[i].size = classsize(i);
+#if defined(LUA_USE_BGSWEEP)
+  pthread_mutex_init(&a->lock, NULL);
+#endif
+  a->live = 1;  /* do not free the arena if lua_newstate fails */
+  L = newstate(arena_alloc, a, seed);
+  if (L == NULL) {
+    freearena(a);
+    return NULL;
+  }
+  a->live--;
+  lua_atpanic(L, &panic);
+  return L;
+}
+
+
+LUALIB_API lua_State *luaL_newarenastate (void) {
+  return arenastate(NULL);
+}
+
+
+static lua_State *auxstate (const unsigned int *seed) {
+#if defined(LUA_USE_ARENA)
+  return arenastate(seed);
+#else
+  lua_State *L = newstate(l_alloc, NULL, seed);
   if (L) lua_atpanic(L, &panic);
   return L;
+#endif
+}
+
+
+LUALIB_API lua_State *luaL_newstate (void) {
+  return auxstate(NULL);
+}
+
+
+LUALIB_API lua_State *luaL_newstateseed (unsigned int seed) {
+  return auxstate(&seed);
 }
 
@@ -43,6 +43,8 @@ LUALIB_API void (luaI_openlib) (lua_State *L, const char *libname,
                                 const luaL_Reg *l, int nup);
 LUALIB_API void (luaL_register) (lua_State *L, const char *libname,
                                 const luaL_Reg *l);
+LUALIB_API void (luaL_registerleaf) (lua_State *L, const char *libname,
+                                    const luaL_Reg *l);
 LUALIB_API int (luaL_getmetafield) (lua_State *L, int obj, const char *e);
 LUALIB_API int (luaL_callmeta) (lua_State *L, int obj, const char *e);
 LUALIB_API int (luaL_typerror) (lua_State *L, int narg, const char *tname);
@@ -75,11 +77,29 @@ LUALIB_API int (luaL_ref) (lua_State *L, int t);
 LUALIB_API void (luaL_unref) (lua_State *L, int t, int ref);
 
 LUALIB_API int (luaL_loadfile) (lua_State *L, const char *filename);
+LUALIB_API int (luaL_loadimage) (lua_State *L, const char *filename);
 LUALIB_API int (luaL_loadbuffer) (lua_State *L, const char *buff, size_t sz,
                                   const char *name);
 LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
+LUALIB_API int (luaL_loadfileopt) (lua_State *L, const char *filename,
+                                   int opt);
+LUALIB_API int (luaL_loadbufferopt) (lua_State *L, const char *buff,
+                                     size_t sz, const char *name, int opt);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
+LUALIB_API lua_State *(luaL_newstateseed) (unsigned int seed);
+LUALIB_API lua_State *(luaL_newarenastate) (void);
+
+
+/* statistics of the arena allocator, one entry per size class */
+typedef struct luaL_AllocClass {
+  size_t size;  /* block size (0 for blocks bigger than any class) */
+  size_t nused;  /* blocks in use */
+  size_t nfree;  /* free blocks kept for reuse */
+  size_t bytes;  /* bytes requested for the blocks in use */
+} luaL_AllocClass;
+
+LUALIB_API int (luaL_allocstats) (lua_State *L, luaL_AllocClass *c, int n);
 
 
 LUALIB_API const char *(luaL_gsub) (lua_State *L, const char *s, const char *p,
@@ -190,24 +190,71 @@ static int luaB_gcinfo (lua_State *L) {
 }
 
 
+/*
+** one entry {size, used, free, bytes} per size class of the arena
+** allocator, plus field `frag': the fraction of the memory held by small
+** blocks that is not in use (free blocks and padding up to class sizes)
+*/
+static int allocstats (lua_State *L) {
+  luaL_AllocClass c[64];
+  int i;
+  int n = luaL_allocstats(L, c, 64);
+  lua_Number held = 0, used = 0;
+  if (n == 0) {  /* state does not use the arena? */
+    lua_pushnil(L);
+    return 1;
+  }
+  if (n > 64) n = 64;
+  lua_createtable(L, n, 1);
+  for (i = 0; i < n; i++) {
+    lua_createtable(L, 0, 4);
+    lua_pushnumber(L, (lua_Number)c[i].size);
+    lua_setfield(L, -2, "size");
+    lua_pushnumber(L, (lua_Number)c[i].nused);
+    lua_setfield(L, -2, "used");
+    lua_pushnumber(L, (lua_Number)c[i].nfree);
+    lua_setfield(L, -2, "free");
+    lua_pushnumber(L, (lua_Number)c[i].bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_rawseti(L, -2, i + 1);
+    if (c[i].size > 0) {  /* small blocks? */
+      held += (lua_Number)c[i].size * (lua_Number)(c[i].nused + c[i].nfree);
+      used += (lua_Number)c[i].bytes;
+    }
+  }
+  lua_pushnumber(L, (held > 0) ? (held - used) / held : 0);
+  lua_setfield(L, -2, "frag");
+  return 1;
+}
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
-    "count", "step", "setpause", "setstepmul", NULL};
+    "count", "step", "setpause", "setstepmul", "generational",
+    "incremental", "steptime", "allocstats", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
-    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL};
+    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL, LUA_GCGEN,
+    LUA_GCINC, LUA_GCSTEPTIME, -1};
   int o = luaL_checkoption(L, 1, "collect", opts);
   int ex = luaL_optint(L, 2, 0);
-  int res = lua_gc(L, optsnum[o], ex);
+  int res;
+  if (optsnum[o] == -1)
+    return allocstats(L);
+  res = lua_gc(L, optsnum[o], ex);
   switch (optsnum[o]) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
       lua_pushnumber(L, res + ((lua_Number)b/1024));
       return 1;
     }
-    case LUA_GCSTEP: {
+    case LUA_GCSTEP: case LUA_GCSTEPTIME: {
       lua_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCGEN: case LUA_GCINC: {  /* previous mode */
+      lua_pushstring(L, (res == LUA_GCGEN) ? "generational" : "incremental");
+      return 1;
+    }
     default: {
       lua_pushnumber(L, res);
       return 1;
@@ -515,6 +562,10 @@ static int luaB_costatus (lua_State *L) {
 }
 
 
+/*
+** `resume' and `wrap' run the coroutine with `lua_resumek', so they do
+** not nest C calls; what follows the resume is in their continuations
+*/
 static int auxresume (lua_State *L, lua_State *co, int narg) {
   int status = costatus(L, co);
   if (!lua_checkstack(co, narg))
@@ -525,7 +576,11 @@ static int auxresume (lua_State *L, lua_State *co, int narg) {
   }
   lua_xmove(L, co, narg);
   lua_setlevel(L, co);
-  status = lua_resume(co, narg);
+  return 0;
+}
+
+
+static int auxresults (lua_State *L, lua_State *co, int status) {
   if (status == 0 || status == LUA_YIELD) {
     int nres = lua_gettop(co);
     if (!lua_checkstack(L, nres + 1))
@@ -540,11 +595,7 @@ static int auxresume (lua_State *L, lua_State *co, int narg) {
 }
 
 
-static int luaB_coresume (lua_State *L) {
-  lua_State *co = lua_tothread(L, 1);
-  int r;
-  luaL_argcheck(L, co, 1, "coroutine expected");
-  r = auxresume(L, co, lua_gettop(L) - 1);
+static int coresumeret (lua_State *L, int r) {
   if (r < 0) {
     lua_pushboolean(L, 0);
     lua_insert(L, -2);
@@ -558,9 +609,22 @@ static int luaB_coresume (lua_State *L) {
 }
 
 
-static int luaB_auxwrap (lua_State *L) {
-  lua_State *co = lua_tothread(L, lua_upvalueindex(1));
-  int r = auxresume(L, co, lua_gettop(L));
+static int coresumek (lua_State *L, int status) {
+  return coresumeret(L, auxresults(L, lua_tothread(L, 1), status));
+}
+
+
+static int luaB_coresume (lua_State *L) {
+  lua_State *co = lua_tothread(L, 1);
+  int narg = lua_gettop(L) - 1;
+  luaL_argcheck(L, co, 1, "coroutine expected");
+  if (auxresume(L, co, narg) < 0)
+    return coresumeret(L, -1);
+  return lua_resumek(L, co, narg, coresumek);
+}
+
+
+static int auxwrapret (lua_State *L, int r) {
   if (r < 0) {
     if (lua_isstring(L, -1)) {  /* error object is a string? */
       luaL_where(L, 1);  /* add extra info */
@@ -573,6 +637,21 @@ static int luaB_auxwrap (lua_State *L) {
 }
 
 
+static int auxwrapk (lua_State *L, int status) {
+  lua_State *co = lua_tothread(L, lua_upvalueindex(1));
+  return auxwrapret(L, auxresults(L, co, status));
+}
+
+
+static int luaB_auxwrap (lua_State *L) {
+  lua_State *co = lua_tothread(L, lua_upvalueindex(1));
+  int narg = lua_gettop(L);
+  if (auxresume(L, co, narg) < 0)
+    return auxwrapret(L, -1);
+  return lua_resumek(L, co, narg, auxwrapk);
+}
+
+
 static int luaB_cocreate (lua_State *L) {
   lua_State *NL = lua_newthread(L);
   luaL_argcheck(L, lua_isfunction(L, 1) && !lua_iscfunction(L, 1), 1,
@@ -6,6 +6,7 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 
 #define lcode_c
 #define LUA_CORE
@@ -256,7 +257,7 @@ int luaK_stringK (FuncState *fs, TString *s) {
 
 int luaK_numberK (FuncState *fs, lua_Number r) {
   TValue o;
-  setnvalue(&o, r);
+  luaO_setnumber(&o, r);
   return addk(fs, &o, &o);
 }
 
@@ -624,11 +625,13 @@ void luaK_indexed (FuncState *fs, expdesc *t, expdesc *k) {
 }
 
 
-static int constfolding (OpCode op, expdesc *e1, expdesc *e2) {
-  lua_Number v1, v2, r;
-  if (!isnumeral(e1) || !isnumeral(e2)) return 0;
-  v1 = e1->u.nval;
-  v2 = e2->u.nval;
+/*
+** result of arithmetic operation `op' on constants `v1' and `v2'; fails
+** for operations that should not be done at compile time
+*/
+static int numarith (OpCode op, lua_Number v1, lua_Number v2,
+                     lua_Number *res) {
+  lua_Number r;
   switch (op) {
     case OP_ADD: r = luai_numadd(v1, v2); break;
     case OP_SUB: r = luai_numsub(v1, v2); break;
@@ -645,11 +648,17 @@ static int constfolding (OpCode op, expdesc *e1, expdesc *e2) {
     default: lua_assert(0); r = 0; break;
   }
   if (luai_numisnan(r)) return 0;  /* do not attempt to produce NaN */
-  e1->u.nval = r;
+  *res = r;
   return 1;
 }
 
 
+static int constfolding (OpCode op, expdesc *e1, expdesc *e2) {
+  if (!isnumeral(e1) || !isnumeral(e2)) return 0;
+  return numarith(op, e1->u.nval, e2->u.nval, &e1->u.nval);
+}
+
+
 static void codearith (FuncState *fs, OpCode op, expdesc *e1, expdesc *e2) {
   if (constfolding(op, e1, e2))
     return;
@@ -829,3 +838,677 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+
+/*
+** replace pairs of instructions that usually run one after the other by
+** a fused opcode (see notes in lopcodes.h). Runs over the finished code,
+** so it never sees instructions still being patched. The pseudo-
+** instructions after OP_CLOSURE and the count after OP_SETLIST are data,
+** not code, and are left alone.
+*/
+void luaK_fuse (FuncState *fs) {
+  Proto *f = fs->f;
+  int pc;
+  if (G(fs->L)->nofuse) return;
+  for (pc = 0; pc + 1 < fs->pc; pc++) {
+    Instruction *i = &f->code[pc];
+    OpCode next = GET_OPCODE(f->code[pc + 1]);
+    int fused = -1;  /* no fused opcode */
+    switch (GET_OPCODE(*i)) {
+      case OP_CLOSURE: {
+        pc += f->p[GETARG_Bx(*i)]->nups;
+        break;
+      }
+      case OP_SETLIST: {
+        if (GETARG_C(*i) == 0) pc++;
+        break;
+      }
+      case OP_GETTABLE: {
+        if (next == OP_CALL) fused = OP_GETTABLECALL;
+        break;
+      }
+      case OP_MOVE: {
+        if (next == OP_CALL) fused = OP_MOVECALL;
+        break;
+      }
+      case OP_GETUPVAL: {
+        if (next == OP_GETTABLE) fused = OP_GETUPVALTABLE;
+        break;
+      }
+      default: break;
+    }
+    if (fused >= 0) {
+      SET_OPCODE(*i, fused);
+      pc++;  /* second instruction of the pair stays as it is */
+    }
+  }
+}
+
+
+/*
+** {======================================================
+** Optimizer: an optional pass over the finished code of a function
+** (`luac -O', `lua_loadopt'). Locals that get a constant once and are
+** never assigned again nor captured by a closure are replaced by that
+** constant; arithmetic and comparisons on constants are folded, and so
+** are the tests that depend on them; unreachable code is removed and
+** the code is compacted, fixing jumps, `lineinfo' and the ranges of
+** locals. Instructions are only marked while the passes run, so that
+** positions stay valid until the final compaction.
+** =======================================================
+*/
+
+#define OPTDATA		1	/* not an instruction (see `luaK_fuse') */
+#define OPTDEAD		2	/* to be removed (a no-op or unreachable) */
+#define OPTENTRY	4	/* reached by a jump or a skip */
+#define OPTREACH	8	/* reachable from the function entry */
+
+#define MAXOPTPASSES	8
+
+#define islive(m)	(((m) & (OPTDATA | OPTDEAD)) == 0)
+#define rkisreg(x,r)	(!ISK(x) && (x) == (r))
+#define jumpdest(i,pc)	((pc) + 1 + GETARG_sBx(i))
+
+
+/*
+** `numarith' for the optimizer, which does not fold to a zero: that
+** may be -0, and constants would merge it with a 0 of the function
+*/
+static int optarith (OpCode op, lua_Number v1, lua_Number v2,
+                     lua_Number *res) {
+  lua_Number r;
+  if (!numarith(op, v1, v2, &r) || r == 0) return 0;
+  *res = r;
+  return 1;
+}
+
+
+/* does instruction `i' (maybe) change register `r'? */
+static int setsreg (Instruction i, int r) {
+  int a = GETARG_A(i);
+  switch (GET_OPCODE(i)) {
+    case OP_LOADNIL: return (a <= r && r <= GETARG_B(i));
+    case OP_SELF: return (r == a || r == a+1);
+    case OP_CALL: return (r >= a && (GETARG_C(i) == 0 ||
+                                     r <= a + GETARG_C(i) - 2));
+    case OP_VARARG: return (r >= a && (GETARG_B(i) == 0 ||
+                                       r <= a + GETARG_B(i) - 2));
+    case OP_TAILCALL: return (r >= a);
+    case OP_FORLOOP: return (r == a || r == a+3);
+    case OP_TFORLOOP: return (a+2 <= r && r <= a+2+GETARG_C(i));
+    case OP_SETGLOBAL: case OP_SETUPVAL: case OP_SETTABLE: case OP_JMP:
+    case OP_EQ: case OP_LT: case OP_LE: case OP_TEST: case OP_RETURN:
+    case OP_SETLIST: case OP_CLOSE:
+      return 0;
+    default: return (r == a);
+  }
+}
+
+
+/* does instruction `i' (maybe) read register `r'? */
+static int readsreg (Instruction i, int r) {
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  switch (GET_OPCODE(i)) {
+    case OP_LOADK: case OP_LOADBOOL: case OP_LOADNIL: case OP_GETUPVAL:
+    case OP_GETGLOBAL: case OP_NEWTABLE: case OP_JMP: case OP_CLOSE:
+    case OP_CLOSURE: case OP_VARARG:
+      return 0;
+    case OP_MOVE: case OP_UNM: case OP_NOT: case OP_LEN: case OP_TESTSET:
+      return (b == r);
+    case OP_GETTABLE: case OP_SELF: return (b == r || rkisreg(c, r));
+    case OP_SETGLOBAL: case OP_SETUPVAL: case OP_TEST: return (a == r);
+    case OP_SETTABLE: return (a == r || rkisreg(b, r) || rkisreg(c, r));
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+    case OP_POW: case OP_EQ: case OP_LT: case OP_LE:
+      return (rkisreg(b, r) || rkisreg(c, r));
+    case OP_CONCAT: return (b <= r && r <= c);
+    case OP_CALL: case OP_TAILCALL: return (r >= a && (b == 0 || r < a+b));
+    case OP_RETURN: return (r >= a && (b == 0 || r < a+b-1));
+    case OP_FORLOOP: case OP_FORPREP: case OP_TFORLOOP:
+      return (a <= r && r <= a+2);
+    case OP_SETLIST: return (r >= a && (b == 0 || r <= a+b));
+    default: return 1;
+  }
+}
+
+
+static void markdata (Proto *f, char *mark, int n) {
+  int pc;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    mark[pc] = 0;
+    if (GET_OPCODE(i) == OP_CLOSURE) {
+      int j;
+      for (j = 0; j < f->p[GETARG_Bx(i)]->nups; j++)
+        mark[++pc] = OPTDATA;
+    }
+    else if (GET_OPCODE(i) == OP_SETLIST && GETARG_C(i) == 0)
+      mark[++pc] = OPTDATA;
+  }
+}
+
+
+static void markentries (Proto *f, char *mark, int n) {
+  int pc;
+  for (pc = 0; pc < n; pc++) mark[pc] &= ~OPTENTRY;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (!islive(mark[pc])) continue;
+    if (getOpMode(op) == iAsBx)
+      mark[jumpdest(i, pc)] |= OPTENTRY;
+    else if (testTMode(op) || (op == OP_LOADBOOL && GETARG_C(i)))
+      mark[pc + 2] |= OPTENTRY;
+  }
+}
+
+
+/* instruction loading constant `v' into register `a' */
+static Instruction loadconst (FuncState *fs, int a, const TValue *v) {
+  if (ttisnil(v))
+    return CREATE_ABC(OP_LOADNIL, a, a, 0);
+  else if (ttisboolean(v))
+    return CREATE_ABC(OP_LOADBOOL, a, bvalue(v), 0);
+  else if (ttisnumber(v))
+    return CREATE_ABx(OP_LOADK, a, luaK_numberK(fs, nvalue(v)));
+  else
+    return CREATE_ABx(OP_LOADK, a, luaK_stringK(fs, rawtsvalue(v)));
+}
+
+
+static int constidx (FuncState *fs, const TValue *v) {
+  if (ttisnil(v)) return nilK(fs);
+  else if (ttisboolean(v)) return boolK(fs, bvalue(v));
+  else if (ttisnumber(v)) return luaK_numberK(fs, nvalue(v));
+  else return luaK_stringK(fs, rawtsvalue(v));
+}
+
+
+/*
+** test at `pc' found to always skip the jump that follows it (`skip')
+** or never to skip it
+*/
+static void foldtest (char *mark, int pc, int skip) {
+  mark[pc] |= OPTDEAD;
+  if (skip) mark[pc + 1] |= OPTDEAD;
+}
+
+
+/* replace reads of register `r' in instruction at `pc' by constant `v' */
+static int substitute (FuncState *fs, char *mark, int pc, int r,
+                       const TValue *v) {
+  Instruction *i = &fs->f->code[pc];
+  OpCode op = GET_OPCODE(*i);
+  int a = GETARG_A(*i);
+  lua_Number nv;
+  switch (op) {
+    case OP_MOVE: {
+      if (GETARG_B(*i) != r) return 0;
+      *i = loadconst(fs, a, v);
+      return 1;
+    }
+    case OP_NOT: {
+      if (GETARG_B(*i) != r) return 0;
+      *i = CREATE_ABC(OP_LOADBOOL, a, l_isfalse(v), 0);
+      return 1;
+    }
+    case OP_UNM: {
+      if (GETARG_B(*i) != r || !ttisnumber(v) ||
+          !optarith(OP_UNM, nvalue(v), nvalue(v), &nv)) return 0;
+      *i = CREATE_ABx(OP_LOADK, a, luaK_numberK(fs, nv));
+      return 1;
+    }
+    case OP_TEST: {  /* if not (R(A) <=> C) then pc++ */
+      if (a != r) return 0;
+      foldtest(mark, pc, (!l_isfalse(v)) != GETARG_C(*i));
+      return 1;
+    }
+    case OP_TESTSET: {  /* if (R(B) <=> C) then R(A) := R(B) else pc++ */
+      if (GETARG_B(*i) != r) return 0;
+      if ((!l_isfalse(v)) == GETARG_C(*i))
+        *i = loadconst(fs, a, v);  /* and take the jump */
+      else
+        foldtest(mark, pc, 1);
+      return 1;
+    }
+    default: {
+      int changed = 0;
+      if (getOpMode(op) != iABC) return 0;
+      if (OP_ADD <= op && op <= OP_POW && !ttisnumber(v))
+        return 0;  /* keep the name of the operand for the error */
+      if (getBMode(op) == OpArgK && rkisreg(GETARG_B(*i), r)) {
+        int k = constidx(fs, v);
+        if (k <= MAXINDEXRK) { SETARG_B(*i, RKASK(k)); changed = 1; }
+      }
+      if (getCMode(op) == OpArgK && rkisreg(GETARG_C(*i), r)) {
+        int k = constidx(fs, v);
+        if (k <= MAXINDEXRK) { SETARG_C(*i, RKASK(k)); changed = 1; }
+      }
+      return changed;
+    }
+  }
+}
+
+
+/*
+** find the instruction that gives local in register `r' (active from
+** `startpc') its value, if it is a constant that reaches `startpc' by
+** every path; returns -1 if there is none
+*/
+static int constinit (Proto *f, char *mark, int startpc, int r) {
+  int pc;
+  for (pc = startpc - 1; pc >= 0 && !(mark[pc + 1] & OPTENTRY); pc--) {
+    Instruction i = f->code[pc];
+    if (mark[pc] & OPTDATA) return -1;
+    if (mark[pc] & OPTDEAD) continue;  /* a no-op */
+    switch (GET_OPCODE(i)) {
+      case OP_LOADK: case OP_LOADNIL: break;
+      case OP_LOADBOOL: if (GETARG_C(i) == 0) break;  /* else */ return -1;
+      default: return -1;
+    }
+    if (setsreg(i, r)) return pc;
+  }
+  return -1;
+}
+
+
+/* replace the reads of locals that are constants in their whole range */
+static int propagate (FuncState *fs, char *mark) {
+  Proto *f = fs->f;
+  int changed = 0;
+  int nactive = 0;
+  int active[LUAI_MAXVARS];  /* `endpc' of active locals (registers) */
+  int v;
+  for (v = 0; v < fs->nlocvars; v++) {
+    int startpc = f->locvars[v].startpc;
+    int endpc = f->locvars[v].endpc;
+    int r, init, pc, reads;
+    TValue k;
+    while (nactive > 0 && active[nactive - 1] <= startpc)
+      nactive--;  /* remove locals that ended before this one */
+    r = nactive;
+    if (nactive < LUAI_MAXVARS) active[nactive++] = endpc;
+    if (startpc == 0 || startpc >= endpc ||
+        (init = constinit(f, mark, startpc, r)) < 0)
+      continue;
+    for (pc = startpc; pc < endpc; pc++) {  /* is it ever assigned? */
+      Instruction i = f->code[pc];
+      if (mark[pc] & OPTDATA) {
+        if (GET_OPCODE(i) == OP_MOVE && GETARG_B(i) == r)
+          break;  /* captured by a closure */
+      }
+      else if (!(mark[pc] & OPTDEAD) && setsreg(i, r))
+        break;
+    }
+    if (pc < endpc) continue;
+    switch (GET_OPCODE(f->code[init])) {
+      case OP_LOADK: setobj(fs->L, &k, &f->k[GETARG_Bx(f->code[init])]); break;
+      case OP_LOADBOOL: setbvalue(&k, GETARG_B(f->code[init])); break;
+      default: setnilvalue(&k); break;
+    }
+    reads = 0;
+    for (pc = startpc; pc < endpc; pc++) {
+      if (!islive(mark[pc])) continue;
+      if (substitute(fs, mark, pc, r, &k)) changed = 1;
+      if (islive(mark[pc]) && readsreg(f->code[pc], r)) reads++;
+    }
+    if (reads == 0 && (GET_OPCODE(f->code[init]) != OP_LOADNIL ||
+                       GETARG_B(f->code[init]) == GETARG_A(f->code[init]))) {
+      mark[init] |= OPTDEAD;  /* nobody reads the local */
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/* are all instructions in [from, to) dead? */
+static int onlydead (char *mark, int from, int to) {
+  if (from > to) return 0;  /* a backward jump */
+  for (; from < to; from++)
+    if (!(mark[from] & OPTDEAD)) return 0;
+  return 1;
+}
+
+
+/*
+** a constant loaded into temporary register `r' only to be used (and
+** overwritten) by the next instruction goes straight into it
+*/
+static int foldtemp (FuncState *fs, char *mark, int pc) {
+  Proto *f = fs->f;
+  Instruction i = f->code[pc];
+  int r = GETARG_A(i);
+  int next = pc + 1;
+  TValue k;
+  switch (GET_OPCODE(i)) {
+    case OP_LOADK: setobj(fs->L, &k, &f->k[GETARG_Bx(i)]); break;
+    case OP_LOADBOOL:
+      if (GETARG_C(i)) return 0;
+      setbvalue(&k, GETARG_B(i));
+      break;
+    case OP_LOADNIL:
+      if (GETARG_B(i) != r) return 0;
+      setnilvalue(&k);
+      break;
+    default: return 0;
+  }
+  while (next < fs->pc && (mark[next] & OPTDEAD) && !(mark[next] & OPTENTRY))
+    next++;  /* skip no-ops */
+  if (next >= fs->pc || !islive(mark[next]) || (mark[next] & OPTENTRY))
+    return 0;
+  switch (GET_OPCODE(f->code[next])) {
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+    case OP_POW: case OP_UNM: case OP_NOT:
+      break;
+    default: return 0;
+  }
+  if (GETARG_A(f->code[next]) != r || !substitute(fs, mark, next, r, &k))
+    return 0;
+  if (!readsreg(f->code[next], r))
+    mark[pc] |= OPTDEAD;
+  return 1;
+}
+
+
+/* fold arithmetic and comparisons on constants */
+static int fold (FuncState *fs, char *mark, int n) {
+  Proto *f = fs->f;
+  int changed = 0;
+  int pc;
+  for (pc = 0; pc < n; pc++) {
+    Instruction *i = &f->code[pc];
+    OpCode op = GET_OPCODE(*i);
+    int b = GETARG_B(*i);
+    int c = GETARG_C(*i);
+    TValue *kb, *kc;
+    lua_Number r;
+    if (!islive(mark[pc])) continue;
+    if (op == OP_JMP && onlydead(mark, pc + 1, jumpdest(*i, pc)) &&
+        (pc == 0 || !islive(mark[pc - 1]) ||
+         !testTMode(GET_OPCODE(f->code[pc - 1])))) {
+      mark[pc] |= OPTDEAD;  /* jump to next (live) instruction */
+      changed = 1;
+      continue;
+    }
+    if (foldtemp(fs, mark, pc)) {
+      changed = 1;
+      continue;
+    }
+    if (getOpMode(op) != iABC || getBMode(op) != OpArgK ||
+        getCMode(op) != OpArgK || !ISK(b) || !ISK(c))
+      continue;
+    kb = &f->k[INDEXK(b)];
+    kc = &f->k[INDEXK(c)];
+    switch (op) {
+      case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+      case OP_POW: {
+        if (!ttisnumber(kb) || !ttisnumber(kc) ||
+            !optarith(op, nvalue(kb), nvalue(kc), &r)) break;
+        *i = CREATE_ABx(OP_LOADK, GETARG_A(*i), luaK_numberK(fs, r));
+        changed = 1;
+        break;
+      }
+      case OP_EQ: {  /* if ((RK(B) == RK(C)) ~= A) then pc++ */
+        foldtest(mark, pc, luaO_rawequalObj(kb, kc) != GETARG_A(*i));
+        changed = 1;
+        break;
+      }
+      case OP_LT: case OP_LE: {
+        int res;
+        if (!ttisnumber(kb) || !ttisnumber(kc)) break;
+        res = (op == OP_LT) ? luai_numlt(nvalue(kb), nvalue(kc))
+                            : luai_numle(nvalue(kb), nvalue(kc));
+        foldtest(mark, pc, res != GETARG_A(*i));
+        changed = 1;
+        break;
+      }
+      default: break;
+    }
+  }
+  return changed;
+}
+
+
+/* mark unreachable instructions as dead */
+static int unreachable (Proto *f, char *mark, int n) {
+  int changed, pc;
+  for (pc = 0; pc < n; pc++) mark[pc] &= ~OPTREACH;
+  mark[0] |= OPTREACH;
+  do {  /* propagate reachability until nothing changes */
+    changed = 0;
+    for (pc = 0; pc < n; pc++) {
+      Instruction i = f->code[pc];
+      OpCode op = GET_OPCODE(i);
+      int next = pc + 1;  /* fall-through successor (-1 if none) */
+      int other = -1;  /* other successor */
+      if (!(mark[pc] & OPTREACH)) continue;
+      if (islive(mark[pc])) {  /* (no-ops and data fall through) */
+        switch (op) {
+          case OP_JMP: case OP_FORPREP: next = -1;  /* go through */
+          case OP_FORLOOP: other = jumpdest(i, pc); break;
+          case OP_RETURN: next = -1; break;
+          case OP_LOADBOOL: if (GETARG_C(i)) next = pc + 2; break;
+          case OP_CLOSURE: case OP_SETLIST: {
+            while (next < n && (mark[next] & OPTDATA))
+              mark[next++] |= OPTREACH;
+            break;
+          }
+          default: if (testTMode(op)) other = pc + 2; break;
+        }
+      }
+      if (next >= 0 && next < n && !(mark[next] & OPTREACH)) {
+        mark[next] |= OPTREACH;
+        if (next < pc) changed = 1;
+      }
+      if (other >= 0 && !(mark[other] & OPTREACH)) {
+        mark[other] |= OPTREACH;
+        if (other < pc) changed = 1;  /* must go over it again */
+      }
+    }
+  } while (changed);
+  for (pc = 0; pc < n - 1; pc++) {  /* (final return always stays) */
+    if (!(mark[pc] & (OPTREACH | OPTDEAD))) {
+      mark[pc] |= OPTDEAD;
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/* number of locals active at `pc' (registers 0 to n-1) */
+static int nactive (FuncState *fs, int pc) {
+  int v, n = 0;
+  for (v = 0; v < fs->nlocvars; v++)
+    if (fs->f->locvars[v].startpc <= pc && pc < fs->f->locvars[v].endpc) n++;
+  return n;
+}
+
+
+/* does instruction `i' surely overwrite register `r'? */
+static int killsreg (Instruction i, int r) {
+  switch (GET_OPCODE(i)) {
+    case OP_TESTSET: case OP_FORLOOP: case OP_FORPREP: case OP_TFORLOOP:
+    case OP_TAILCALL:
+      return 0;  /* writes conditionally or not at all */
+    case OP_CALL: if (GETARG_C(i) == 0) return 0; break;
+    case OP_VARARG: if (GETARG_B(i) == 0) return 0; break;
+    default: break;
+  }
+  return setsreg(i, r);
+}
+
+
+/*
+** is the value in register `r' at `pc' never read? Follows every path
+** until `r' is overwritten, giving up (returning 0) after `*budget'
+** instructions
+*/
+static int deadreg (Proto *f, char *mark, int pc, int r, int *budget) {
+  for (; --(*budget) > 0; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (mark[pc] & OPTDATA) {
+      if (op == OP_MOVE && GETARG_B(i) == r) return 0;  /* captured */
+      continue;
+    }
+    if (mark[pc] & OPTDEAD) continue;
+    if (readsreg(i, r)) return 0;
+    if (killsreg(i, r)) return 1;
+    switch (op) {
+      case OP_JMP: pc = jumpdest(i, pc) - 1; break;
+      case OP_RETURN: case OP_TAILCALL: return 1;
+      case OP_FORLOOP: case OP_FORPREP:
+        return deadreg(f, mark, jumpdest(i, pc), r, budget) &&
+               (op == OP_FORPREP || deadreg(f, mark, pc + 1, r, budget));
+      case OP_LOADBOOL:
+        if (GETARG_C(i)) return deadreg(f, mark, pc + 2, r, budget);
+        break;
+      default:
+        if (testTMode(op) && !deadreg(f, mark, pc + 2, r, budget))
+          return 0;
+        break;
+    }
+  }
+  return 0;
+}
+
+
+/* can instruction `i' have its result register changed? */
+static int retargetable (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_LOADK: case OP_GETUPVAL: case OP_GETGLOBAL:
+    case OP_GETTABLE: case OP_NEWTABLE: case OP_ADD: case OP_SUB:
+    case OP_MUL: case OP_DIV: case OP_MOD: case OP_POW: case OP_UNM:
+    case OP_NOT: case OP_LEN: case OP_CONCAT:
+      return 1;
+    case OP_LOADBOOL: return (GETARG_C(i) == 0);
+    case OP_LOADNIL: return (GETARG_A(i) == GETARG_B(i));
+    case OP_VARARG: return (GETARG_B(i) == 2);
+    default: return 0;
+  }
+}
+
+
+/*
+** `MOVE r t' at `pc' copying a temporary: make the instruction that
+** computed `t' put its result straight into `r'
+*/
+static int coalesce (FuncState *fs, char *mark, const lu_byte *captured,
+                     int pc) {
+  Proto *f = fs->f;
+  int r = GETARG_A(f->code[pc]);
+  int t = GETARG_B(f->code[pc]);
+  int p, budget = MAXOPTPASSES * 8;
+  if (t < nactive(fs, pc)) return 0;  /* not a temporary */
+  for (p = pc - 1; p >= 0; p--) {  /* look for the producer */
+    Instruction i = f->code[p];
+    if (mark[p + 1] & OPTENTRY) return 0;  /* other paths reach `pc' */
+    if (mark[p] & OPTDATA) return 0;
+    if (mark[p] & OPTDEAD) continue;
+    if (setsreg(i, t)) break;
+    if (readsreg(i, r) || readsreg(i, t) || setsreg(i, r) ||
+        GET_OPCODE(i) == OP_CLOSE || testTMode(GET_OPCODE(i)) ||
+        getOpMode(GET_OPCODE(i)) == iAsBx ||
+        (GET_OPCODE(i) == OP_LOADBOOL && GETARG_C(i)))
+      return 0;
+  }
+  if (p < 0 || !retargetable(f->code[p]) || GETARG_A(f->code[p]) != t ||
+      t < nactive(fs, p) || (p > 0 && (mark[p - 1] & OPTDATA) == 0 &&
+                             testTMode(GET_OPCODE(f->code[p - 1]))))
+    return 0;
+  /* someone could see `r' early through an upvalue */
+  if (captured[r] && p < pc - 1) return 0;
+  if (!deadreg(f, mark, pc + 1, t, &budget)) return 0;
+  SETARG_A(f->code[p], r);
+  if (GET_OPCODE(f->code[p]) == OP_LOADNIL) SETARG_B(f->code[p], r);
+  mark[pc] |= OPTDEAD;
+  if (GET_OPCODE(f->code[p]) == OP_MOVE && GETARG_B(f->code[p]) == r)
+    mark[p] |= OPTDEAD;  /* became `MOVE r r' */
+  return 1;
+}
+
+
+/* remove redundant moves */
+static int moves (FuncState *fs, char *mark, int n) {
+  Proto *f = fs->f;
+  lu_byte captured[MAXSTACK];
+  int changed = 0;
+  int pc;
+  memset(captured, 0, sizeof(captured));
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    if ((mark[pc] & OPTDATA) && GET_OPCODE(i) == OP_MOVE)
+      captured[GETARG_B(i)] = 1;
+  }
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    if (!islive(mark[pc]) || GET_OPCODE(i) != OP_MOVE) continue;
+    if (GETARG_A(i) == GETARG_B(i)) {  /* self move? */
+      mark[pc] |= OPTDEAD;
+      changed = 1;
+    }
+    else if (coalesce(fs, mark, captured, pc))
+      changed = 1;
+  }
+  return changed;
+}
+
+
+/* remove dead instructions, correcting jumps and debug information */
+static void compact (FuncState *fs, char *mark, int *newpc, int n) {
+  Proto *f = fs->f;
+  int pc, j = 0;
+  for (pc = 0; pc < n; pc++) {
+    newpc[pc] = j;
+    if (!(mark[pc] & OPTDEAD)) j++;
+  }
+  newpc[n] = j;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    if (mark[pc] & OPTDEAD) continue;
+    if (!(mark[pc] & OPTDATA)) {
+      if (getOpMode(GET_OPCODE(i)) == iAsBx)
+        SETARG_sBx(i, newpc[jumpdest(i, pc)] - (newpc[pc] + 1));
+      else if (GET_OPCODE(i) == OP_LOADBOOL && GETARG_C(i) &&
+               newpc[pc + 2] == newpc[pc] + 1)
+        SETARG_C(i, 0);  /* skipped instruction is gone */
+    }
+    f->code[newpc[pc]] = i;
+    f->lineinfo[newpc[pc]] = f->lineinfo[pc];
+  }
+  for (j = 0; j < fs->nlocvars; j++) {
+    f->locvars[j].startpc = newpc[f->locvars[j].startpc];
+    f->locvars[j].endpc = newpc[f->locvars[j].endpc];
+  }
+  fs->pc = newpc[n];
+}
+
+
+void luaK_optimize (FuncState *fs) {
+  int n = fs->pc;
+  /* scratch space: the scanner does not need its buffer between tokens */
+  int *newpc = cast(int *, luaZ_openspace(fs->L, fs->ls->buff,
+                                          (n + 1) * (sizeof(int) + 1)));
+  char *mark = cast(char *, newpc + n + 1);
+  int pass, changed = 0;
+  markdata(fs->f, mark, n);
+  for (pass = 0; pass < MAXOPTPASSES; pass++) {
+    int c = 0;
+    markentries(fs->f, mark, n);
+    c |= propagate(fs, mark);
+    c |= fold(fs, mark, n);
+    c |= unreachable(fs->f, mark, n);
+    c |= moves(fs, mark, n);
+    if (!c) break;
+    changed = 1;
+  }
+  if (changed)
+    compact(fs, mark, newpc, n);
+}
+
+/* }====================================================== */
@@ -26,6 +26,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lundump.h"
 #include "lvm.h"
 
 
@@ -112,6 +113,7 @@ static Proto *getluaproto (CallInfo *ci) {
 static const char *findlocal (lua_State *L, CallInfo *ci, int n) {
   const char *name;
   Proto *fp = getluaproto(ci);
+  if (fp) luaU_checkdebug(L, fp);
   if (fp && (name = luaF_getlocalname(fp, n, currentpc(L, ci))) != NULL)
     return name;  /* is a local variable in a Lua function */
   else {
@@ -326,6 +328,11 @@ static Instruction symbexec (const Proto *pt, int lastpc, int reg) {
     int b = 0;
     int c = 0;
     check(op < NUM_OPCODES);
+    if (isFusedOp(op)) {  /* check its pair and go on as its first opcode */
+      check(pc+1 < pt->sizecode);
+      check(GET_OPCODE(pt->code[pc+1]) == getFusedNext(op));
+      op = getBaseOp(op);
+    }
     checkreg(pt, a);
     switch (getOpMode(op)) {
       case iABC: {
@@ -500,12 +507,13 @@ static const char *getobjname (lua_State *L, CallInfo *ci, int stackpos,
     Proto *p = ci_func(ci)->l.p;
     int pc = currentpc(L, ci);
     Instruction i;
+    luaU_checkdebug(L, p);
     *name = luaF_getlocalname(p, stackpos+1, pc);
     if (*name)  /* is a local? */
       return "local";
     i = symbexec(p, pc, stackpos);  /* try symbolic execution */
     lua_assert(pc != -1);
-    switch (GET_OPCODE(i)) {
+    switch (getBaseOp(GET_OPCODE(i))) {
       case OP_GETGLOBAL: {
         int g = GETARG_Bx(i);  /* global index */
         lua_assert(ttisstring(&p->k[g]));
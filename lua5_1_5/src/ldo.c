@@ -18,6 +18,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
@@ -126,6 +127,8 @@ int luaD_rawrunprotected (lua_State *L, Pfunc f, void *ud) {
 static void correctstack (lua_State *L, TValue *oldstack) {
   CallInfo *ci;
   GCObject *up;
+  if (L->stack == oldstack)  /* grown in place? */
+    return;  /* nothing to correct */
   L->top = (L->top - oldstack) + L->stack;
   for (up = L->openupval; up != NULL; up = up->gch.next)
     gco2uv(up)->v = (gco2uv(up)->v - oldstack) + L->stack;
@@ -297,6 +300,7 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
     for (st = L->top; st < ci->top; st++)
       setnilvalue(st);
     L->top = ci->top;
+    luaJ_count(L, p);
     if (L->hookmask & LUA_MASKCALL) {
       L->savedpc++;  /* hooks assume 'pc' is already incremented */
       luaD_callhook(L, LUA_HOOKCALL, -1);
@@ -319,8 +323,8 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
     lua_unlock(L);
     n = (*curr_func(L)->c.f)(L);  /* do the actual call */
     lua_lock(L);
-    if (n < 0)  /* yielding? */
-      return PCRYIELD;
+    if (n < 0)  /* yielding or resuming a coroutine? */
+      return (L->resuming != NULL) ? PCRSWITCH : PCRYIELD;
     else {
       luaD_poscall(L, L->top - n);
       return PCRC;
@@ -365,18 +369,30 @@ int luaD_poscall (lua_State *L, StkId firstResult) {
 ** Call a function (C or Lua). The function to be called is at *func.
 ** The arguments are on the stack, right after the function.
 ** When returns, all the results are on the stack, starting at the original
-** function position.
+** function position. `L->base' is restored too: a leaf (see `lua_pushleaf')
+** has one of its own, which `luaD_poscall' does not know.
 */ 
 void luaD_call (lua_State *L, StkId func, int nResults) {
+  ptrdiff_t oldbase = savestack(L, L->base);
   if (++L->nCcalls >= LUAI_MAXCCALLS) {
     if (L->nCcalls == LUAI_MAXCCALLS)
       luaG_runerror(L, "C stack overflow");
     else if (L->nCcalls >= (LUAI_MAXCCALLS + (LUAI_MAXCCALLS>>3)))
       luaD_throw(L, LUA_ERRERR);  /* error while handing stack error */
   }
-  if (luaD_precall(L, func, nResults) == PCRLUA)  /* is a Lua function? */
-    luaV_execute(L, 1);  /* call it */
+  switch (luaD_precall(L, func, nResults)) {
+    case PCRLUA: {  /* is a Lua function? */
+      int n = luaV_execute(L, 1, NULL);  /* call it */
+      if (n > 0) luaD_switch(L, n);  /* it resumed a coroutine */
+      break;
+    }
+    case PCRSWITCH: {  /* C function resumed a coroutine */
+      luaD_switch(L, 0);
+      break;
+    }
+  }
   L->nCcalls--;
+  L->base = restorestack(L, oldbase);
   luaC_checkGC(L);
 }
 
@@ -384,25 +400,29 @@ void luaD_call (lua_State *L, StkId func, int nResults) {
 static void resume (lua_State *L, void *ud) {
   StkId firstArg = cast(StkId, ud);
   CallInfo *ci = L->ci;
+  int n;
   if (L->status == 0) {  /* start coroutine? */
     lua_assert(ci == L->base_ci && firstArg > L->base);
-    if (luaD_precall(L, firstArg - 1, LUA_MULTRET) != PCRLUA)
-      return;
+    switch (luaD_precall(L, firstArg - 1, LUA_MULTRET)) {
+      case PCRLUA: break;
+      case PCRSWITCH: luaD_switch(L, 0);  /* go through */
+      default: return;
+    }
   }
   else {  /* resuming from previous yield */
     lua_assert(L->status == LUA_YIELD);
     L->status = 0;
     if (!f_isLua(ci)) {  /* `common' yield? */
       /* finish interrupted execution of `OP_CALL' */
-      lua_assert(GET_OPCODE(*((ci-1)->savedpc - 1)) == OP_CALL ||
-                 GET_OPCODE(*((ci-1)->savedpc - 1)) == OP_TAILCALL);
       if (luaD_poscall(L, firstArg))  /* complete it... */
         L->top = L->ci->top;  /* and correct top if not multiple results */
+      if (L->ci != L->base_ci) luaV_finishcall(L);
     }
     else  /* yielded inside a hook: just continue its execution */
       L->base = L->ci->base;
   }
-  luaV_execute(L, cast_int(L->ci - L->base_ci));
+  n = luaV_execute(L, cast_int(L->ci - L->base_ci), NULL);
+  if (n > 0) luaD_switch(L, n);
 }
 
 
@@ -453,6 +473,107 @@ LUA_API int lua_yield (lua_State *L, int nresults) {
 }
 
 
+/*
+** {======================================================
+** Stackless coroutines: a C function that ends with `lua_resumek' asks
+** for a coroutine to run. Instead of a nested `lua_resume' (a `setjmp'
+** and a new `luaV_execute' for each level) the VM switches to the
+** coroutine itself; when it yields, returns or fails the continuation
+** runs in the resumer and the VM goes on with it. `luaD_switch' sets up
+** the one handler that catches the errors of all coroutines it runs.
+** =======================================================
+*/
+
+
+/* start or continue the coroutine `L' asked for (see `resume') */
+lua_State *luaD_switchin (lua_State *L, struct lua_longjmp *errorJmp) {
+  lua_State *co = L->resuming;
+  StkId firstArg = co->top - L->nresumeargs;
+  co->resumer = L;
+  co->errorJmp = errorJmp;
+  co->nCcalls = co->baseCcalls = L->nCcalls;
+  if (co->status == 0)  /* start coroutine? */
+    luaD_precall(co, firstArg - 1, LUA_MULTRET);
+  else {  /* resuming from previous yield */
+    co->status = 0;
+    if (!f_isLua(co->ci)) {  /* `common' yield? */
+      luaD_poscall(co, firstArg);  /* complete it... */
+      if (co->ci != co->base_ci)
+        luaV_finishcall(co);  /* ...and the instruction that made it */
+    }
+    else  /* yielded inside a hook: just continue its execution */
+      co->base = co->ci->base;
+  }
+  return co;
+}
+
+
+/* coroutine `co' stopped: run the continuation of its resumer */
+lua_State *luaD_switchback (lua_State *co) {
+  lua_State *L = co->resumer;
+  lua_KFunction k = L->resumek;
+  int n;
+  co->resumer = NULL;
+  co->errorJmp = NULL;
+  L->resuming = NULL;
+  L->resumek = NULL;
+  lua_unlock(L);
+  n = (*k)(L, co->status);
+  lua_lock(L);
+  if (n >= 0)  /* continuation returned? */
+    luaD_poscall(L, L->top - n);
+  return L;
+}
+
+
+/*
+** `L' is in a C function that called `lua_resumek'; `nexeccalls' is the
+** number of its Lua calls to run after that (0 if it was not called from
+** the VM)
+*/
+void luaD_switch (lua_State *L, int nexeccalls) {
+  struct lua_longjmp lj;
+  Switch sw;
+  lua_State *co = L;
+  sw.L = L;
+  sw.nexeccalls = nexeccalls;
+  sw.errorJmp = &lj;
+  lj.previous = NULL;
+  for (;;) {
+    lj.status = 0;
+    LUAI_TRY(L, &lj,
+      luaV_execute(co, sw.nexeccalls, &sw);
+    );
+    if (lj.status == 0) break;
+    /* a coroutine failed: kill it (see `lua_resume') and go back */
+    for (co = L; co->resuming != NULL; co = co->resuming) ;
+    lua_assert(co != L && co->errorJmp == &lj);
+    co->status = cast_byte(lj.status);
+    luaD_seterrorobj(co, lj.status, co->top);
+    co->ci->top = co->top;
+  }
+}
+
+
+LUA_API int lua_resumek (lua_State *L, lua_State *co, int narg,
+                         lua_KFunction k) {
+  lua_lock(L);
+  if (co->status != LUA_YIELD && (co->status != 0 || co->ci != co->base_ci)) {
+    lua_unlock(L);
+    return (*k)(L, lua_resume(co, narg));  /* let it build the error */
+  }
+  luai_userstateresume(co, narg);
+  lua_assert(co->errfunc == 0 && L->resuming == NULL);
+  L->resuming = co;
+  L->nresumeargs = narg;
+  L->resumek = k;
+  lua_unlock(L);
+  return -1;
+}
+
+/* }====================================================== */
+
+
 int luaD_pcall (lua_State *L, Pfunc func, void *u,
                 ptrdiff_t old_top, ptrdiff_t ef) {
   int status;
@@ -486,6 +607,9 @@ struct SParser {  /* data to `f_parser' */
   ZIO *z;
   Mbuffer buff;  /* buffer to be used by the scanner */
   const char *name;
+  int opt;  /* optimize the code? */
+  const Image *img;  /* binary chunk to load instead of `z' */
+  Image *loader;  /* its copy used by the loader */
 };
 
 static void f_parser (lua_State *L, void *ud) {
@@ -493,10 +617,13 @@ static void f_parser (lua_State *L, void *ud) {
   Proto *tf;
   Closure *cl;
   struct SParser *p = cast(struct SParser *, ud);
-  int c = luaZ_lookahead(p->z);
   luaC_checkGC(L);
-  tf = ((c == LUA_SIGNATURE[0]) ? luaU_undump : luaY_parser)(L, p->z,
-                                                             &p->buff, p->name);
+  if (p->img)
+    tf = luaU_undumpimage(L, p->img, &p->loader, p->name);
+  else if (luaZ_lookahead(p->z) == LUA_SIGNATURE[0])
+    tf = luaU_undump(L, p->z, &p->buff, p->name);
+  else
+    tf = luaY_parser(L, p->z, &p->buff, p->name, p->opt);
   cl = luaF_newLclosure(L, tf->nups, hvalue(gt(L)));
   cl->l.p = tf;
   for (i = 0; i < tf->nups; i++)  /* initialize eventual upvalues */
@@ -506,13 +633,30 @@ static void f_parser (lua_State *L, void *ud) {
 }
 
 
-int luaD_protectedparser (lua_State *L, ZIO *z, const char *name) {
+int luaD_protectedparser (lua_State *L, ZIO *z, const char *name, int opt) {
+  struct SParser p;
+  int status;
+  p.z = z; p.name = name; p.opt = opt;
+  p.img = NULL;
+  luaZ_initbuffer(L, &p.buff);
+  status = luaD_pcall(L, f_parser, &p, savestack(L, L->top), L->errfunc);
+  luaZ_freebuffer(L, &p.buff);
+  return status;
+}
+
+
+int luaD_protectedimage (lua_State *L, const Image *img, const char *name) {
   struct SParser p;
   int status;
-  p.z = z; p.name = name;
+  p.z = NULL; p.name = name; p.opt = 0;
+  p.img = img; p.loader = NULL;
   luaZ_initbuffer(L, &p.buff);
   status = luaD_pcall(L, f_parser, &p, savestack(L, L->top), L->errfunc);
   luaZ_freebuffer(L, &p.buff);
+  if (p.loader)
+    luaF_dropimage(L, p.loader);  /* functions loaded keep their own refs */
+  else  /* could not even copy it */
+    (*img->release)(img->ud, img->p, img->size);
   return status;
 }
 
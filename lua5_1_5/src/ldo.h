@@ -32,15 +32,31 @@
 #define PCRLUA		0	/* initiated a call to a Lua function */
 #define PCRC		1	/* did a call to a C function */
 #define PCRYIELD	2	/* C funtion yielded */
+#define PCRSWITCH	3	/* C function called `lua_resumek' */
+
+
+/* a coroutine switch in progress (see `luaD_switch') */
+typedef struct Switch {
+  lua_State *L;  /* thread that started it */
+  int nexeccalls;  /* its Lua calls run by the VM (see `luaV_execute') */
+  struct lua_longjmp *errorJmp;  /* handler of the coroutines it runs */
+} Switch;
 
 
 /* type of protected functions, to be ran by `runprotected' */
 typedef void (*Pfunc) (lua_State *L, void *ud);
 
-LUAI_FUNC int luaD_protectedparser (lua_State *L, ZIO *z, const char *name);
+LUAI_FUNC int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
+                                   int opt);
+LUAI_FUNC int luaD_protectedimage (lua_State *L, const Image *img,
+                                   const char *name);
 LUAI_FUNC void luaD_callhook (lua_State *L, int event, int line);
 LUAI_FUNC int luaD_precall (lua_State *L, StkId func, int nresults);
 LUAI_FUNC void luaD_call (lua_State *L, StkId func, int nResults);
+LUAI_FUNC void luaD_switch (lua_State *L, int nexeccalls);
+LUAI_FUNC lua_State *luaD_switchin (lua_State *L,
+                                    struct lua_longjmp *errorJmp);
+LUAI_FUNC lua_State *luaD_switchback (lua_State *co);
 LUAI_FUNC int luaD_pcall (lua_State *L, Pfunc func, void *u,
                                         ptrdiff_t oldtop, ptrdiff_t ef);
 LUAI_FUNC int luaD_poscall (lua_State *L, StkId firstResult);
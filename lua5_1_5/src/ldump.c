@@ -5,14 +5,19 @@
 */
 
 #include <stddef.h>
+#include <string.h>
 
 #define ldump_c
 #define LUA_CORE
 
 #include "lua.h"
 
+#include "ldo.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
 #include "lundump.h"
 
 typedef struct {
@@ -20,6 +25,11 @@ typedef struct {
  lua_Writer writer;
  void* data;
  int strip;
+ int image;				/* align vectors for mapping? */
+ int compact;				/* LUAC_COMPACT encoding? */
+ Table* pool;				/* strings dumped so far (compact) */
+ int npool;				/* number of strings in pool */
+ size_t pos;				/* bytes written so far */
  int status;
 } DumpState;
 
@@ -28,12 +38,20 @@ typedef struct {
 
 static void DumpBlock(const void* b, size_t size, DumpState* D)
 {
- if (D->status==0)
+ if (D->writer!=NULL && D->status==0)
  {
   lua_unlock(D->L);
   D->status=(*D->writer)(D->L,b,size,D->data);
   lua_lock(D->L);
  }
+ D->pos+=size;
+}
+
+static void DumpAlign(DumpState* D)
+{
+ static const char pad[LUAC_IMAGEALIGN]={0};
+ if (D->image)
+  DumpBlock(pad,(LUAC_IMAGEALIGN-D->pos%LUAC_IMAGEALIGN)%LUAC_IMAGEALIGN,D);
 }
 
 static void DumpChar(int y, DumpState* D)
@@ -42,9 +60,33 @@ static void DumpChar(int y, DumpState* D)
  DumpVar(x,D);
 }
 
+/* 7 bits per byte, least significant first; high bit set if more follow */
+static char* PutSize(char* p, size_t x)
+{
+ for (; x>=0x80; x>>=7) *p++=(char)(x|0x80);
+ *p++=(char)x;
+ return p;
+}
+
+static void DumpSize(size_t x, DumpState* D)
+{
+ char b[(sizeof(size_t)*CHAR_BIT+6)/7];
+ DumpBlock(b,PutSize(b,x)-b,D);
+}
+
+/* zigzag: small negative numbers stay small too */
+static void DumpSigned(int x, DumpState* D)
+{
+ DumpSize((x<0) ? ((size_t)-(x+1)<<1)|1 : (size_t)x<<1,D);
+}
+
 static void DumpInt(int x, DumpState* D)
 {
- DumpVar(x,D);
+ lua_assert(x>=0);
+ if (D->compact)
+  DumpSize(x,D);
+ else
+  DumpVar(x,D);
 }
 
 static void DumpNumber(lua_Number x, DumpState* D)
@@ -55,12 +97,56 @@ static void DumpNumber(lua_Number x, DumpState* D)
 static void DumpVector(const void* b, int n, size_t size, DumpState* D)
 {
  DumpInt(n,D);
+ DumpAlign(D);
  DumpMem(b,n,size,D);
 }
 
+/* can x be dumped as an int? (not -0) */
+static int IsInt(lua_Number x)
+{
+ lua_Number z=0;
+ int i;
+ if (!(x>=-INT_MAX && x<=INT_MAX)) return 0;
+ lua_number2int(i,x);
+ return cast_num(i)==x && (i!=0 || memcmp(&x,&z,sizeof(x))==0);
+}
+
+/*
+** compact chunks number strings as they first appear: 0 is NULL, a
+** number not seen yet is followed by the length and bytes of the string
+*/
+static void DumpPooled(const TString* s, DumpState* D)
+{
+ if (s==NULL)
+  DumpSize(0,D);
+ else
+ {
+  TValue* idx=luaH_setstr(D->L,D->pool,(TString*)s);
+  if (ttisnumber(idx))
+   DumpSize((size_t)nvalue(idx),D);
+  else
+  {
+   setnvalue(idx,cast_num(++D->npool));
+   DumpSize(D->npool,D);
+   DumpSize(s->tsv.len,D);
+   DumpBlock(getstr(s),s->tsv.len,D);
+  }
+ }
+}
+
+static void NewPool(DumpState* D)
+{
+ D->pool=luaH_new(D->L,0,0);
+ D->npool=0;
+ sethvalue2s(D->L,D->L->top,D->pool);
+ incr_top(D->L);
+}
+
 static void DumpString(const TString* s, DumpState* D)
 {
- if (s==NULL || getstr(s)==NULL)
+ if (D->compact)
+  DumpPooled(s,D);
+ else if (s==NULL || getstr(s)==NULL)
  {
   size_t size=0;
   DumpVar(size,D);
@@ -77,6 +163,21 @@ static void DumpString(const TString* s, DumpState* D)
 
 static void DumpFunction(const Proto* f, const TString* p, DumpState* D);
 
+/* where each nested function will start and where the last one ends */
+static void DumpOffsets(const Proto* f, DumpState* D)
+{
+ DumpState M=*D;
+ int i;
+ M.writer=NULL;				/* only count bytes */
+ M.pos+=(f->sizep+1)*sizeof(size_t);
+ for (i=0; i<=f->sizep; i++)
+ {
+  size_t offset=M.pos;
+  DumpVar(offset,D);
+  if (i<f->sizep && D->writer!=NULL) DumpFunction(f->p[i],f->source,&M);
+ }
+}
+
 static void DumpConstants(const Proto* f, DumpState* D)
 {
  int i,n=f->sizek;
@@ -84,8 +185,10 @@ static void DumpConstants(const Proto* f, DumpState* D)
  for (i=0; i<n; i++)
  {
   const TValue* o=&f->k[i];
-  DumpChar(ttype(o),D);
-  switch (ttype(o))
+  int t=ttype(o);
+  if (t==LUA_TNUMBER && D->compact && IsInt(nvalue(o))) t=LUAC_TINT;
+  DumpChar(t,D);
+  switch (t)
   {
    case LUA_TNIL:
 	break;
@@ -95,6 +198,9 @@ static void DumpConstants(const Proto* f, DumpState* D)
    case LUA_TNUMBER:
 	DumpNumber(nvalue(o),D);
 	break;
+   case LUAC_TINT:
+	DumpSigned(cast_int(nvalue(o)),D);
+	break;
    case LUA_TSTRING:
 	DumpString(rawtsvalue(o),D);
 	break;
@@ -105,14 +211,33 @@ static void DumpConstants(const Proto* f, DumpState* D)
  }
  n=f->sizep;
  DumpInt(n,D);
+ if (D->image) DumpOffsets(f,D);
  for (i=0; i<n; i++) DumpFunction(f->p[i],f->source,D);
 }
 
+/* compact chunks keep each line as its difference from the previous one */
+static void DumpLines(const Proto* f, int n, DumpState* D)
+{
+ if (D->compact)
+ {
+  int i,last=f->linedefined;
+  DumpInt(n,D);
+  for (i=0; i<n; i++)
+  {
+   DumpSigned(f->lineinfo[i]-last,D);
+   last=f->lineinfo[i];
+  }
+ }
+ else
+  DumpVector(f->lineinfo,n,sizeof(int),D);
+}
+
 static void DumpDebug(const Proto* f, DumpState* D)
 {
  int i,n;
- n= (D->strip) ? 0 : f->sizelineinfo;
- DumpVector(f->lineinfo,n,sizeof(int),D);
+ if (!D->strip) luaU_checkdebug(D->L,(Proto*)f);
+ n= (D->strip==1) ? 0 : f->sizelineinfo;
+ DumpLines(f,n,D);
  n= (D->strip) ? 0 : f->sizelocvars;
  DumpInt(n,D);
  for (i=0; i<n; i++)
@@ -128,7 +253,8 @@ static void DumpDebug(const Proto* f, DumpState* D)
 
 static void DumpFunction(const Proto* f, const TString* p, DumpState* D)
 {
- DumpString((f->source==p || D->strip) ? NULL : f->source,D);
+ luaU_checkbody(D->L,(Proto*)f);
+ DumpString((f->source==p || D->strip==1) ? NULL : f->source,D);
  DumpInt(f->linedefined,D);
  DumpInt(f->lastlinedefined,D);
  DumpChar(f->nups,D);
@@ -140,25 +266,159 @@ static void DumpFunction(const Proto* f, const TString* p, DumpState* D)
  DumpDebug(f,D);
 }
 
-static void DumpHeader(DumpState* D)
+/* log2 of the size of the hash table of the compressor */
+#define LZHASH		14
+
+/* farthest match of the compressor */
+#define LZWINDOW	65535
+
+/* most bytes that n bytes compress to */
+#define LZBOUND(n)	((n)+(n)/8+16)
+
+static size_t Hash(const char* s)
+{
+ unsigned long x=(unsigned long)(unsigned char)s[0]
+  | (unsigned long)(unsigned char)s[1]<<8
+  | (unsigned long)(unsigned char)s[2]<<16
+  | (unsigned long)(unsigned char)s[3]<<24;
+ return (size_t)(((x*2654435761UL)&0xFFFFFFFFUL)>>(32-LZHASH));
+}
+
+static char* Literals(char* p, const char* s, size_t n)
+{
+ if (n==0) return p;
+ p=PutSize(p,n<<1);
+ memcpy(p,s,n);
+ return p+n;
+}
+
+/*
+** LZ77 with a hash table of the last position of each 4 bytes: tokens
+** are sizes, t>>1 literal bytes follow an even t and an odd t is a match
+** of (t>>1)+LUAC_LZMIN bytes at the distance in the next size; a match
+** is never longer than the bytes it replaces
+*/
+static size_t Compress(const char* s, size_t n, char* b, size_t* head)
+{
+ char* p=b;
+ size_t i=0,lit=0;
+ memset(head,0,sizeof(size_t)<<LZHASH);
+ while (i+LUAC_LZMIN<=n)
+ {
+  size_t* h=head+Hash(s+i);
+  size_t m=*h-1,d=i-m,len=0;
+  *h=i+1;
+  if (m<i && d<=LZWINDOW)
+   while (i+len<n && s[m+len]==s[i+len]) len++;
+  if (len>=LUAC_LZMIN && (d<(1<<14) || len>LUAC_LZMIN))
+  {
+   p=Literals(p,s+lit,i-lit);
+   p=PutSize(p,((len-LUAC_LZMIN)<<1)|1);
+   p=PutSize(p,d);
+   for (i++,len--; len>0; i++,len--)
+    if (i+LUAC_LZMIN<=n) head[Hash(s+i)]=i+1;
+   lit=i;
+  }
+  else
+   i++;
+ }
+ p=Literals(p,s+lit,n-lit);
+ lua_assert((size_t)(p-b)<=LZBOUND(n));
+ return p-b;
+}
+
+static int Store(lua_State* L, const void* b, size_t size, void* data)
+{
+ char** p=(char**)data;
+ UNUSED(L);
+ memcpy(*p,b,size);
+ *p+=size;
+ return 0;
+}
+
+/*
+** dump f compact to memory, after counting how much that takes, and
+** compress its n bytes there; the memory is a userdata on the stack
+*/
+static const char* Pack(const Proto* f, DumpState* D, size_t* n, size_t* size)
+{
+ lua_State* L=D->L;
+ DumpState M=*D;
+ char *b,*p;
+ Udata* u;
+ M.writer=NULL;				/* only count bytes */
+ NewPool(&M);
+ DumpFunction(f,NULL,&M);
+ *n=M.pos-D->pos;
+ u=luaS_newudata(L,(sizeof(size_t)<<LZHASH)+*n+LZBOUND(*n),hvalue(gt(L)));
+ setuvalue(L,L->top,u); incr_top(L);
+ b=p=cast(char*,u+1)+(sizeof(size_t)<<LZHASH);
+ M.writer=Store;
+ M.data=&p;
+ NewPool(&M);
+ DumpFunction(f,NULL,&M);
+ *size=Compress(b,*n,b+*n,cast(size_t*,u+1));
+ return b+*n;
+}
+
+/* does f or a function nested in it use fused opcodes? */
+static int Fused(lua_State* L, const Proto* f)
+{
+ int i;
+ luaU_checkbody(L,(Proto*)f);
+ for (i=0; i<f->sizecode; i++)
+  if (isFusedOp(GET_OPCODE(f->code[i]))) return 1;
+ for (i=0; i<f->sizep; i++)
+  if (Fused(L,f->p[i])) return 1;
+ return 0;
+}
+
+static void DumpHeader(const Proto* f, int format, DumpState* D)
 {
  char h[LUAC_HEADERSIZE];
  luaU_header(h);
+ if (Fused(D->L,f)) format|=LUAC_FUSED;
+ h[LUAC_FORMATPOS]=(char)format;
  DumpBlock(h,LUAC_HEADERSIZE,D);
 }
 
 /*
-** dump Lua function as precompiled chunk
+** dump Lua function as precompiled chunk; what it anchors on the stack
+** goes before the first write and is removed from below whatever the
+** writer left there (the buffer of string.dump)
 */
-int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip)
+int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip, int format)
 {
  DumpState D;
+ ptrdiff_t top=savestack(L,L->top);
+ const char* b=NULL;
+ size_t size=0,packed=0;
+ StkId o;
+ int n;
  D.L=L;
  D.writer=w;
  D.data=data;
  D.strip=strip;
+ D.image=(format==LUAC_IMAGE);
+ D.compact=(format==LUAC_COMPACT || format==LUAC_COMPRESSED);
+ D.pool=NULL;
+ D.npool=0;
+ D.pos=0;
  D.status=0;
- DumpHeader(&D);
- DumpFunction(f,NULL,&D);
+ if (format==LUAC_COMPRESSED)
+  b=Pack(f,&D,&size,&packed);
+ else if (D.compact)
+  NewPool(&D);
+ n=cast_int(L->top-restorestack(L,top));
+ DumpHeader(f,format,&D);
+ if (b!=NULL)
+ {
+  DumpSize(size,&D);
+  DumpBlock(b,packed,&D);
+ }
+ else
+  DumpFunction(f,NULL,&D);
+ for (o=restorestack(L,top); o+n<L->top; o++) setobjs2s(L,o,o+n);
+ L->top-=n;
  return D.status;
 }
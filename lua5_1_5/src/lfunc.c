@@ -14,6 +14,7 @@
 
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -129,8 +130,18 @@ Proto *luaF_newproto (lua_State *L) {
   f->is_vararg = 0;
   f->maxstacksize = 0;
   f->lineinfo = NULL;
+  f->icache = NULL;
+  f->sizeicache = 0;
+#if defined(LUA_USE_JIT)
+  f->jit = NULL;
+  f->jitfunc = NULL;
+  f->jitcalls = 0;
+#endif
   f->sizelocvars = 0;
   f->locvars = NULL;
+  f->image = NULL;
+  f->debug = NULL;
+  f->body = NULL;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
@@ -138,17 +149,44 @@ Proto *luaF_newproto (lua_State *L) {
 }
 
 
+/*
+** create the inline caches of a prototype whose code is complete; each
+** one holds the node where a string key was last found (see lvm.c)
+*/
+void luaF_initcache (lua_State *L, Proto *f) {
+  int i;
+  f->icache = luaM_newvector(L, f->sizecode, int);
+  f->sizeicache = f->sizecode;
+  for (i = 0; i < f->sizecode; i++) f->icache[i] = 0;
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
-  luaM_freearray(L, f->code, f->sizecode, Instruction);
+#if defined(LUA_USE_JIT)
+  luaJ_freeproto(L, f);
+#endif
+  if (f->image) luaF_dropimage(L, f->image);
+  else {
+    luaM_freearray(L, f->code, f->sizecode, Instruction);
+    luaM_freearray(L, f->lineinfo, f->sizelineinfo, int);
+  }
   luaM_freearray(L, f->p, f->sizep, Proto *);
   luaM_freearray(L, f->k, f->sizek, TValue);
-  luaM_freearray(L, f->lineinfo, f->sizelineinfo, int);
+  luaM_freearray(L, f->icache, f->sizeicache, int);
   luaM_freearray(L, f->locvars, f->sizelocvars, struct LocVar);
   luaM_freearray(L, f->upvalues, f->sizeupvalues, TString *);
   luaM_free(L, f);
 }
 
 
+void luaF_dropimage (lua_State *L, Image *img) {
+  if (--img->nref == 0) {
+    (*img->release)(img->ud, img->p, img->size);
+    luaM_free(L, img);
+  }
+}
+
+
 void luaF_freeclosure (lua_State *L, Closure *c) {
   int size = (c->c.isC) ? sizeCclosure(c->c.nupvalues) :
                           sizeLclosure(c->l.nupvalues);
@@ -6,6 +6,10 @@
 
 #include <string.h>
 
+#if defined(LUA_USE_BGSWEEP)
+#include <pthread.h>
+#endif
+
 #define lgc_c
 #define LUA_CORE
 
@@ -27,9 +31,10 @@
 #define GCSWEEPMAX	40
 #define GCSWEEPCOST	10
 #define GCFINALIZECOST	100
+#define GCTRAVMAX	1024
 
 
-#define maskmarks	cast_byte(~(bitmask(BLACKBIT)|WHITEBITS))
+#define maskmarks	cast_byte(~(bitmask(BLACKBIT)|bitmask(OLDBIT)|WHITEBITS))
 
 #define makewhite(g,x)	\
    ((x)->gch.marked = cast_byte(((x)->gch.marked & maskmarks) | luaC_white(g)))
@@ -131,6 +136,8 @@ size_t luaC_separateudata (lua_State *L, int all) {
   GCObject **p = &g->mainthread->next;
   GCObject *curr;
   while ((curr = *p) != NULL) {
+    if (isold(curr) && !all)  /* (only in generational mode) */
+      break;  /* all remaining udata are old, so not dead */
     if (!(iswhite(curr) || all) || isfinalized(gco2u(curr)))
       p = &curr->gch.next;  /* don't bother with them */
     else if (fasttm(L, gco2u(curr)->metatable, TM_GC) == NULL) {
@@ -175,6 +182,19 @@ static int traversetable (global_State *g, Table *h) {
     }
   }
   if (weakkey && weakvalue) return 1;
+#if defined(LUA_USE_SHAPES)
+  if (h->shape != NULL && !weakvalue) {  /* keys are marked by `markshapes' */
+    i = h->shape->nkeys;
+    while (i--)
+      markvalue(g, &h->fields[i]);
+  }
+#endif
+  if (!weakkey && !weakvalue && g->partial == NULL &&
+      h->sizearray + sizenode(h) > GCTRAVMAX) {  /* big strong table? */
+    g->partial = obj2gco(h);  /* traverse its slots in pieces */
+    g->partialpos = 0;
+    return 0;
+  }
   if (!weakvalue) {
     i = h->sizearray;
     while (i--)
@@ -196,6 +216,38 @@ static int traversetable (global_State *g, Table *h) {
 }
 
 
+/*
+** traverse the next GCTRAVMAX slots (array part, then hash part) of
+** `g->partial'. The table is already black, so a write into it goes
+** through `luaC_barrierback' as for any traversed table; a resize
+** (which moves entries around) starts its traversal again.
+*/
+static l_mem traversepartial (global_State *g) {
+  Table *h = gco2h(g->partial);
+  int i = g->partialpos;
+  int lim = h->sizearray + sizenode(h);
+  if (lim - i > GCTRAVMAX)
+    lim = i + GCTRAVMAX;
+  else
+    g->partial = NULL;  /* last piece */
+  g->partialpos = lim;
+  for (; i < lim && i < h->sizearray; i++)
+    markvalue(g, &h->array[i]);
+  for (; i < lim; i++) {
+    Node *n = gnode(h, i - h->sizearray);
+    lua_assert(ttype(gkey(n)) != LUA_TDEADKEY || ttisnil(gval(n)));
+    if (ttisnil(gval(n)))
+      removeentry(n);  /* remove empty entries */
+    else {
+      lua_assert(!ttisnil(gkey(n)));
+      markvalue(g, gkey(n));
+      markvalue(g, gval(n));
+    }
+  }
+  return GCTRAVMAX * sizeof(TValue);
+}
+
+
 /*
 ** All marks are conditional because a GC may happen while the
 ** prototype is still being created
@@ -243,11 +295,13 @@ static void checkstacksizes (lua_State *L, StkId max) {
   int s_used = cast_int(max - L->stack);  /* part of stack in use */
   if (L->size_ci > LUAI_MAXCALLS)  /* handling overflow? */
     return;  /* do not touch the stacks */
-  if (4*ci_used < L->size_ci && 2*BASIC_CI_SIZE < L->size_ci)
+  if (4*ci_used < L->size_ci && 2*BASIC_CI_SIZE < L->size_ci &&
+      L->minci <= L->size_ci/2)
     luaD_reallocCI(L, L->size_ci/2);  /* still big enough... */
   condhardstacktests(luaD_reallocCI(L, ci_used + 1));
   if (4*s_used < L->stacksize &&
-      2*(BASIC_STACK_SIZE+EXTRA_STACK) < L->stacksize)
+      2*(BASIC_STACK_SIZE+EXTRA_STACK) < L->stacksize &&
+      L->minstack <= L->stacksize/2)
     luaD_reallocstack(L, L->stacksize/2);  /* still big enough... */
   condhardstacktests(luaD_reallocstack(L, s_used));
 }
@@ -276,6 +330,8 @@ static void traversestack (global_State *g, lua_State *l) {
 */
 static l_mem propagatemark (global_State *g) {
   GCObject *o = g->gray;
+  if (g->partial != NULL)  /* finish big table first */
+    return traversepartial(g);
   lua_assert(isgray(o));
   gray2black(o);
   switch (o->gch.tt) {
@@ -284,8 +340,11 @@ static l_mem propagatemark (global_State *g) {
       g->gray = h->gclist;
       if (traversetable(g, h))  /* table is weak? */
         black2gray(o);  /* keep it gray */
+      if (g->partial == o)  /* slots will be traversed later? */
+        return sizeof(Table) + sizeof(TValue) * sizefields(h);
       return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                             sizeof(Node) * sizenode(h);
+                             sizeof(Node) * sizenode(h) +
+                             sizeof(TValue) * sizefields(h);
     }
     case LUA_TFUNCTION: {
       Closure *cl = gco2cl(o);
@@ -312,6 +371,7 @@ static l_mem propagatemark (global_State *g) {
                              sizeof(Proto *) * p->sizep +
                              sizeof(TValue) * p->sizek + 
                              sizeof(int) * p->sizelineinfo +
+                             sizeof(int) * p->sizeicache +
                              sizeof(LocVar) * p->sizelocvars +
                              sizeof(TString *) * p->sizeupvalues;
     }
@@ -322,7 +382,7 @@ static l_mem propagatemark (global_State *g) {
 
 static size_t propagateall (global_State *g) {
   size_t m = 0;
-  while (g->gray) m += propagatemark(g);
+  while (g->gray || g->partial) m += propagatemark(g);
   return m;
 }
 
@@ -360,6 +420,16 @@ static void cleartable (GCObject *l) {
         if (iscleared(o, 0))  /* value was collected? */
           setnilvalue(o);  /* remove value */
       }
+#if defined(LUA_USE_SHAPES)
+      if (h->shape != NULL) {
+        i = h->shape->nkeys;
+        while (i--) {
+          TValue *o = &h->fields[i];
+          if (iscleared(o, 0))  /* value was collected? */
+            setnilvalue(o);  /* remove value */
+        }
+      }
+#endif
     }
     i = sizenode(h);
     while (i--) {
@@ -387,7 +457,7 @@ static void freeobj (lua_State *L, GCObject *o) {
       break;
     }
     case LUA_TSTRING: {
-      G(L)->strt.nuse--;
+      if (!islong(rawgco2ts(o))) G(L)->strt.nuse--;
       luaM_freemem(L, o, sizestring(gco2ts(o)));
       break;
     }
@@ -428,6 +498,29 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
 }
 
 
+/*
+** sweep list `p' up to its first old object, making the survivors old
+** (generational mode). New objects are always linked at the front of
+** their lists, so that everything after that object is old too.
+** Open upvalues are not swept here; dead ones are freed by `luaF_close'.
+*/
+static void sweepyoung (lua_State *L, GCObject **p) {
+  GCObject *curr;
+  global_State *g = G(L);
+  int deadmask = otherwhite(g);
+  while ((curr = *p) != NULL && !isold(curr)) {
+    if ((curr->gch.marked ^ WHITEBITS) & deadmask) {  /* not dead? */
+      l_setbit(curr->gch.marked, OLDBIT);  /* it keeps its color */
+      p = &curr->gch.next;
+    }
+    else {  /* must erase `curr' */
+      *p = curr->gch.next;
+      freeobj(L, curr);
+    }
+  }
+}
+
+
 static void checkSizes (lua_State *L) {
   global_State *g = G(L);
   /* check size of string hash */
@@ -480,13 +573,189 @@ void luaC_callGCTM (lua_State *L) {
 }
 
 
+#if defined(LUA_USE_BGSWEEP)
+
+/*
+** {======================================================
+** Background sweep
+** At the end of the atomic phase the objects in `rootgc' (everything
+** before the main thread, after which come the userdata) are handed to
+** a helper thread, which frees the dead ones and whitens the others
+** while the interpreter goes on sweeping the string table, the userdata
+** and the objects created meanwhile. The helper frees memory through a
+** shadow state, so `totalbytes' is adjusted only when the sweep is
+** joined; dead objects whose freeing touches shared structures
+** (threads, tables with a shape, functions holding an image or native
+** code) are also left for that moment. Open upvalues of live threads
+** are swept when the helper starts. While it runs the barriers do
+** nothing (see `nobarrier'): they are not needed in the sweep phases
+** and must not touch the marks the helper writes.
+** =======================================================
+*/
+
+typedef struct BGSweep {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  int done;  /* helper has finished (protected by `lock') */
+  int joinable;  /* `thread' was created */
+  GCObject *list;  /* objects handed to the helper (later, survivors) */
+  GCObject **last;  /* end of `list' (slot pointing to `stop') */
+  GCObject *stop;  /* main thread: end of the helper's part */
+  GCObject *deferred;  /* dead objects left to the interpreter */
+  lu_mem total;  /* `totalbytes' of the shadow state when started */
+  global_State g;  /* shadow state for the helper */
+  lua_State L;
+} BGSweep;
+
+
+static int mustdefer (GCObject *o) {
+  switch (o->gch.tt) {
+    case LUA_TTHREAD: return 1;
+#if defined(LUA_USE_JIT)
+    case LUA_TPROTO:  /* traces share code pages (see ljit.c) */
+      return (gco2p(o)->image != NULL || gco2p(o)->jit != NULL ||
+              gco2p(o)->jitfunc != NULL);
+#else
+    case LUA_TPROTO: return (gco2p(o)->image != NULL);
+#endif
+#if defined(LUA_USE_SHAPES)
+    case LUA_TTABLE: return (gco2h(o)->shape != NULL);
+#endif
+    default: return 0;
+  }
+}
+
+
+static void *bgsweepf (void *ud) {
+  BGSweep *s = cast(BGSweep *, ud);
+  lua_State *L = &s->L;
+  global_State *g = &s->g;
+  int deadmask = otherwhite(g);
+  GCObject **p = &s->list;
+  GCObject *curr;
+  while ((curr = *p) != s->stop) {
+    if ((curr->gch.marked ^ WHITEBITS) & deadmask) {  /* not dead? */
+      makewhite(g, curr);  /* make it white (for next cycle) */
+      p = &curr->gch.next;
+    }
+    else {  /* must erase `curr' */
+      *p = curr->gch.next;
+      if (mustdefer(curr)) {
+        curr->gch.next = s->deferred;
+        s->deferred = curr;
+      }
+      else
+        freeobj(L, curr);
+    }
+  }
+  s->last = p;
+  pthread_mutex_lock(&s->lock);
+  s->done = 1;
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+
+static void bgstart (lua_State *L) {
+  global_State *g = G(L);
+  BGSweep *s = g->bgsweep;
+  GCObject *o = g->grayagain;
+  lua_assert(g->gcstate == GCSsweepstring && !g->bgrunning);
+  if (g->rootgc == obj2gco(g->mainthread))
+    return;  /* nothing to hand over */
+  if (s == NULL) {
+    s = luaM_new(L, BGSweep);
+    memset(s, 0, sizeof(BGSweep));
+    pthread_mutex_init(&s->lock, NULL);
+    g->bgsweep = s;
+  }
+  while (o != NULL) {  /* sweep open upvalues of live threads */
+    if (o->gch.tt == LUA_TTHREAD) {
+      sweepwholelist(L, &gco2th(o)->openupval);
+      o = gco2th(o)->gclist;
+    }
+    else
+      o = gco2h(o)->gclist;
+  }
+  s->g.frealloc = g->frealloc;
+  s->g.ud = g->ud;
+  s->g.currentwhite = g->currentwhite;
+  s->g.totalbytes = s->total = g->totalbytes;
+  s->L.l_G = &s->g;
+  s->list = g->rootgc;
+  s->stop = obj2gco(g->mainthread);
+  s->deferred = NULL;
+  s->done = 0;
+  g->bgrunning = 1;
+  g->rootgc = s->stop;
+  g->sweepgc = &g->rootgc;
+  s->joinable = (pthread_create(&s->thread, NULL, bgsweepf, s) == 0);
+  if (!s->joinable)
+    bgsweepf(s);  /* no thread: sweep here */
+}
+
+
+/*
+** finish the background sweep (if the helper is done or `wait' is
+** true); returns 0 if it is still running
+*/
+static int bgjoin (lua_State *L, int wait) {
+  global_State *g = G(L);
+  BGSweep *s = g->bgsweep;
+  if (!g->bgrunning) return 1;
+  if (!wait) {
+    int done;
+    pthread_mutex_lock(&s->lock);
+    done = s->done;
+    pthread_mutex_unlock(&s->lock);
+    if (!done) return 0;
+  }
+  if (s->joinable)
+    pthread_join(s->thread, NULL);
+  g->bgrunning = 0;
+  *s->last = g->rootgc;  /* survivors go back to `rootgc' */
+  g->rootgc = s->list;
+  g->totalbytes -= s->total - s->g.totalbytes;
+  while (s->deferred != NULL) {
+    GCObject *o = s->deferred;
+    s->deferred = o->gch.next;
+    if (o->gch.tt == LUA_TTHREAD)
+      sweepwholelist(L, &gco2th(o)->openupval);
+    freeobj(L, o);
+  }
+  return 1;
+}
+
+
+/* wait for the helper when there is nothing else to sweep */
+static void bgwait (lua_State *L) {
+  global_State *g = G(L);
+  if (g->gcstate == GCSsweep && *g->sweepgc == NULL)
+    bgjoin(L, 1);
+}
+
+/* }====================================================== */
+
+#endif
+
+
 void luaC_freeall (lua_State *L) {
   global_State *g = G(L);
   int i;
+#if defined(LUA_USE_BGSWEEP)
+  if (g->bgsweep != NULL) {
+    bgjoin(L, 1);
+    pthread_mutex_destroy(&g->bgsweep->lock);
+    luaM_free(L, g->bgsweep);
+    g->bgsweep = NULL;
+  }
+#endif
   g->currentwhite = WHITEBITS | bitmask(SFIXEDBIT);  /* mask to collect all elements */
   sweepwholelist(L, &g->rootgc);
   for (i = 0; i < g->strt.size; i++)  /* free all string lists */
-    sweepwholelist(L, &g->strt.hash[i]);
+    if (validbucket(&g->strt, i)) sweepwholelist(L, &g->strt.hash[i]);
+  for (i = 0; i < g->strt.osize; i++)
+    sweepwholelist(L, &g->strt.ohash[i]);
 }
 
 
@@ -497,12 +766,24 @@ static void markmt (global_State *g) {
 }
 
 
+#if defined(LUA_USE_SHAPES)
+/* mark the keys of shape `s', its siblings and their descendants */
+static void markshapes (Shape *s) {
+  for (; s != NULL; s = s->sibling) {
+    if (s->key != NULL) stringmark(s->key);
+    markshapes(s->children);
+  }
+}
+#endif
+
+
 /* mark root set */
 static void markroot (lua_State *L) {
   global_State *g = G(L);
   g->gray = NULL;
   g->grayagain = NULL;
   g->weak = NULL;
+  g->partial = NULL;
   markobject(g, g->mainthread);
   /* make global table be traversed before main stack */
   markvalue(g, gt(g->mainthread));
@@ -543,6 +824,9 @@ static void atomic (lua_State *L) {
   udsize = luaC_separateudata(L, 0);  /* separate userdata to be finalized */
   marktmu(g);  /* mark `preserved' userdata */
   udsize += propagateall(g);  /* remark, to propagate `preserveness' */
+#if defined(LUA_USE_SHAPES)
+  markshapes(g->rootshape);  /* keep keys of all shapes */
+#endif
   cleartable(g->weak);  /* remove collected objects from weak tables */
   /* flip current white */
   g->currentwhite = cast_byte(otherwhite(g));
@@ -562,17 +846,26 @@ static l_mem singlestep (lua_State *L) {
       return 0;
     }
     case GCSpropagate: {
-      if (g->gray)
+      if (g->gray || g->partial)
         return propagatemark(g);
       else {  /* no more `gray' objects */
         atomic(L);  /* finish mark phase */
+#if defined(LUA_USE_BGSWEEP)
+        bgstart(L);
+#endif
         return 0;
       }
     }
     case GCSsweepstring: {
+      stringtable *tb = &g->strt;
       lu_mem old = g->totalbytes;
-      sweepwholelist(L, &g->strt.hash[g->sweepstrgc++]);
-      if (g->sweepstrgc >= g->strt.size)  /* nothing more to sweep? */
+      int i = g->sweepstrgc++;
+      /* in a resize, sweep the old array first (it does not change now) */
+      if (i < tb->osize)
+        sweepwholelist(L, &tb->ohash[i]);
+      else if (validbucket(tb, i - tb->osize))
+        sweepwholelist(L, &tb->hash[i - tb->osize]);
+      if (g->sweepstrgc >= tb->osize + tb->size)  /* nothing more to sweep? */
         g->gcstate = GCSsweep;  /* end sweep-string phase */
       lua_assert(old >= g->totalbytes);
       g->estimate -= old - g->totalbytes;
@@ -582,11 +875,18 @@ static l_mem singlestep (lua_State *L) {
       lu_mem old = g->totalbytes;
       g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
       if (*g->sweepgc == NULL) {  /* nothing more to sweep? */
-        checkSizes(L);
+#if defined(LUA_USE_BGSWEEP)
+        if (!bgjoin(L, 0)) {  /* helper still sweeping? */
+          g->gcdept = 0;  /* nothing to do but wait for it */
+          return (MAX_LUMEM-1)/2;  /* end this step */
+        }
+#endif
         g->gcstate = GCSfinalize;  /* end sweep phase */
       }
       lua_assert(old >= g->totalbytes);
       g->estimate -= old - g->totalbytes;
+      if (g->gcstate == GCSfinalize)
+        checkSizes(L);  /* (a smaller string table comes before freeing) */
       return GCSWEEPMAX*GCSWEEPCOST;
     }
     case GCSfinalize: {
@@ -607,9 +907,137 @@ static l_mem singlestep (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Generational mode
+** After a collection in generational mode, all surviving objects are
+** old: they keep their black color, so the next (minor) collection
+** neither traverses nor sweeps them. The collector stays in
+** GCSpropagate between collections; the write barriers (which keep
+** black objects from pointing to white ones) form the remembered set:
+** `luaC_barrierf' marks the new object and `luaC_barrierback' puts the
+** old table in `grayagain'. Objects that are always gray (threads and
+** weak tables) stay in `grayagain', to be traversed in every collection.
+** Strings are swept only in the buckets of `strt' that got new strings
+** (see `youngbuckets').
+** A major collection turns everything white again and marks it all.
+** =======================================================
+*/
+
+
+/* make all objects white again (starting from the sweep phases) */
+static void entersweep (lua_State *L) {
+  global_State *g = G(L);
+  g->sweepstrgc = 0;
+  g->sweepgc = &g->rootgc;
+  g->gray = NULL;
+  g->grayagain = NULL;
+  g->weak = NULL;
+  g->partial = NULL;
+  g->gcstate = GCSsweepstring;
+}
+
+
+static void sweepyoungstrings (lua_State *L, GCObject **hash, int size) {
+  stringtable *tb = &G(L)->strt;
+  lu_byte *young = youngbuckets(hash, size);
+  int i, j;
+  for (i = 0; i < sizeyoung(size); i++) {
+    if (young[i] == 0) continue;  /* no new strings in these buckets */
+    for (j = 0; j < 8; j++) {
+      if (testbit(young[i], j) && (hash != tb->hash || validbucket(tb, i*8+j)))
+        sweepyoung(L, &hash[i*8 + j]);
+    }
+    young[i] = 0;
+  }
+}
+
+
+static void youngcollection (lua_State *L) {
+  global_State *g = G(L);
+  lua_assert(g->gckind == KGC_GEN && g->gcstate == GCSpropagate);
+  propagateall(g);
+  atomic(L);
+  sweepyoungstrings(L, g->strt.hash, g->strt.size);
+  if (g->strt.ohash != NULL)  /* in a resize? */
+    sweepyoungstrings(L, g->strt.ohash, g->strt.osize);
+  sweepyoung(L, &g->rootgc);
+  sweepyoung(L, &g->mainthread->next);  /* userdata */
+  checkSizes(L);
+  while (g->weak) {  /* weak tables must be traversed again next time */
+    GCObject *o = g->weak;
+    g->weak = gco2h(o)->gclist;
+    gco2h(o)->gclist = g->grayagain;
+    g->grayagain = o;
+  }
+  g->gcstate = GCSpropagate;  /* old objects are black: keep invariant */
+  g->estimate = g->totalbytes;
+  luaC_callGCTM(L);
+}
+
+
+/* collect and make old all objects */
+static void fullgen (lua_State *L) {
+  global_State *g = G(L);
+  g->gckind = KGC_NORMAL;
+  if (g->gcstate <= GCSpropagate)
+    entersweep(L);
+  while (g->gcstate != GCSfinalize) {  /* finish sweeping (into white) */
+#if defined(LUA_USE_BGSWEEP)
+    bgwait(L);
+#endif
+    singlestep(L);
+  }
+  markroot(L);
+  g->gckind = KGC_GEN;
+  /* all strings are young now */
+  memset(youngbuckets(g->strt.hash, g->strt.size), 0xff,
+         sizeyoung(g->strt.size));
+  if (g->strt.ohash != NULL)
+    memset(youngbuckets(g->strt.ohash, g->strt.osize), 0xff,
+           sizeyoung(g->strt.osize));
+  youngcollection(L);  /* nothing is old: it is a full collection */
+  g->lastmajor = g->totalbytes;
+}
+
+
+static void genstep (lua_State *L) {
+  global_State *g = G(L);
+  if (g->lastmajor == 0)  /* major collection pending? */
+    fullgen(L);
+  else {
+    youngcollection(L);
+    if (g->totalbytes > (g->lastmajor/100) * (100 + LUAI_GCMAJOR))
+      g->lastmajor = 0;  /* too many old objects: do a major next time */
+  }
+  g->GCthreshold = (g->totalbytes/100) * (100 + LUAI_GCMINOR);
+}
+
+
+void luaC_changemode (lua_State *L, int kind) {
+  global_State *g = G(L);
+  if (kind == g->gckind) return;
+  if (kind == KGC_GEN) {
+    fullgen(L);
+    g->GCthreshold = (g->totalbytes/100) * (100 + LUAI_GCMINOR);
+  }
+  else {
+    g->gckind = KGC_NORMAL;
+    entersweep(L);  /* old objects must become white */
+    g->GCthreshold = g->totalbytes;
+  }
+}
+
+/* }====================================================== */
+
+
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
   l_mem lim = (GCSTEPSIZE/100) * g->gcstepmul;
+  if (g->gckind == KGC_GEN) {
+    genstep(L);
+    return;
+  }
   if (lim == 0)
     lim = (MAX_LUMEM-1)/2;  /* no limit */
   g->gcdept += g->totalbytes - g->GCthreshold;
@@ -632,26 +1060,59 @@ void luaC_step (lua_State *L) {
 }
 
 
+/*
+** do incremental steps for about `us' microseconds (the atomic phase
+** cannot be split). Returns 1 when a cycle finishes. In generational
+** mode it does a minor collection.
+*/
+int luaC_steptime (lua_State *L, int us) {
+  global_State *g = G(L);
+  unsigned long start, now;
+  l_mem work = 0;
+  if (g->gckind == KGC_GEN) {
+    genstep(L);
+    return 1;
+  }
+  luai_gcclock(start);
+  for (;;) {
+    work += singlestep(L);
+    if (g->gcstate == GCSpause) {  /* end of cycle? */
+      setthreshold(g);
+      return 1;
+    }
+    if (work >= cast(l_mem, GCSTEPSIZE)) {  /* time to look at the clock? */
+      work = 0;
+      luai_gcclock(now);
+      if (now - start >= cast(unsigned long, us))
+        return 0;
+    }
+  }
+}
+
+
 void luaC_fullgc (lua_State *L) {
   global_State *g = G(L);
-  if (g->gcstate <= GCSpropagate) {
-    /* reset sweep marks to sweep all elements (returning them to white) */
-    g->sweepstrgc = 0;
-    g->sweepgc = &g->rootgc;
-    /* reset other collector lists */
-    g->gray = NULL;
-    g->grayagain = NULL;
-    g->weak = NULL;
-    g->gcstate = GCSsweepstring;
+  if (g->gckind == KGC_GEN) {
+    fullgen(L);
+    g->GCthreshold = (g->totalbytes/100) * (100 + LUAI_GCMINOR);
+    return;
   }
+  if (g->gcstate <= GCSpropagate)
+    entersweep(L);  /* reset sweep marks to sweep all elements */
   lua_assert(g->gcstate != GCSpause && g->gcstate != GCSpropagate);
   /* finish any pending sweep phase */
   while (g->gcstate != GCSfinalize) {
     lua_assert(g->gcstate == GCSsweepstring || g->gcstate == GCSsweep);
+#if defined(LUA_USE_BGSWEEP)
+    bgwait(L);
+#endif
     singlestep(L);
   }
   markroot(L);
   while (g->gcstate != GCSpause) {
+#if defined(LUA_USE_BGSWEEP)
+    bgwait(L);
+#endif
     singlestep(L);
   }
   setthreshold(g);
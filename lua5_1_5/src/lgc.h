@@ -21,6 +21,13 @@
 #define GCSfinalize	4
 
 
+/*
+** Kinds of Garbage Collection
+*/
+#define KGC_NORMAL	0	/* incremental */
+#define KGC_GEN		1	/* generational */
+
+
 /*
 ** some userful bit tricks
 */
@@ -48,6 +55,7 @@
 ** bit 4 - for tables: has weak values
 ** bit 5 - object is fixed (should not be collected)
 ** bit 6 - object is "super" fixed (only the main thread)
+** bit 7 - object is old (survived a collection in generational mode)
 */
 
 
@@ -59,12 +67,14 @@
 #define VALUEWEAKBIT	4
 #define FIXEDBIT	5
 #define SFIXEDBIT	6
+#define OLDBIT		7
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
 
 
 #define iswhite(x)      test2bits((x)->gch.marked, WHITE0BIT, WHITE1BIT)
 #define isblack(x)      testbit((x)->gch.marked, BLACKBIT)
 #define isgray(x)	(!isblack(x) && !iswhite(x))
+#define isold(x)	testbit((x)->gch.marked, OLDBIT)
 
 #define otherwhite(g)	(g->currentwhite ^ WHITEBITS)
 #define isdead(g,v)	((v)->gch.marked & otherwhite(g) & WHITEBITS)
@@ -83,24 +93,34 @@
 	luaC_step(L); }
 
 
-#define luaC_barrier(L,p,v) { if (valiswhite(v) && isblack(obj2gco(p)))  \
-	luaC_barrierf(L,obj2gco(p),gcvalue(v)); }
+/* no barriers while a helper thread is sweeping (and changing marks) */
+#if defined(LUA_USE_BGSWEEP)
+#define nobarrier(L)	(G(L)->bgrunning)
+#else
+#define nobarrier(L)	0
+#endif
 
-#define luaC_barriert(L,t,v) { if (valiswhite(v) && isblack(obj2gco(t)))  \
-	luaC_barrierback(L,t); }
+#define luaC_barrier(L,p,v) { if (!nobarrier(L) && valiswhite(v) && \
+	isblack(obj2gco(p))) luaC_barrierf(L,obj2gco(p),gcvalue(v)); }
+
+#define luaC_barriert(L,t,v) { if (!nobarrier(L) && valiswhite(v) && \
+	isblack(obj2gco(t))) luaC_barrierback(L,t); }
 
 #define luaC_objbarrier(L,p,o)  \
-	{ if (iswhite(obj2gco(o)) && isblack(obj2gco(p))) \
+	{ if (!nobarrier(L) && iswhite(obj2gco(o)) && isblack(obj2gco(p))) \
 		luaC_barrierf(L,obj2gco(p),obj2gco(o)); }
 
 #define luaC_objbarriert(L,t,o)  \
-   { if (iswhite(obj2gco(o)) && isblack(obj2gco(t))) luaC_barrierback(L,t); }
+   { if (!nobarrier(L) && iswhite(obj2gco(o)) && isblack(obj2gco(t))) \
+	luaC_barrierback(L,t); }
 
 LUAI_FUNC size_t luaC_separateudata (lua_State *L, int all);
 LUAI_FUNC void luaC_callGCTM (lua_State *L);
 LUAI_FUNC void luaC_freeall (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_fullgc (lua_State *L);
+LUAI_FUNC int luaC_steptime (lua_State *L, int us);
+LUAI_FUNC void luaC_changemode (lua_State *L, int kind);
 LUAI_FUNC void luaC_link (lua_State *L, GCObject *o, lu_byte tt);
 LUAI_FUNC void luaC_linkupval (lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v);
@@ -0,0 +1,1300 @@
+/*
+** $Id: ljit.c $
+** Native code for hot loops and functions (x86-64)
+** See Copyright Notice in lua.h
+*/
+
+
+#include <stddef.h>
+#include <string.h>
+
+#define ljit_c
+#define LUA_CORE
+
+#include "lua.h"
+
+#if defined(LUA_USE_JIT)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ldo.h"
+#include "lgc.h"
+#include "ljit.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+
+
+/*
+** A numeric `for' loop that runs LUAI_JITHOT iterations (see OP_FORLOOP
+** in lvm.c) gets its body compiled to machine code, specialized for the
+** way its loop counts (`int's or numbers, up or down). Values stay in
+** their stack slots, so leaving the native code anywhere needs only a
+** pc: an instruction the compiler does not handle and a guard on a type
+** that does not hold become jumps back to the interpreter ("side exits")
+** at that instruction. Loops that take side exits too often are dropped
+** and compiled again some iterations later.
+** A function called LUAI_JITCALLS times (see `luaD_precall') is compiled
+** whole the same way, with no types assumed. It can be entered at its
+** start and after each instruction it leaves to the interpreter, which
+** goes back to it when a call returns there.
+** Native code of all traces goes into shared chunks of code pages, one
+** after the other. A chunk is writable only while a trace is copied
+** into it, and is unmapped when no trace in it is left.
+*/
+
+
+/*
+** native code, started at `entry'; returns where to go on (`-1 - pc'
+** after a side exit)
+*/
+typedef int (*JitFunc) (StkId base, TValue *k, LClosure *cl, lua_State *L,
+                        lu_mem *niter, const void *entry);
+
+/* pages holding the code of traces */
+typedef struct JitChunk {
+  lu_byte *mem;
+  size_t size;
+  size_t used;  /* bytes given to traces */
+  int nref;  /* traces using it */
+} JitChunk;
+
+typedef struct JitTrace {
+  struct JitTrace *next;
+  JitFunc f;
+  JitChunk *chunk;  /* where `f' is */
+  lu_mem niter;  /* iterations run natively (loops) */
+  lu_mem nexits;  /* side exits taken */
+  lu_byte *mcode;  /* code of `f' in `chunk' */
+  int *entry;  /* offset of each instruction in `mcode' (-1: no entry) */
+  int sizeentry;
+  int start;  /* offset of the entry of a loop */
+  int pc;  /* its OP_FORLOOP (-1 for a whole function) */
+} JitTrace;
+
+
+#define JITBACKOFF	(64*LUAI_JITHOT)  /* wait after dropping a loop */
+#define JITMAXLOOP	1000  /* longest loop body compiled */
+#define JITMAXFUNC	4000  /* longest function compiled */
+#define JITMAXINSTR	512  /* longest code for an instruction */
+#define JITMAXFIX	12  /* most jumps out of an instruction */
+#define JITCHUNK	(64*1024)  /* usual size of a chunk of code pages */
+#define JITALIGN	16  /* alignment of the code of a trace */
+
+#define ANY	0xFF  /* type of a register not checked yet */
+
+/* marks of the instructions of a function */
+#define MHEAD	1  /* target of a back jump */
+#define MENTRY	2  /* the interpreter may come back here */
+
+
+/*
+** {======================================================
+** x86-64 code emission
+** =======================================================
+*/
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+       R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#define XMM0	0
+#define XMM1	1
+#define XMM2	2
+#define XMM3	3
+
+/* registers kept by the native code */
+#define RBASE	RBX  /* base of the frame */
+#define RKST	RBP  /* constants */
+#define RCL	R13  /* the closure */
+#define RL	R14  /* the thread */
+#define RITER	R15  /* iteration counter */
+
+/* condition codes (for `jcc') */
+#define CC_O	0x0
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_S	0x8
+#define CC_P	0xA
+#define CC_L	0xC
+#define CC_LE	0xE
+#define CC_G	0xF
+#define JMP	(-1)
+
+#define REG(r)	(cast_int(sizeof(TValue))*(r))
+#define TT	cast_int(offsetof(TValue, tt))
+#if defined(LUA_USE_DUALNUM)
+#define IV	cast_int(offsetof(TValue, i))
+#endif
+#define OFF(t,f)	cast_int(offsetof(t, f))
+
+
+/* kinds of jumps to fix at the end */
+enum { FLABEL, FEXIT, FSIDE };
+
+typedef struct Fixup {
+  int pos;  /* where the offset goes */
+  int kind;
+  int pc;
+} Fixup;
+
+
+typedef struct JitState {
+  Proto *p;
+  StkId base;  /* values when the loop got hot (NULL for functions) */
+  lu_byte *code;
+  int n, size;
+  Fixup *fix;
+  int nfix, sizefix;
+  int *label;  /* code of each instruction of the loop */
+  lu_byte *type;  /* type checked of each register (or ANY) */
+  lu_byte *pend;  /* types at each jump target */
+  lu_byte *haspend;
+  lu_byte *mark;  /* MHEAD and MENTRY of each instruction (functions) */
+  int nreg;
+  int start, end;  /* first instruction of the body and the OP_FORLOOP */
+  int pc;  /* instruction being compiled */
+  int dead;  /* current code unreachable? */
+  int fail;
+} JitState;
+
+
+static void eb (JitState *J, int b) {
+  J->code[J->n++] = cast(lu_byte, b);
+}
+
+
+static void e32 (JitState *J, int v) {
+  unsigned int u = cast(unsigned int, v);
+  int i;
+  for (i = 0; i < 4; i++, u >>= 8) eb(J, cast_int(u & 0xFF));
+}
+
+
+static void e64 (JitState *J, size_t v) {
+  int i;
+  for (i = 0; i < 8; i++, v >>= 8) eb(J, cast_int(v & 0xFF));
+}
+
+
+static void setrel (JitState *J, int pos, int to) {
+  unsigned int u = cast(unsigned int, to - (pos + 4));
+  int i;
+  for (i = 0; i < 4; i++, u >>= 8) J->code[pos + i] = cast(lu_byte, u & 0xFF);
+}
+
+
+static void rex (JitState *J, int w, int r, int b) {
+  int x = (w ? 8 : 0) | ((r & 8) ? 4 : 0) | ((b & 8) ? 1 : 0);
+  if (x) eb(J, 0x40 | x);
+}
+
+
+static void prefix (JitState *J, int pfx, int w, int op, int r, int b) {
+  if (pfx) eb(J, pfx);
+  rex(J, w, r, b);
+  if (op > 0xFF) eb(J, op >> 8);
+  eb(J, op & 0xFF);
+}
+
+
+/* `op r, [b + d]' */
+static void opm (JitState *J, int pfx, int w, int op, int r, int b, int d) {
+  prefix(J, pfx, w, op, r, b);
+  eb(J, 0x80 | ((r & 7) << 3) | (b & 7));
+  if ((b & 7) == RSP) eb(J, 0x24);  /* SIB byte */
+  e32(J, d);
+}
+
+
+/* `op r, b' */
+static void opr (JitState *J, int pfx, int w, int op, int r, int b) {
+  prefix(J, pfx, w, op, r, b);
+  eb(J, 0xC0 | ((r & 7) << 3) | (b & 7));
+}
+
+
+#define ld64(J,r,b,d)	opm(J, 0, 1, 0x8B, r, b, d)
+#define st64(J,r,b,d)	opm(J, 0, 1, 0x89, r, b, d)
+#define ld32(J,r,b,d)	opm(J, 0, 0, 0x8B, r, b, d)
+#define st32(J,r,b,d)	opm(J, 0, 0, 0x89, r, b, d)
+#define mov64(J,r,b)	opr(J, 0, 1, 0x8B, r, b)
+#define mov32(J,r,b)	opr(J, 0, 0, 0x8B, r, b)
+#define ldsd(J,x,b,d)	opm(J, 0xF2, 0, 0x0F10, x, b, d)
+#define stsd(J,x,b,d)	opm(J, 0xF2, 0, 0x0F11, x, b, d)
+#define ucomisd(J,x,b,d)	opm(J, 0x66, 0, 0x0F2E, x, b, d)
+#define cvtsi2sd(J,x,r)	opr(J, 0xF2, 0, 0x0F2A, x, r)
+
+
+/* `op r, imm8' for the 0x83 group (ext: 0 add, 4 and, 5 sub, 7 cmp) */
+static void opri (JitState *J, int w, int ext, int r, int imm) {
+  opr(J, 0, w, 0x83, ext, r);
+  eb(J, imm);
+}
+
+
+/* `cmp [b + d], imm8' */
+static void cmpm (JitState *J, int w, int b, int d, int imm) {
+  opm(J, 0, w, 0x83, 7, b, d);
+  eb(J, imm);
+}
+
+
+/* `mov dword [b + d], imm32' */
+static void stimm (JitState *J, int b, int d, int imm) {
+  opm(J, 0, 0, 0xC7, 0, b, d);
+  e32(J, imm);
+}
+
+
+static void ldimm32 (JitState *J, int r, int v) {
+  rex(J, 0, 0, r);
+  eb(J, 0xB8 + (r & 7));
+  e32(J, v);
+}
+
+
+static void ldimm64 (JitState *J, int r, size_t v) {
+  rex(J, 1, 0, r);
+  eb(J, 0xB8 + (r & 7));
+  e64(J, v);
+}
+
+
+static void callf (JitState *J, size_t f) {
+  ldimm64(J, RAX, f);
+  eb(J, 0xFF); eb(J, 0xD0);  /* call rax */
+}
+
+
+static void push (JitState *J, int r) {
+  rex(J, 0, 0, r);
+  eb(J, 0x50 + (r & 7));
+}
+
+
+static void pop (JitState *J, int r) {
+  rex(J, 0, 0, r);
+  eb(J, 0x58 + (r & 7));
+}
+
+
+/* emits a jump (`cc' JMP: always); returns where its offset goes */
+static int jump (JitState *J, int cc) {
+  if (cc == JMP) eb(J, 0xE9);
+  else { eb(J, 0x0F); eb(J, 0x80 | cc); }
+  e32(J, 0);
+  return J->n - 4;
+}
+
+
+/* fixes a jump inside one instruction to go to the current position */
+static void here (JitState *J, int pos) {
+  setrel(J, pos, J->n);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Loop compiler
+** =======================================================
+*/
+
+static void jumpout (JitState *J, int cc, int kind, int pc) {
+  int pos = jump(J, cc);
+  if (J->nfix == J->sizefix) J->fail = 1;
+  else {
+    Fixup *f = &J->fix[J->nfix++];
+    f->pos = pos;
+    f->kind = kind;
+    f->pc = pc;
+  }
+}
+
+
+#define sideexit(J,cc)	jumpout(J, cc, FSIDE, (J)->pc)
+
+
+/* jumps to instruction `pc', carrying the types checked so far */
+static void jumpto (JitState *J, int cc, int pc) {
+  if (pc > J->end)  /* leaving the loop? */
+    jumpout(J, cc, FEXIT, pc);
+  else if (pc <= J->pc) {  /* back jump */
+    if (J->mark == NULL || cc != JMP) J->fail = 1;  /* an inner loop? */
+    else {
+      lua_assert(J->mark[pc] & MHEAD);
+      opm(J, 0, 0, 0xF6, 0, RL, OFF(lua_State, hookmask));  /* test byte */
+      eb(J, LUA_MASKLINE | LUA_MASKCOUNT);
+      jumpout(J, CC_NE, FEXIT, pc);  /* let the interpreter call hooks */
+      jumpout(J, cc, FLABEL, pc);
+    }
+  }
+  else {
+    lu_byte *st = J->pend + (pc - J->start) * J->nreg;
+    int r;
+    if (!J->haspend[pc - J->start]) {
+      memcpy(st, J->type, J->nreg);
+      J->haspend[pc - J->start] = 1;
+    }
+    else {
+      for (r = 0; r < J->nreg; r++)
+        if (st[r] != J->type[r]) st[r] = ANY;
+    }
+    jumpout(J, cc, FLABEL, pc);
+  }
+}
+
+
+/* instruction `J->pc' starts here */
+static void label (JitState *J) {
+  int i = J->pc - J->start;
+  if (J->mark != NULL && J->mark[J->pc]) {  /* reached from anywhere */
+    memset(J->type, ANY, J->nreg);
+    J->dead = 0;
+  }
+  else if (J->haspend[i]) {
+    lu_byte *st = J->pend + i * J->nreg;
+    int r;
+    if (J->dead) memcpy(J->type, st, J->nreg);
+    else {
+      for (r = 0; r < J->nreg; r++)
+        if (J->type[r] != st[r]) J->type[r] = ANY;
+    }
+    J->dead = 0;
+  }
+  J->label[i] = J->n;
+}
+
+
+/* compares the type of the value at [b + d] with `t' */
+static void cmptype (JitState *J, int b, int d, int t) {
+#if defined(LUA_USE_DUALNUM)
+  ld32(J, RAX, b, d + TT);
+  opri(J, 0, 4, RAX, 0x0F);
+  opri(J, 0, 7, RAX, t);
+#else
+  cmpm(J, 0, b, d + TT, t);
+#endif
+}
+
+
+/* makes sure register `r' has type `t', or leaves the native code */
+static void need (JitState *J, int r, int t) {
+  if (J->type[r] != t) {
+    cmptype(J, RBASE, REG(r), t);
+    sideexit(J, CC_NE);
+    J->type[r] = cast_byte(t);
+  }
+}
+
+
+static void rk (int x, int *b, int *d) {
+  if (ISK(x)) { *b = RKST; *d = REG(INDEXK(x)); }
+  else { *b = RBASE; *d = REG(x); }
+}
+
+
+/* makes sure RK(x) is a number; 0 if it is a constant that is not */
+static int neednum (JitState *J, int x) {
+  if (ISK(x)) return ttisnumber(&J->p->k[INDEXK(x)]);
+  need(J, x, LUA_TNUMBER);
+  return 1;
+}
+
+
+/* was RK(x) a number when the loop got hot? */
+static int wasnum (JitState *J, int x) {
+  if (ISK(x)) return ttisnumber(&J->p->k[INDEXK(x)]);
+  return J->type[x] == LUA_TNUMBER ||
+         (J->base != NULL && ttisnumber(J->base + x));
+}
+
+
+static void copy (JitState *J, int db, int dd, int sb, int sd) {
+  int o;
+  for (o = 0; o < cast_int(sizeof(TValue)); o += 8) {
+    ld64(J, RCX, sb, sd + o);
+    st64(J, RCX, db, dd + o);
+  }
+}
+
+
+/* R(a) := xmm0 */
+static void setnum (JitState *J, int a) {
+  stsd(J, XMM0, RBASE, REG(a));
+  stimm(J, RBASE, REG(a) + TT, LUA_TNUMBER);
+  J->type[a] = LUA_TNUMBER;
+}
+
+
+static lua_Number jit_mod (lua_Number a, lua_Number b) {
+  return luai_nummod(a, b);
+}
+
+
+static lua_Number jit_pow (lua_Number a, lua_Number b) {
+  return luai_numpow(a, b);
+}
+
+
+static void jit_barrier (lua_State *L, Table *t, const TValue *v) {
+  luaC_barriert(L, t, v);
+}
+
+
+/*
+** leaves in rax the slot for key RK(key) in the table at R(t), as
+** `luaH_get' would find it; 0 if the key cannot be handled
+*/
+static int lookup (JitState *J, int t, int key) {
+  if (ISK(key) && ttisstring(&J->p->k[INDEXK(key)])) {
+    ld64(J, RDI, RBASE, REG(t));
+    ldimm64(J, RSI, cast(size_t, rawtsvalue(&J->p->k[INDEXK(key)])));
+    callf(J, cast(size_t, luaH_getstr));
+  }
+  else if (neednum(J, key)) {
+    int b, d, hash, done;
+    rk(key, &b, &d);
+    ldsd(J, XMM0, b, d);
+    opr(J, 0xF2, 0, 0x0F2C, RAX, XMM0);  /* cvttsd2si eax, xmm0 */
+    cvtsi2sd(J, XMM1, RAX);
+    opr(J, 0x66, 0, 0x0F2E, XMM0, XMM1);  /* ucomisd xmm0, xmm1 */
+    sideexit(J, CC_NE);  /* not an `int'? */
+    sideexit(J, CC_P);
+    ld64(J, RDI, RBASE, REG(t));
+    mov32(J, RCX, RAX);
+    opri(J, 0, 5, RCX, 1);  /* key - 1 */
+    opm(J, 0, 0, 0x3B, RCX, RDI, OFF(Table, sizearray));
+    hash = jump(J, CC_AE);
+    opr(J, 0, 1, 0x69, RCX, RCX);  /* imul rcx, rcx, sizeof(TValue) */
+    e32(J, cast_int(sizeof(TValue)));
+    opm(J, 0, 1, 0x03, RCX, RDI, OFF(Table, array));
+    mov64(J, RAX, RCX);
+    done = jump(J, JMP);
+    here(J, hash);
+    mov32(J, RSI, RAX);
+    callf(J, cast(size_t, luaH_getnum));
+    here(J, done);
+  }
+  else return 0;
+  return 1;
+}
+
+
+/*
+** R(a) := the value at rax, got from the table at [b + d]; leaves when
+** it is nil and the table has a metatable (which may have `__index')
+*/
+static void getresult (JitState *J, int a, int b, int d) {
+  int found;
+  cmpm(J, 0, RAX, TT, LUA_TNIL);
+  found = jump(J, CC_NE);
+  ld64(J, RCX, b, d);
+  cmpm(J, 1, RCX, OFF(Table, metatable), 0);
+  sideexit(J, CC_NE);
+  here(J, found);
+  copy(J, RBASE, REG(a), RAX, 0);
+  J->type[a] = ANY;
+}
+
+
+/* barrier for storing RK(x) into the table at rsi */
+static void barrier (JitState *J, int x) {
+  int b, d, skip = -1;
+  if (ISK(x) ? !iscollectable(&J->p->k[INDEXK(x)])
+             : J->type[x] == LUA_TNUMBER)
+    return;
+  rk(x, &b, &d);
+  if (!ISK(x)) {
+#if defined(LUA_USE_DUALNUM)
+    ld32(J, RAX, b, d + TT);
+    opri(J, 0, 4, RAX, 0x0F);
+    opri(J, 0, 7, RAX, LUA_TSTRING);
+#else
+    cmpm(J, 0, b, d + TT, LUA_TSTRING);
+#endif
+    skip = jump(J, CC_L);  /* not collectable */
+  }
+  mov64(J, RDI, RL);
+  opm(J, 0, 1, 0x8D, RDX, b, d);  /* lea rdx, RK(x) */
+  callf(J, cast(size_t, jit_barrier));
+  if (skip >= 0) here(J, skip);
+}
+
+
+/* jumps to `t' if R(x) is false, or to `f' if it is not */
+static void truth (JitState *J, int x, int t, int f) {
+  int isnil, notbool, isfalse;
+  if (J->type[x] != ANY) {  /* a number or a table */
+    jumpto(J, JMP, f);
+    return;
+  }
+  cmpm(J, 0, RBASE, REG(x) + TT, LUA_TNIL);
+  isnil = jump(J, CC_E);
+  cmpm(J, 0, RBASE, REG(x) + TT, LUA_TBOOLEAN);
+  notbool = jump(J, CC_NE);
+  cmpm(J, 0, RBASE, REG(x), 0);
+  isfalse = jump(J, CC_E);
+  here(J, notbool);
+  jumpto(J, JMP, f);
+  here(J, isnil);
+  here(J, isfalse);
+  jumpto(J, JMP, t);
+}
+
+
+/* jumps to `ifeq' if RK(b) == RK(c) or to `ifne' if not; leaves the
+   native code for types that may call `__eq' (or are strings) */
+static void eqany (JitState *J, int b, int c, int ifeq, int ifne) {
+  int rb, db, rc, dc, ne, ne2, eq, isnum, isnil;
+  rk(b, &rb, &db);
+  rk(c, &rc, &dc);
+  ld32(J, RAX, rb, db + TT);
+  ld32(J, RCX, rc, dc + TT);
+#if defined(LUA_USE_DUALNUM)
+  opri(J, 0, 4, RAX, 0x0F);
+  opri(J, 0, 4, RCX, 0x0F);
+#endif
+  opr(J, 0, 0, 0x3B, RAX, RCX);  /* cmp eax, ecx */
+  ne = jump(J, CC_NE);  /* different types */
+  opri(J, 0, 7, RAX, LUA_TNUMBER);
+  isnum = jump(J, CC_E);
+  opri(J, 0, 7, RAX, LUA_TNIL);
+  isnil = jump(J, CC_E);
+  opri(J, 0, 7, RAX, LUA_TBOOLEAN);
+  sideexit(J, CC_NE);
+  ld32(J, RAX, rb, db);
+  opm(J, 0, 0, 0x3B, RAX, rc, dc);
+  ne2 = jump(J, CC_NE);
+  eq = jump(J, JMP);
+  here(J, isnum);
+  ldsd(J, XMM0, rb, db);
+  ucomisd(J, XMM0, rc, dc);
+  jumpto(J, CC_P, ifne);
+  jumpto(J, CC_NE, ifne);
+  here(J, isnil);
+  here(J, eq);
+  jumpto(J, JMP, ifeq);
+  here(J, ne);
+  here(J, ne2);
+  jumpto(J, JMP, ifne);
+}
+
+
+/* OP_EQ, OP_LT and OP_LE; 0 if they cannot be handled */
+static int compare (JitState *J, Instruction i) {
+  Instruction next = J->p->code[J->pc + 1];
+  int a = GETARG_A(i), b = GETARG_B(i), c = GETARG_C(i);
+  int target, rb, db, rc, dc;
+  if (GET_OPCODE(next) != OP_JMP) return 0;
+  target = J->pc + 2 + GETARG_sBx(next);
+  if (GET_OPCODE(i) == OP_EQ && !(wasnum(J, b) && wasnum(J, c))) {
+    /* comparisons with nil and booleans never call `__eq' */
+    const TValue *k = NULL;
+    int x, ne, ne2 = -1;
+    if (ISK(b) != ISK(c)) {
+      if (ISK(b)) { k = &J->p->k[INDEXK(b)]; x = c; }
+      else { k = &J->p->k[INDEXK(c)]; x = b; }
+    }
+    if (k == NULL || (!ttisnil(k) && !ttisboolean(k))) {
+      eqany(J, b, c, a ? target : J->pc + 2, a ? J->pc + 2 : target);
+      return 1;
+    }
+    cmpm(J, 0, RBASE, REG(x) + TT, ttype(k));
+    ne = jump(J, CC_NE);
+    if (ttisboolean(k)) {
+      cmpm(J, 0, RBASE, REG(x), bvalue(k));
+      ne2 = jump(J, CC_NE);
+    }
+    jumpto(J, JMP, a ? target : J->pc + 2);
+    here(J, ne);
+    if (ne2 >= 0) here(J, ne2);
+    jumpto(J, JMP, a ? J->pc + 2 : target);
+    return 1;
+  }
+  if (!neednum(J, b) || !neednum(J, c)) return 0;
+  rk(b, &rb, &db);
+  rk(c, &rc, &dc);
+  if (GET_OPCODE(i) == OP_EQ) {
+    ldsd(J, XMM0, rb, db);
+    ucomisd(J, XMM0, rc, dc);
+    if (a) {
+      int unordered = jump(J, CC_P);
+      jumpto(J, CC_E, target);
+      here(J, unordered);
+    }
+    else {
+      jumpto(J, CC_P, target);
+      jumpto(J, CC_NE, target);
+    }
+  }
+  else {  /* `b < c' is `c > b' (ucomisd sets CF when unordered) */
+    int lt = (GET_OPCODE(i) == OP_LT);
+    ldsd(J, XMM0, rc, dc);
+    ucomisd(J, XMM0, rb, db);
+    if (a) jumpto(J, lt ? CC_A : CC_AE, target);
+    else jumpto(J, lt ? CC_BE : CC_B, target);
+  }
+  jumpto(J, JMP, J->pc + 2);
+  return 1;
+}
+
+
+/* OP_FORPREP in a function, as the interpreter does it for numbers */
+static void forprep (JitState *J, int ra, int target) {
+  int r;
+#if defined(LUA_USE_DUALNUM)
+  int notint[3], ovf;
+  for (r = 0; r < 3; r++) {
+    cmpm(J, 0, RBASE, REG(ra+r) + TT, LUA_TINT);
+    notint[r] = jump(J, CC_NE);
+  }
+  ld32(J, RAX, RBASE, REG(ra) + IV);
+  opm(J, 0, 0, 0x2B, RAX, RBASE, REG(ra+2) + IV);  /* sub eax, step */
+  ovf = jump(J, CC_O);
+  st32(J, RAX, RBASE, REG(ra) + IV);  /* all `int's: loop keeps them */
+  cvtsi2sd(J, XMM0, RAX);
+  stsd(J, XMM0, RBASE, REG(ra));
+  jumpto(J, JMP, target);
+  for (r = 0; r < 3; r++) here(J, notint[r]);
+  here(J, ovf);
+#endif
+  for (r = 0; r < 3; r++)  /* strings and errors go to the interpreter */
+    need(J, ra + r, LUA_TNUMBER);
+  ldsd(J, XMM0, RBASE, REG(ra));
+  opm(J, 0xF2, 0, 0x0F5C, XMM0, RBASE, REG(ra+2));  /* subsd */
+  setnum(J, ra);
+  jumpto(J, JMP, target);
+  J->dead = 1;
+}
+
+
+/* OP_FORLOOP in a function, for both kinds of loops */
+static void forloop (JitState *J, int ra, int target) {
+  int r, down, store, done[5], nd = 0;
+#if defined(LUA_USE_DUALNUM)
+  int isnum;
+  cmpm(J, 0, RBASE, REG(ra) + TT, LUA_TINT);
+  isnum = jump(J, CC_NE);
+  ld32(J, RAX, RBASE, REG(ra) + IV);
+  opm(J, 0, 0, 0x03, RAX, RBASE, REG(ra+2) + IV);  /* add eax, step */
+  done[nd++] = jump(J, CC_O);
+  cmpm(J, 0, RBASE, REG(ra+2) + IV, 0);
+  down = jump(J, CC_LE);
+  opm(J, 0, 0, 0x3B, RAX, RBASE, REG(ra+1) + IV);  /* cmp eax, limit */
+  done[nd++] = jump(J, CC_G);
+  store = jump(J, JMP);
+  here(J, down);
+  opm(J, 0, 0, 0x3B, RAX, RBASE, REG(ra+1) + IV);
+  done[nd++] = jump(J, CC_L);
+  here(J, store);
+  cvtsi2sd(J, XMM0, RAX);
+  st32(J, RAX, RBASE, REG(ra) + IV);
+  stsd(J, XMM0, RBASE, REG(ra));
+  st32(J, RAX, RBASE, REG(ra+3) + IV);
+  stsd(J, XMM0, RBASE, REG(ra+3));
+  stimm(J, RBASE, REG(ra+3) + TT, LUA_TINT);
+  jumpto(J, JMP, target);
+  here(J, isnum);
+#endif
+  ldsd(J, XMM0, RBASE, REG(ra));
+  opm(J, 0xF2, 0, 0x0F58, XMM0, RBASE, REG(ra+2));  /* addsd */
+  ldsd(J, XMM1, RBASE, REG(ra+1));
+  ldsd(J, XMM2, RBASE, REG(ra+2));
+  opr(J, 0, 0, 0x0F57, XMM3, XMM3);  /* xorps xmm3, xmm3 */
+  opr(J, 0x66, 0, 0x0F2E, XMM2, XMM3);  /* step > 0? */
+  down = jump(J, CC_BE);
+  opr(J, 0x66, 0, 0x0F2E, XMM1, XMM0);  /* limit >= idx? */
+  done[nd++] = jump(J, CC_B);
+  store = jump(J, JMP);
+  here(J, down);
+  opr(J, 0x66, 0, 0x0F2E, XMM0, XMM1);  /* idx >= limit? */
+  done[nd++] = jump(J, CC_B);
+  here(J, store);
+  stsd(J, XMM0, RBASE, REG(ra));
+  stsd(J, XMM0, RBASE, REG(ra+3));
+  stimm(J, RBASE, REG(ra+3) + TT, LUA_TNUMBER);
+  jumpto(J, JMP, target);
+  for (r = 0; r < nd; r++) here(J, done[r]);  /* loop ends */
+}
+
+
+static void instr (JitState *J, Instruction i) {
+  Proto *p = J->p;
+  int a = GETARG_A(i);
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: {
+      int b = GETARG_B(i);
+      copy(J, RBASE, REG(a), RBASE, REG(b));
+      J->type[a] = J->type[b];
+      return;
+    }
+    case OP_LOADK: {
+      int k = GETARG_Bx(i);
+      copy(J, RBASE, REG(a), RKST, REG(k));
+      J->type[a] = ttisnumber(&p->k[k]) ? LUA_TNUMBER : ANY;
+      return;
+    }
+    case OP_LOADBOOL: {
+      stimm(J, RBASE, REG(a), GETARG_B(i));
+      stimm(J, RBASE, REG(a) + TT, LUA_TBOOLEAN);
+      J->type[a] = ANY;
+      if (GETARG_C(i)) {
+        jumpto(J, JMP, J->pc + 2);
+        J->dead = 1;
+      }
+      return;
+    }
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      if (b - a >= 16) break;
+      for (; a <= b; a++) {
+        stimm(J, RBASE, REG(a) + TT, LUA_TNIL);
+        J->type[a] = ANY;
+      }
+      return;
+    }
+    case OP_GETUPVAL:
+    case OP_GETUPVALTABLE: {  /* its OP_GETTABLE is compiled by itself */
+      int b = GETARG_B(i);
+      ld64(J, RAX, RCL, OFF(LClosure, upvals) + b*cast_int(sizeof(UpVal *)));
+      ld64(J, RAX, RAX, OFF(UpVal, v));
+      copy(J, RBASE, REG(a), RAX, 0);
+      J->type[a] = ANY;
+      return;
+    }
+    case OP_GETGLOBAL: {
+      ld64(J, RDI, RCL, OFF(LClosure, env));
+      ldimm64(J, RSI, cast(size_t, rawtsvalue(&p->k[GETARG_Bx(i)])));
+      callf(J, cast(size_t, luaH_getstr));
+      getresult(J, a, RCL, OFF(LClosure, env));
+      return;
+    }
+    case OP_GETTABLE: {
+      int b = GETARG_B(i);
+      need(J, b, LUA_TTABLE);
+      if (!lookup(J, b, GETARG_C(i))) break;
+      getresult(J, a, RBASE, REG(b));
+      return;
+    }
+    case OP_SETTABLE: {  /* only existing keys: no rehash, no `__newindex' */
+      int c = GETARG_C(i), b, d;
+      need(J, a, LUA_TTABLE);
+      if (!lookup(J, a, GETARG_B(i))) break;
+      cmpm(J, 0, RAX, TT, LUA_TNIL);
+      sideexit(J, CC_E);
+      rk(c, &b, &d);
+      copy(J, RAX, 0, b, d);
+      ld64(J, RSI, RBASE, REG(a));
+      opm(J, 0, 0, 0xC6, 0, RSI, OFF(Table, flags));  /* flags = 0 */
+      eb(J, 0);
+      barrier(J, c);
+      return;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+    case OP_MOD: case OP_POW: {
+      int b = GETARG_B(i), c = GETARG_C(i), rb, db, rc, dc;
+      if (!neednum(J, b) || !neednum(J, c)) break;
+      rk(b, &rb, &db);
+      rk(c, &rc, &dc);
+      ldsd(J, XMM0, rb, db);
+      switch (GET_OPCODE(i)) {
+        case OP_ADD: opm(J, 0xF2, 0, 0x0F58, XMM0, rc, dc); break;
+        case OP_SUB: opm(J, 0xF2, 0, 0x0F5C, XMM0, rc, dc); break;
+        case OP_MUL: opm(J, 0xF2, 0, 0x0F59, XMM0, rc, dc); break;
+        case OP_DIV: opm(J, 0xF2, 0, 0x0F5E, XMM0, rc, dc); break;
+        default:
+          ldsd(J, XMM1, rc, dc);
+          callf(J, GET_OPCODE(i) == OP_MOD ? cast(size_t, jit_mod)
+                                           : cast(size_t, jit_pow));
+      }
+      setnum(J, a);
+      return;
+    }
+    case OP_UNM: {
+      int b = GETARG_B(i);
+      need(J, b, LUA_TNUMBER);
+      ld64(J, RAX, RBASE, REG(b));
+      opr(J, 0, 1, 0x0FBA, 7, RAX);  /* btc rax, 63 */
+      eb(J, 63);
+      st64(J, RAX, RBASE, REG(a));
+      stimm(J, RBASE, REG(a) + TT, LUA_TNUMBER);
+      J->type[a] = LUA_TNUMBER;
+      return;
+    }
+    case OP_LEN: {  /* tables only; strings are rare in these loops */
+      need(J, GETARG_B(i), LUA_TTABLE);
+      ld64(J, RDI, RBASE, REG(GETARG_B(i)));
+      callf(J, cast(size_t, luaH_getn));
+      cvtsi2sd(J, XMM0, RAX);
+      setnum(J, a);
+      return;
+    }
+    case OP_NOT: {
+      int b = GETARG_B(i);
+      if (J->type[b] != ANY)
+        ldimm32(J, RAX, 0);
+      else {
+        int isnil, notbool, isfalse, done;
+        cmpm(J, 0, RBASE, REG(b) + TT, LUA_TNIL);
+        isnil = jump(J, CC_E);
+        cmpm(J, 0, RBASE, REG(b) + TT, LUA_TBOOLEAN);
+        notbool = jump(J, CC_NE);
+        cmpm(J, 0, RBASE, REG(b), 0);
+        isfalse = jump(J, CC_E);
+        here(J, notbool);
+        ldimm32(J, RAX, 0);
+        done = jump(J, JMP);
+        here(J, isnil);
+        here(J, isfalse);
+        ldimm32(J, RAX, 1);
+        here(J, done);
+      }
+      st32(J, RAX, RBASE, REG(a));
+      stimm(J, RBASE, REG(a) + TT, LUA_TBOOLEAN);
+      J->type[a] = ANY;
+      return;
+    }
+    case OP_JMP: {
+      jumpto(J, JMP, J->pc + 1 + GETARG_sBx(i));
+      J->dead = 1;
+      return;
+    }
+    case OP_EQ: case OP_LT: case OP_LE: {
+      if (!compare(J, i)) break;
+      J->dead = 1;
+      return;
+    }
+    case OP_TEST: {
+      Instruction next = p->code[J->pc + 1];
+      int target, c = GETARG_C(i);
+      if (GET_OPCODE(next) != OP_JMP) break;
+      target = J->pc + 2 + GETARG_sBx(next);
+      if (c) truth(J, a, J->pc + 2, target);
+      else truth(J, a, target, J->pc + 2);
+      J->dead = 1;
+      return;
+    }
+    case OP_FORPREP: {
+      if (J->mark == NULL) break;  /* no inner loops in loops */
+      forprep(J, a, J->pc + 1 + GETARG_sBx(i));
+      return;
+    }
+    case OP_FORLOOP: {  /* (in a function) */
+      if (J->mark == NULL) break;
+      forloop(J, a, J->pc + 1 + GETARG_sBx(i));
+      return;
+    }
+    default: break;
+  }
+  /* anything else runs in the interpreter */
+  sideexit(J, JMP);
+  J->dead = 1;
+  if (J->mark != NULL && J->pc < J->end)
+    J->mark[J->pc + 1] |= MENTRY;  /* it may come back after that */
+}
+
+
+
+
+/* checks on entry that the loop counts as it did when compiled */
+static void forentry (JitState *J, int ra, int isint, int up) {
+#if defined(LUA_USE_DUALNUM)
+  if (isint) {
+    cmpm(J, 0, RBASE, REG(ra) + TT, LUA_TINT);
+    sideexit(J, CC_NE);
+    cmpm(J, 0, RBASE, REG(ra+2) + IV, 0);
+    sideexit(J, up ? CC_LE : CC_G);
+    return;
+  }
+#endif
+  UNUSED(isint);
+  cmpm(J, 0, RBASE, REG(ra) + TT, LUA_TNUMBER);
+  sideexit(J, CC_NE);
+  ldsd(J, XMM0, RBASE, REG(ra+2));
+  opr(J, 0, 0, 0x0F57, XMM1, XMM1);  /* xorps xmm1, xmm1 */
+  opr(J, 0x66, 0, 0x0F2E, XMM0, XMM1);  /* ucomisd xmm0, xmm1 */
+  sideexit(J, up ? CC_BE : CC_A);
+}
+
+
+/* the OP_FORLOOP of a compiled loop, specialized as the loop counts */
+static void loopback (JitState *J, int ra, int isint, int up) {
+#if defined(LUA_USE_DUALNUM)
+  if (isint) {
+    ld32(J, RAX, RBASE, REG(ra) + IV);
+    opm(J, 0, 0, 0x03, RAX, RBASE, REG(ra+2) + IV);  /* add eax, step */
+    jumpout(J, CC_O, FEXIT, J->end + 1);
+    opm(J, 0, 0, 0x3B, RAX, RBASE, REG(ra+1) + IV);  /* cmp eax, limit */
+    jumpout(J, up ? CC_G : CC_L, FEXIT, J->end + 1);
+    cvtsi2sd(J, XMM0, RAX);
+    st32(J, RAX, RBASE, REG(ra) + IV);
+    stsd(J, XMM0, RBASE, REG(ra));
+    st32(J, RAX, RBASE, REG(ra+3) + IV);
+    stsd(J, XMM0, RBASE, REG(ra+3));
+    stimm(J, RBASE, REG(ra+3) + TT, LUA_TINT);
+  }
+  else
+#endif
+  {
+    UNUSED(isint);
+    ldsd(J, XMM0, RBASE, REG(ra));
+    opm(J, 0xF2, 0, 0x0F58, XMM0, RBASE, REG(ra+2));  /* addsd */
+    ldsd(J, XMM1, RBASE, REG(ra+1));
+    if (up) opr(J, 0x66, 0, 0x0F2E, XMM1, XMM0);  /* limit >= idx? */
+    else opr(J, 0x66, 0, 0x0F2E, XMM0, XMM1);  /* idx >= limit? */
+    jumpout(J, CC_B, FEXIT, J->end + 1);
+    stsd(J, XMM0, RBASE, REG(ra));
+    stsd(J, XMM0, RBASE, REG(ra+3));
+    stimm(J, RBASE, REG(ra+3) + TT, LUA_TNUMBER);
+  }
+  opm(J, 0, 1, 0x83, 0, RITER, 0);  /* add qword [r15], 1 */
+  eb(J, 1);
+  opm(J, 0, 0, 0xF6, 0, RL, OFF(lua_State, hookmask));  /* test byte */
+  eb(J, LUA_MASKLINE | LUA_MASKCOUNT);
+  jumpout(J, CC_NE, FEXIT, J->start);  /* let the interpreter call hooks */
+  jumpout(J, JMP, FLABEL, J->start);
+}
+
+
+static const int saved[] = {RBX, RBP, R13, R14, R15};
+
+
+static void prologue (JitState *J) {
+  int r;
+  for (r = 0; r < 5; r++) push(J, saved[r]);  /* keeps rsp aligned */
+  mov64(J, RBASE, RDI);
+  mov64(J, RKST, RSI);
+  mov64(J, RCL, RDX);
+  mov64(J, RL, RCX);
+  mov64(J, RITER, R8);
+  rex(J, 0, 0, R9);
+  eb(J, 0xFF); eb(J, 0xE0 | (R9 & 7));  /* jmp r9 (the entry) */
+}
+
+
+/* emits the return and the side exits, and fixes all jumps */
+static void finish (JitState *J) {
+  int r, epilogue = J->n;
+  for (r = 4; r >= 0; r--) pop(J, saved[r]);
+  eb(J, 0xC3);  /* ret */
+  for (r = 0; r < J->nfix; r++) {
+    Fixup *f = &J->fix[r];
+    if (f->kind == FLABEL)
+      setrel(J, f->pos, J->label[f->pc - J->start]);
+    else {
+      setrel(J, f->pos, J->n);
+      ldimm32(J, RAX, f->kind == FEXIT ? f->pc : -1 - f->pc);
+      setrel(J, jump(J, JMP), epilogue);
+    }
+  }
+}
+
+
+/* compiles instructions from `J->pc' to `J->end' (excluded) */
+static void compileall (JitState *J) {
+  for (; J->pc < J->end && !J->fail; J->pc++) {
+    label(J);
+    if (J->dead) continue;
+    if (J->n + JITMAXINSTR > J->size || J->nfix + JITMAXFIX > J->sizefix)
+      J->fail = 1;
+    else
+      instr(J, J->p->code[J->pc]);
+  }
+}
+
+
+static JitTrace *newtrace (lua_State *L, int pc) {
+  JitTrace *tr = luaM_new(L, JitTrace);
+  tr->f = NULL;
+  tr->mcode = NULL;
+  tr->chunk = NULL;
+  tr->niter = tr->nexits = 0;
+  tr->entry = NULL;
+  tr->sizeentry = 0;
+  tr->start = 0;
+  tr->pc = pc;
+  tr->next = NULL;
+  return tr;
+}
+
+
+static void freechunk (lua_State *L, JitChunk *ch) {
+  if (G(L)->jitchunk == ch) G(L)->jitchunk = NULL;
+  munmap(ch->mem, ch->size);
+  luaM_free(L, ch);
+}
+
+
+static void freetrace (lua_State *L, JitTrace *tr) {
+  if (tr->chunk && --tr->chunk->nref == 0) freechunk(L, tr->chunk);
+  luaM_freearray(L, tr->entry, tr->sizeentry, int);
+  luaM_free(L, tr);
+}
+
+
+/* gets, in one block, the buffers to compile `len' instructions */
+static char *openstate (lua_State *L, JitState *J, Proto *p, int start,
+                        int len, size_t *total) {
+  char *mem;
+  J->p = p;
+  J->nreg = p->maxstacksize;
+  J->start = J->pc = start;
+  J->end = start + len - 1;
+  J->sizefix = len * JITMAXFIX + 8;
+  J->size = 256 + len * JITMAXINSTR + J->sizefix * 10;
+  *total = J->sizefix * sizeof(Fixup) + len * sizeof(int) + J->size +
+           J->nreg + len * J->nreg + 2 * len;
+  mem = cast(char *, luaM_malloc(L, *total));
+  J->fix = cast(Fixup *, mem);
+  J->label = cast(int *, J->fix + J->sizefix);
+  J->code = cast(lu_byte *, J->label + len);
+  J->type = J->code + J->size;
+  J->pend = J->type + J->nreg;
+  J->haspend = J->pend + len * J->nreg;
+  J->mark = J->haspend + len;
+  memset(J->haspend, 0, 2 * len);
+  J->n = J->nfix = 0;
+  J->dead = J->fail = 0;
+  return mem;
+}
+
+
+/* a chunk with room for `n' bytes of code; NULL if it cannot map one */
+static JitChunk *getchunk (lua_State *L, size_t n) {
+  global_State *g = G(L);
+  JitChunk *ch = g->jitchunk;
+  size_t page = cast(size_t, sysconf(_SC_PAGESIZE));
+  void *m;
+  if (ch != NULL && ch->size - ch->used >= n)
+    return ch;
+  if (ch != NULL && ch->nref == 0) freechunk(L, ch);
+  g->jitchunk = NULL;  /* a full chunk stays only while its traces do */
+  ch = luaM_new(L, JitChunk);
+  ch->size = (n <= JITCHUNK) ? JITCHUNK : (n + page - 1) / page * page;
+  m = mmap(NULL, ch->size, PROT_READ | PROT_EXEC,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (m == MAP_FAILED) {
+    luaM_free(L, ch);
+    return NULL;
+  }
+  ch->mem = cast(lu_byte *, m);
+  ch->used = 0;
+  ch->nref = 0;
+  g->jitchunk = ch;
+  return ch;
+}
+
+
+/*
+** copies the code of `J' into a chunk for `tr'. No native code runs
+** while compiling, so the pages it goes to can be writable for a while
+*/
+static void install (lua_State *L, JitState *J, JitTrace *tr) {
+  size_t page = cast(size_t, sysconf(_SC_PAGESIZE));
+  JitChunk *ch = getchunk(L, cast(size_t, J->n));
+  lu_byte *first, *end;
+  if (ch == NULL) return;
+  first = ch->mem + ch->used / page * page;
+  end = ch->mem + (ch->used + J->n + page - 1) / page * page;
+  if (mprotect(first, end - first, PROT_READ | PROT_WRITE) != 0) {
+    if (ch->nref == 0) freechunk(L, ch);
+    return;
+  }
+  memcpy(ch->mem + ch->used, J->code, J->n);
+  /* restoring only joins the pages back to their mapping */
+  mprotect(first, end - first, PROT_READ | PROT_EXEC);
+  tr->mcode = ch->mem + ch->used;
+  tr->f = cast(JitFunc, tr->mcode);
+  tr->chunk = ch;
+  ch->nref++;
+  ch->used += (J->n + JITALIGN - 1) / JITALIGN * JITALIGN;
+}
+
+
+/*
+** what is being compiled and what compiling it has allocated so far;
+** compilers run protected (see `compile') and leave the freeing to it
+*/
+typedef struct Compile {
+  Proto *p;
+  int forpc;  /* OP_FORLOOP of the loop (-1: the whole function) */
+  StkId base;  /* frame running the loop */
+  JitTrace *tr;
+  char *mem;  /* buffers from `openstate' */
+  size_t total;
+} Compile;
+
+
+static void compileloop (lua_State *L, void *ud) {
+  Compile *c = cast(Compile *, ud);
+  JitState J;
+  Proto *p = c->p;
+  StkId base = c->base;
+  Instruction fl = p->code[c->forpc];
+  int ra = GETARG_A(fl);
+  int len = -GETARG_sBx(fl);  /* the body and the OP_FORLOOP */
+  int isint = ttisint(base + ra);
+  int up, r;
+  up = isint ? (0 < ivalue(base + ra + 2))
+             : luai_numlt(0, nvalue(base + ra + 2));
+  c->tr = newtrace(L, c->forpc);
+  c->mem = openstate(L, &J, p, c->forpc + 1 - len, len, &c->total);
+  J.base = base;
+  J.mark = NULL;
+  prologue(&J);
+  c->tr->start = J.n;
+  forentry(&J, ra, isint, up);
+  memset(J.type, ANY, J.nreg);
+  for (r = ra; r <= ra + 3; r++) J.type[r] = LUA_TNUMBER;
+  compileall(&J);
+  if (!J.fail) {
+    label(&J);
+    if (J.dead) J.fail = 1;  /* no way back to OP_FORLOOP? */
+    else {
+      loopback(&J, ra, isint, up);
+      finish(&J);
+      install(L, &J, c->tr);
+    }
+  }
+}
+
+
+static void compilefunc (lua_State *L, void *ud) {
+  Compile *c = cast(Compile *, ud);
+  JitState J;
+  Proto *p = c->p;
+  int len = p->sizecode;
+  int pc;
+  c->tr = newtrace(L, -1);
+  c->tr->entry = luaM_newvector(L, len, int);
+  c->tr->sizeentry = len;
+  c->mem = openstate(L, &J, p, 0, len + 1, &c->total);
+  J.base = NULL;
+  J.mark[0] = MENTRY;
+  for (pc = 0; pc < len; pc++) {  /* find loop heads */
+    Instruction i = p->code[pc];
+    if ((GET_OPCODE(i) == OP_JMP || GET_OPCODE(i) == OP_FORLOOP) &&
+        GETARG_sBx(i) < 0)
+      J.mark[pc + 1 + GETARG_sBx(i)] |= MHEAD;
+  }
+  prologue(&J);
+  compileall(&J);
+  if (!J.fail) {
+    finish(&J);
+    for (pc = 0; pc < len; pc++)
+      c->tr->entry[pc] = (J.mark[pc] & MENTRY) ? J.label[pc] : -1;
+    install(L, &J, c->tr);
+  }
+}
+
+
+/*
+** runs compiler `f'; returns the trace it made, or NULL if it could not
+** (an error, such as running out of memory, only leaves the code to
+** the interpreter)
+*/
+static JitTrace *compile (lua_State *L, Pfunc f, Compile *c) {
+  c->tr = NULL;
+  c->mem = NULL;
+  luaD_rawrunprotected(L, f, c);
+  if (c->mem) luaM_freemem(L, c->mem, c->total);
+  if (c->tr != NULL && c->tr->f == NULL) {
+    freetrace(L, c->tr);
+    return NULL;
+  }
+  return c->tr;
+}
+
+
+static void droptrace (lua_State *L, Proto *p, JitTrace *tr) {
+  JitTrace **pt = &p->jit;
+  while (*pt != tr) pt = &(*pt)->next;
+  *pt = tr->next;
+  freetrace(L, tr);
+}
+
+
+/*
+** called at the back jump of the OP_FORLOOP whose counter is `hot';
+** returns where the interpreter goes on
+*/
+const Instruction *luaJ_forloop (lua_State *L, LClosure *cl, StkId base,
+                                 int *hot) {
+  Proto *p = cl->p;
+  int forpc = cast_int(hot - p->icache);
+  JitTrace *tr = p->jit;
+  int r;
+  while (tr != NULL && tr->pc != forpc) tr = tr->next;
+  if (tr == NULL && -GETARG_sBx(p->code[forpc]) <= JITMAXLOOP) {
+    Compile c;
+    c.p = p;
+    c.forpc = forpc;
+    c.base = base;
+    tr = compile(L, compileloop, &c);
+    if (tr != NULL) {
+      tr->next = p->jit;
+      p->jit = tr;
+    }
+  }
+  if (tr == NULL) {  /* cannot compile it (now)? */
+    *hot = -JITBACKOFF;
+    return p->code + forpc + 1 + GETARG_sBx(p->code[forpc]);
+  }
+  *hot = LUAI_JITHOT;  /* keep it hot */
+  r = (*tr->f)(base, p->k, cl, L, &tr->niter, tr->mcode + tr->start);
+  if (r < 0) {  /* side exit */
+    r = -1 - r;
+    if (++tr->nexits >= LUAI_JITHOT && tr->niter < 4 * tr->nexits) {
+      droptrace(L, p, tr);  /* most iterations leave it */
+      *hot = -JITBACKOFF;
+    }
+  }
+  return p->code + r;
+}
+
+
+/* compiles the whole function `p' (called by `luaD_precall') */
+void luaJ_compile (lua_State *L, Proto *p) {
+  Compile c;
+  if (p->sizecode > JITMAXFUNC || p->jitfunc != NULL) return;
+  c.p = p;
+  c.forpc = -1;
+  c.base = NULL;
+  p->jitfunc = compile(L, compilefunc, &c);
+}
+
+
+/* runs the native code of the function from `pc', if it can start there */
+const Instruction *luaJ_call (lua_State *L, LClosure *cl, StkId base,
+                              const Instruction *pc) {
+  Proto *p = cl->p;
+  JitTrace *tr = p->jitfunc;
+  int e = tr->entry[pc - p->code];
+  int r;
+  if (e < 0) return pc;
+  r = (*tr->f)(base, p->k, cl, L, &tr->niter, tr->mcode + e);
+  if (r < 0) {  /* side exit */
+    r = -1 - r;
+    tr->nexits++;
+  }
+  return p->code + r;
+}
+
+
+void luaJ_freeproto (lua_State *L, Proto *f) {
+  while (f->jit) droptrace(L, f, f->jit);
+  if (f->jitfunc) freetrace(L, f->jitfunc);
+}
+
+/* }====================================================== */
+
+#endif
@@ -0,0 +1,31 @@
+/*
+** $Id: ljit.h $
+** Native code for hot loops and functions (x86-64)
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "lobject.h"
+
+
+#if defined(LUA_USE_JIT)
+
+LUAI_FUNC const Instruction *luaJ_forloop (lua_State *L, LClosure *cl,
+                                           StkId base, int *hot);
+LUAI_FUNC void luaJ_compile (lua_State *L, Proto *p);
+LUAI_FUNC const Instruction *luaJ_call (lua_State *L, LClosure *cl,
+                                        StkId base, const Instruction *pc);
+LUAI_FUNC void luaJ_freeproto (lua_State *L, Proto *f);
+
+/* counts a call to `p' */
+#define luaJ_count(L,p) \
+  { if ((p)->jitcalls < LUAI_JITCALLS && ++(p)->jitcalls == LUAI_JITCALLS) \
+      luaJ_compile(L, p); }
+
+#else
+#define luaJ_count(L,p)	((void)0)
+#endif
+
+#endif
@@ -122,6 +122,8 @@ TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
     setbvalue(o, 1);  /* make sure `str' will not be collected */
     luaC_checkGC(L);
   }
+  else if (islong(ts))  /* `ts' is a copy of the anchored string? */
+    ts = rawtsvalue(key2tval(val2node(o)));  /* use the anchored one */
   return ts;
 }
 
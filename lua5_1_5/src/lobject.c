@@ -80,6 +80,8 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
       return bvalue(t1) == bvalue(t2);  /* boolean true must be 1 !! */
     case LUA_TLIGHTUSERDATA:
       return pvalue(t1) == pvalue(t2);
+    case LUA_TSTRING:
+      return eqstr(rawtsvalue(t1), rawtsvalue(t2));
     default:
       lua_assert(iscollectable(t1));
       return gcvalue(t1) == gcvalue(t2);
@@ -87,6 +89,25 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
 }
 
 
+/*
+** set `obj' to number `n', keeping its `int' value too when it has one
+** (but not for -0, whose sign would be lost)
+*/
+#if defined(LUA_USE_DUALNUM)
+void luaO_setnumber (TValue *obj, lua_Number n) {
+  int k;
+  lua_number2int(k, n);
+  if (luai_numeq(cast_num(k), n) &&
+      (k != 0 || luai_numlt(0, luai_numdiv(cast_num(1), n)))) {
+    setivalue(obj, k);
+  }
+  else {
+    setnvalue(obj, n);
+  }
+}
+#endif
+
+
 int luaO_str2d (const char *s, lua_Number *result) {
   char *endptr;
   *result = lua_str2number(s, &endptr);
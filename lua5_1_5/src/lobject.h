@@ -68,7 +68,15 @@ typedef union {
 ** Tagged Values
 */
 
+#if defined(LUA_USE_DUALNUM)
+/*
+** a number whose value fits in an `int' may also keep it in `i'; the
+** variant bit in `tt' tells so, and `value.n' is always valid
+*/
+#define TValuefields	Value value; int tt; int i
+#else
 #define TValuefields	Value value; int tt
+#endif
 
 typedef struct lua_TValue {
   TValuefields;
@@ -87,7 +95,16 @@ typedef struct lua_TValue {
 #define ttislightuserdata(o)	(ttype(o) == LUA_TLIGHTUSERDATA)
 
 /* Macros to access values */
+#if defined(LUA_USE_DUALNUM)
+#define LUA_TINT	(LUA_TNUMBER | (1 << 4))  /* number with an `int' copy */
+#define ttype(o)	((o)->tt & 0x0F)
+#define ttisint(o)	((o)->tt == LUA_TINT)
+#define ivalue(o)	check_exp(ttisint(o), (o)->i)
+#else
 #define ttype(o)	((o)->tt)
+#define ttisint(o)	0
+#define ivalue(o)	cast_int(nvalue(o))
+#endif
 #define gcvalue(o)	check_exp(iscollectable(o), (o)->value.gc)
 #define pvalue(o)	check_exp(ttislightuserdata(o), (o)->value.p)
 #define nvalue(o)	check_exp(ttisnumber(o), (o)->value.n)
@@ -119,6 +136,16 @@ typedef struct lua_TValue {
 #define setnvalue(obj,x) \
   { TValue *i_o=(obj); i_o->value.n=(x); i_o->tt=LUA_TNUMBER; }
 
+#if defined(LUA_USE_DUALNUM)
+#define setivalue(obj,x) \
+  { TValue *i_o=(obj); int i_x=(x); \
+    i_o->value.n=cast_num(i_x); i_o->i=i_x; i_o->tt=LUA_TINT; }
+#define setival(o1,o2)	((o1)->i=(o2)->i)
+#else
+#define setivalue(obj,x)	setnvalue(obj, cast_num(x))
+#define setival(o1,o2)	((void)0)
+#endif
+
 #define setpvalue(obj,x) \
   { TValue *i_o=(obj); i_o->value.p=(x); i_o->tt=LUA_TLIGHTUSERDATA; }
 
@@ -160,7 +187,7 @@ typedef struct lua_TValue {
 
 #define setobj(L,obj1,obj2) \
   { const TValue *o2=(obj2); TValue *o1=(obj1); \
-    o1->value = o2->value; o1->tt=o2->tt; \
+    o1->value = o2->value; o1->tt=o2->tt; setival(o1,o2); \
     checkliveness(G(L),o1); }
 
 
@@ -183,7 +210,7 @@ typedef struct lua_TValue {
 #define setobj2n	setobj
 #define setsvalue2n	setsvalue
 
-#define setttype(obj, tt) (ttype(obj) = (tt))
+#define setttype(obj, t) ((obj)->tt = (t))
 
 
 #define iscollectable(o)	(ttype(o) >= LUA_TSTRING)
@@ -201,6 +228,7 @@ typedef union TString {
   struct {
     CommonHeader;
     lu_byte reserved;
+    lu_byte hashed;  /* (long strings) `hash' is already computed */
     unsigned int hash;
     size_t len;
   } tsv;
@@ -225,6 +253,19 @@ typedef union Udata {
 
 
 
+/*
+** Binary chunk given to `lua_loadimage', shared by the code and the
+** line information of the functions loaded from it
+*/
+typedef struct Image {
+  const char *p;
+  size_t size;
+  lua_Release release;
+  void *ud;
+  int nref;  /* functions using it (and the loader, while it runs) */
+} Image;
+
+
 /*
 ** Function Prototypes
 */
@@ -234,13 +275,23 @@ typedef struct Proto {
   Instruction *code;
   struct Proto **p;  /* functions defined inside the function */
   int *lineinfo;  /* map from opcodes to source lines */
+  int *icache;  /* inline caches (one per opcode; OP_FORLOOP counts) */
+#if defined(LUA_USE_JIT)
+  struct JitTrace *jit;  /* native code of hot loops (see ljit.c) */
+  struct JitTrace *jitfunc;  /* native code of the whole function */
+  int jitcalls;  /* calls counted until it gets compiled */
+#endif
   struct LocVar *locvars;  /* information about local variables */
   TString **upvalues;  /* upvalue names */
   TString  *source;
+  Image *image;  /* holds `code' and `lineinfo' (NULL if they are ours) */
+  const char *debug;  /* names in `image' not loaded yet (see lundump.c) */
+  const char *body;  /* code and the rest in `image' not loaded yet */
   int sizeupvalues;
   int sizek;  /* size of `k' */
   int sizecode;
   int sizelineinfo;
+  int sizeicache;
   int sizep;  /* size of `p' */
   int sizelocvars;
   int linedefined;
@@ -292,6 +343,9 @@ typedef struct UpVal {
 	CommonHeader; lu_byte isC; lu_byte nupvalues; GCObject *gclist; \
 	struct Table *env
 
+/* `isC' of a C function pushed by `lua_pushleaf' */
+#define CLEAF	2
+
 typedef struct CClosure {
   ClosureHeader;
   lua_CFunction f;
@@ -313,6 +367,7 @@ typedef union Closure {
 
 
 #define iscfunction(o)	(ttype(o) == LUA_TFUNCTION && clvalue(o)->c.isC)
+#define isleaf(o)	(ttype(o) == LUA_TFUNCTION && clvalue(o)->c.isC == CLEAF)
 #define isLfunction(o)	(ttype(o) == LUA_TFUNCTION && !clvalue(o)->c.isC)
 
 
@@ -323,7 +378,9 @@ typedef union Closure {
 typedef union TKey {
   struct {
     TValuefields;
+#if !defined(LUA_USE_SWISSTABLE)
     struct Node *next;  /* for chaining */
+#endif
   } nk;
   TValue tvk;
 } TKey;
@@ -335,6 +392,22 @@ typedef struct Node {
 } Node;
 
 
+/*
+** Shapes (see ltable.c)
+*/
+typedef struct Shape {
+  struct Shape *parent;  /* shape without the last key */
+  struct Shape *children;  /* shapes that extend this one by one key */
+  struct Shape *sibling;  /* next child of `parent' */
+  TString *key;  /* last key (NULL for the empty shape) */
+  TString **keys;  /* all keys, in slot order */
+  lu_byte *index;  /* open-addressing map from keys to slots */
+  int nref;  /* number of tables and children using this shape */
+  lu_byte nkeys;  /* size of `keys' array */
+  lu_byte lsizeindex;  /* log2 of size of `index' array */
+} Shape;
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */ 
@@ -342,9 +415,19 @@ typedef struct Table {
   struct Table *metatable;
   TValue *array;  /* array part */
   Node *node;
+#if !defined(LUA_USE_SWISSTABLE)
   Node *lastfree;  /* any free position is before this position */
+#else
+  lu_byte *ctrl;  /* control bytes of `node' (see ltable.c) */
+  int freeslots;  /* number of keys `node' can still get */
+#endif
   GCObject *gclist;
   int sizearray;  /* size of `array' array */
+#if defined(LUA_USE_SHAPES)
+  Shape *shape;  /* keys of `fields' (NULL if table has no shape) */
+  TValue *fields;  /* values of the string keys in `shape' */
+  int sizefields;  /* size of `fields' array */
+#endif
 } Table;
 
 
@@ -370,6 +453,11 @@ LUAI_FUNC int luaO_log2 (unsigned int x);
 LUAI_FUNC int luaO_int2fb (unsigned int x);
 LUAI_FUNC int luaO_fb2int (int x);
 LUAI_FUNC int luaO_rawequalObj (const TValue *t1, const TValue *t2);
+#if defined(LUA_USE_DUALNUM)
+LUAI_FUNC void luaO_setnumber (TValue *obj, lua_Number n);
+#else
+#define luaO_setnumber(obj,n)	setnvalue(obj,n)
+#endif
 LUAI_FUNC int luaO_str2d (const char *s, lua_Number *result);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
@@ -52,6 +52,9 @@ const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSE",
   "CLOSURE",
   "VARARG",
+  "GETTABLECALL",
+  "MOVECALL",
+  "GETUPVALTABLE",
   NULL
 };
 
@@ -98,5 +101,16 @@ const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, OpArgN, OpArgN, iABC)		/* OP_CLOSE */
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETTABLECALL */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC)		/* OP_MOVECALL */
+ ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_GETUPVALTABLE */
+};
+
+
+const lu_byte luaP_opfused[NUM_OPCODES-NUM_BASEOPCODES][2] = {
+/* first	   second */
+  {OP_GETTABLE, OP_CALL}		/* OP_GETTABLECALL */
+ ,{OP_MOVE,     OP_CALL}		/* OP_MOVECALL */
+ ,{OP_GETUPVAL, OP_GETTABLE}		/* OP_GETUPVALTABLE */
 };
 
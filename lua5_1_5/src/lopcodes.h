@@ -204,11 +204,18 @@ OP_SETLIST,/*	A B C	R(A)[(C-1)*FPF+i] := R(A+i), 1 <= i <= B	*/
 OP_CLOSE,/*	A 	close all variables in the stack up to (>=) R(A)*/
 OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx], R(A), ... ,R(A+n))	*/
 
-OP_VARARG/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
+OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
+
+OP_GETTABLECALL,/* A B C	OP_GETTABLE A B C; then next OP_CALL		*/
+OP_MOVECALL,/*	A B	OP_MOVE A B; then next OP_CALL			*/
+OP_GETUPVALTABLE/* A B	OP_GETUPVAL A B; then next OP_GETTABLE		*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_VARARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_GETUPVALTABLE) + 1)
+
+/* opcodes of stock Lua 5.1; the ones after them are fused (see notes) */
+#define NUM_BASEOPCODES	(cast(int, OP_VARARG) + 1)
 
 
 
@@ -230,6 +237,12 @@ OP_VARARG/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
       (true or false).
 
   (*) All `skips' (pc++) assume that next instruction is a jump
+
+  (*) A fused opcode does the work of its first opcode and then runs the
+      next instruction (which must be the second opcode of the pair) without
+      dispatching it; that instruction stays in the code, so jumps to it
+      and its line info still work. Comparisons and tests are not fused
+      with their following OP_JMP because they already consume it.
 ===========================================================================*/
 
 
@@ -261,6 +274,15 @@ LUAI_DATA const lu_byte luaP_opmodes[NUM_OPCODES];
 LUAI_DATA const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 
 
+/* pair of opcodes replaced by each fused opcode */
+LUAI_DATA const lu_byte luaP_opfused[NUM_OPCODES-NUM_BASEOPCODES][2];
+
+#define isFusedOp(m)	((m) >= NUM_BASEOPCODES)
+#define getBaseOp(m)	(isFusedOp(m) ? \
+	cast(OpCode, luaP_opfused[(m)-NUM_BASEOPCODES][0]) : (m))
+#define getFusedNext(m)	(cast(OpCode, luaP_opfused[(m)-NUM_BASEOPCODES][1]))
+
+
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
 
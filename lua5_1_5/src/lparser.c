@@ -186,7 +186,7 @@ static int indexupvalue (FuncState *fs, TString *name, expdesc *v) {
   int oldsize = f->sizeupvalues;
   for (i=0; i<f->nups; i++) {
     if (fs->upvalues[i].k == v->k && fs->upvalues[i].info == v->u.s.info) {
-      lua_assert(f->upvalues[i] == name);
+      lua_assert(eqstr(f->upvalues[i], name));
       return i;
     }
   }
@@ -207,7 +207,7 @@ static int indexupvalue (FuncState *fs, TString *name, expdesc *v) {
 static int searchvar (FuncState *fs, TString *n) {
   int i;
   for (i=fs->nactvar-1; i >= 0; i--) {
-    if (n == getlocvar(fs, i).varname)
+    if (eqstr(n, getlocvar(fs, i).varname))
       return i;
   }
   return -1;  /* not found */
@@ -230,6 +230,8 @@ static int singlevaraux (FuncState *fs, TString *n, expdesc *var, int base) {
     int v = searchvar(fs, n);  /* look up at current level */
     if (v >= 0) {
       init_exp(var, VLOCAL, v);
+      if (v == fs->f->numparams && (fs->f->is_vararg & VARARG_HASARG))
+        fs->usesarg = 1;  /* it is `arg' */
       if (!base)
         markupval(fs, v);  /* local will be used as an upval */
       return VLOCAL;
@@ -341,6 +343,7 @@ static void open_func (LexState *ls, FuncState *fs) {
   fs->np = 0;
   fs->nlocvars = 0;
   fs->nactvar = 0;
+  fs->usesarg = 0;
   fs->bl = NULL;
   f->source = ls->source;
   f->maxstacksize = 2;  /* registers 0/1 are always valid */
@@ -358,9 +361,14 @@ static void close_func (LexState *ls) {
   FuncState *fs = ls->fs;
   Proto *f = fs->f;
   removevars(ls, 0);
+  if (!fs->usesarg)  /* `arg' never used? */
+    f->is_vararg &= ~VARARG_NEEDSARG;  /* don't build it */
   luaK_ret(fs, 0, 0);  /* final return */
+  if (ls->optimize) luaK_optimize(fs);
+  luaK_fuse(fs);
   luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction);
   f->sizecode = fs->pc;
+  luaF_initcache(L, f);
   luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int);
   f->sizelineinfo = fs->pc;
   luaM_reallocvector(L, f->k, f->sizek, fs->nk, TValue);
@@ -380,10 +388,12 @@ static void close_func (LexState *ls) {
 }
 
 
-Proto *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff, const char *name) {
+Proto *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff, const char *name,
+                    int opt) {
   struct LexState lexstate;
   struct FuncState funcstate;
   lexstate.buff = buff;
+  lexstate.optimize = cast_byte(opt != 0);
   luaX_setinput(L, &lexstate, z, luaS_new(L, name));
   open_func(&lexstate, &funcstate);
   funcstate.f->is_vararg = VARARG_ISVARARG;  /* main func. is always vararg */
@@ -6,6 +6,7 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #define lstate_c
 #define LUA_CORE
@@ -39,15 +40,19 @@ typedef struct LG {
   
 
 
-static void stack_init (lua_State *L1, lua_State *L) {
-  /* initialize CallInfo array */
-  L1->base_ci = luaM_newvector(L, BASIC_CI_SIZE, CallInfo);
+static void stack_init (lua_State *L1, lua_State *L, int nci, int nstack) {
+  /* initialize CallInfo array (unless kept from a pooled thread) */
+  if (L1->base_ci == NULL) {
+    L1->base_ci = luaM_newvector(L, nci, CallInfo);
+    L1->size_ci = nci;
+  }
   L1->ci = L1->base_ci;
-  L1->size_ci = BASIC_CI_SIZE;
   L1->end_ci = L1->base_ci + L1->size_ci - 1;
-  /* initialize stack array */
-  L1->stack = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, TValue);
-  L1->stacksize = BASIC_STACK_SIZE + EXTRA_STACK;
+  /* initialize stack array (idem) */
+  if (L1->stack == NULL) {
+    L1->stack = luaM_newvector(L, nstack + EXTRA_STACK, TValue);
+    L1->stacksize = nstack + EXTRA_STACK;
+  }
   L1->top = L1->stack;
   L1->stack_last = L1->stack+(L1->stacksize - EXTRA_STACK)-1;
   /* initialize first ci */
@@ -70,7 +75,10 @@ static void freestack (lua_State *L, lua_State *L1) {
 static void f_luaopen (lua_State *L, void *ud) {
   global_State *g = G(L);
   UNUSED(ud);
-  stack_init(L, L);  /* init stack */
+  stack_init(L, L, BASIC_CI_SIZE, BASIC_STACK_SIZE);  /* init stack */
+#if defined(LUA_USE_SHAPES)
+  luaH_initshapes(L);
+#endif
   sethvalue(L, gt(L), luaH_new(L, 0, 2));  /* table of globals */
   sethvalue(L, registry(L), luaH_new(L, 0, 2));  /* registry */
   luaS_resize(L, MINSTRTABSIZE);  /* initial size of string table */
@@ -83,8 +91,6 @@ static void f_luaopen (lua_State *L, void *ud) {
 
 static void preinit_state (lua_State *L, global_State *g) {
   G(L) = g;
-  L->stack = NULL;
-  L->stacksize = 0;
   L->errorJmp = NULL;
   L->hook = NULL;
   L->hookmask = 0;
@@ -92,12 +98,15 @@ static void preinit_state (lua_State *L, global_State *g) {
   L->allowhook = 1;
   resethookcount(L);
   L->openupval = NULL;
-  L->size_ci = 0;
+  L->minstack = L->minci = 0;
   L->nCcalls = L->baseCcalls = 0;
   L->status = 0;
-  L->base_ci = L->ci = NULL;
+  L->ci = NULL;
   L->savedpc = NULL;
   L->errfunc = 0;
+  L->resumer = L->resuming = NULL;
+  L->resumek = NULL;
+  L->nresumeargs = 0;
   setnilvalue(gt(L));
 }
 
@@ -106,9 +115,23 @@ static void close_state (lua_State *L) {
   global_State *g = G(L);
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
   luaC_freeall(L);  /* collect all objects */
+#if defined(LUA_USE_THREADPOOL)
+  while (g->threadpool != NULL) {
+    lua_State *L1 = gco2th(g->threadpool);
+    g->threadpool = L1->next;
+    freestack(L, L1);
+    luaM_freemem(L, fromstate(L1), state_size(lua_State));
+  }
+  g->nthreadpool = 0;
+#endif
+#if defined(LUA_USE_SHAPES)
+  luaH_freeshapes(L);
+#endif
   lua_assert(g->rootgc == obj2gco(L));
   lua_assert(g->strt.nuse == 0);
-  luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size, TString *);
+  luaM_freemem(L, G(L)->strt.hash, sizestrt(G(L)->strt.size));
+  if (g->strt.ohash != NULL)
+    luaM_freemem(L, g->strt.ohash, sizestrt(g->strt.osize));
   luaZ_freebuffer(L, &g->buff);
   freestack(L, L);
   lua_assert(g->totalbytes == sizeof(LG));
@@ -117,10 +140,26 @@ static void close_state (lua_State *L) {
 
 
 lua_State *luaE_newthread (lua_State *L) {
-  lua_State *L1 = tostate(luaM_malloc(L, state_size(lua_State)));
+  lua_State *L1;
+#if defined(LUA_USE_THREADPOOL)
+  global_State *g = G(L);
+  if (g->threadpool != NULL) {  /* reuse a dead thread with its stack */
+    L1 = gco2th(g->threadpool);
+    g->threadpool = L1->next;
+    g->nthreadpool--;
+  }
+  else
+#endif
+  {
+    L1 = tostate(luaM_malloc(L, state_size(lua_State)));
+    L1->stack = NULL;
+    L1->stacksize = 0;
+    L1->base_ci = NULL;
+    L1->size_ci = 0;
+  }
   luaC_link(L, obj2gco(L1), LUA_TTHREAD);
   preinit_state(L1, G(L));
-  stack_init(L1, L);  /* init stack */
+  stack_init(L1, L, LUAI_THREADCI, LUAI_THREADSTACK);  /* init stack */
   setobj2n(L, gt(L1), gt(L));  /* share table of globals */
   L1->hookmask = L->hookmask;
   L1->basehookcount = L->basehookcount;
@@ -135,12 +174,59 @@ void luaE_freethread (lua_State *L, lua_State *L1) {
   luaF_close(L1, L1->stack);  /* close all upvalues for this thread */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L1);
+#if defined(LUA_USE_THREADPOOL)
+  if (G(L)->nthreadpool < LUAI_THREADPOOL) {
+    global_State *g = G(L);
+    /* keep arrays that the collector would not shrink (`checkstacksizes') */
+    if (L1->size_ci > 2*BASIC_CI_SIZE) {
+      luaM_freearray(L, L1->base_ci, L1->size_ci, CallInfo);
+      L1->base_ci = NULL;
+      L1->size_ci = 0;
+    }
+    if (L1->stacksize > 2*(BASIC_STACK_SIZE+EXTRA_STACK)) {
+      luaM_freearray(L, L1->stack, L1->stacksize, TValue);
+      L1->stack = NULL;
+      L1->stacksize = 0;
+    }
+    L1->next = g->threadpool;
+    g->threadpool = obj2gco(L1);
+    g->nthreadpool++;
+    return;
+  }
+#endif
   freestack(L, L1);
   luaM_freemem(L, fromstate(L1), state_size(lua_State));
 }
 
 
+/*
+** a seed for string hashes that attackers cannot guess easily: some
+** randomness from `luai_makeseed' plus a few addresses (randomized by
+** the system, when it can), mixed by the hash function itself
+*/
+#define addbuff(b,p,e) \
+  { size_t t = cast(size_t, e); \
+    memcpy((b) + (p), &t, sizeof(t)); (p) += sizeof(t); }
+
+static unsigned int makeseed (void *ud) {
+  char buff[3 * sizeof(size_t)];
+  unsigned int h = luai_makeseed();
+  int p = 0;
+  addbuff(buff, p, &h);  /* local variable */
+  addbuff(buff, p, ud);  /* allocator data */
+  addbuff(buff, p, &makeseed);  /* function in this module */
+  lua_assert(p == sizeof(buff));
+  return luaS_hash(buff, p, h);
+}
+
+
 LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
+  return lua_newstateseed(f, ud, makeseed(ud));
+}
+
+
+LUA_API lua_State *lua_newstateseed (lua_Alloc f, void *ud,
+                                     unsigned int seed) {
   int i;
   lua_State *L;
   global_State *g;
@@ -150,6 +236,10 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g = &((LG *)L)->g;
   L->next = NULL;
   L->tt = LUA_TTHREAD;
+  L->stack = NULL;
+  L->stacksize = 0;
+  L->base_ci = NULL;
+  L->size_ci = 0;
   g->currentwhite = bit2mask(WHITE0BIT, FIXEDBIT);
   L->marked = luaC_white(g);
   set2bits(L->marked, FIXEDBIT, SFIXEDBIT);
@@ -163,21 +253,43 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->strt.size = 0;
   g->strt.nuse = 0;
   g->strt.hash = NULL;
+  g->strt.ohash = NULL;
+  g->strt.osize = g->strt.omoved = 0;
   setnilvalue(registry(L));
   luaZ_initbuffer(L, &g->buff);
   g->panic = NULL;
   g->gcstate = GCSpause;
+  g->gckind = KGC_NORMAL;
+  g->lastmajor = 0;
   g->rootgc = obj2gco(L);
   g->sweepstrgc = 0;
   g->sweepgc = &g->rootgc;
   g->gray = NULL;
   g->grayagain = NULL;
   g->weak = NULL;
+  g->partial = NULL;
+  g->partialpos = 0;
   g->tmudata = NULL;
   g->totalbytes = sizeof(LG);
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
   g->gcdept = 0;
+  g->nofuse = 0;
+  g->seed = seed;
+#if defined(LUA_USE_THREADPOOL)
+  g->threadpool = NULL;
+  g->nthreadpool = 0;
+#endif
+#if defined(LUA_USE_SHAPES)
+  g->rootshape = NULL;
+#endif
+#if defined(LUA_USE_JIT)
+  g->jitchunk = NULL;
+#endif
+#if defined(LUA_USE_BGSWEEP)
+  g->bgsweep = NULL;
+  g->bgrunning = 0;
+#endif
   for (i=0; i<NUM_TAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != 0) {
     /* memory allocation error: free partial state */
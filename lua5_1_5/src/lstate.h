@@ -39,6 +39,9 @@ typedef struct stringtable {
   GCObject **hash;
   lu_int32 nuse;  /* number of elements */
   int size;
+  GCObject **ohash;  /* previous array, during a resize (see lstring.c) */
+  int osize;
+  int omoved;  /* number of buckets of `ohash' already emptied */
 } stringtable;
 
 
@@ -71,12 +74,15 @@ typedef struct global_State {
   void *ud;         /* auxiliary data to `frealloc' */
   lu_byte currentwhite;
   lu_byte gcstate;  /* state of garbage collector */
+  lu_byte gckind;  /* kind of GC running (KGC_NORMAL or KGC_GEN) */
   int sweepstrgc;  /* position of sweep in `strt' */
   GCObject *rootgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* position of sweep in `rootgc' */
   GCObject *gray;  /* list of gray objects */
   GCObject *grayagain;  /* list of objects to be traversed atomically */
   GCObject *weak;  /* list of weak tables (to be cleared) */
+  GCObject *partial;  /* big table being traversed in pieces */
+  int partialpos;  /* next slot of `partial' to traverse */
   GCObject *tmudata;  /* last element of list of userdata to be GC */
   Mbuffer buff;  /* temporary buffer for string concatentation */
   lu_mem GCthreshold;
@@ -85,6 +91,23 @@ typedef struct global_State {
   lu_mem gcdept;  /* how much GC is `behind schedule' */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC `granularity' */
+  lu_mem lastmajor;  /* memory in use after last major collection */
+  lu_byte nofuse;  /* do not emit fused opcodes when compiling */
+  unsigned int seed;  /* seed of string hashes */
+#if defined(LUA_USE_THREADPOOL)
+  GCObject *threadpool;  /* dead threads kept for reuse */
+  int nthreadpool;  /* number of threads in `threadpool' */
+#endif
+#if defined(LUA_USE_SHAPES)
+  struct Shape *rootshape;  /* empty shape (root of all shapes) */
+#endif
+#if defined(LUA_USE_JIT)
+  struct JitChunk *jitchunk;  /* code pages being filled (see ljit.c) */
+#endif
+#if defined(LUA_USE_BGSWEEP)
+  struct BGSweep *bgsweep;  /* background sweeper (see lgc.c) */
+  lu_byte bgrunning;  /* `bgsweep' is sweeping */
+#endif
   lua_CFunction panic;  /* to be called in unprotected errors */
   TValue l_registry;
   struct lua_State *mainthread;
@@ -111,6 +134,8 @@ struct lua_State {
   CallInfo *base_ci;  /* array of CallInfo's */
   int stacksize;
   int size_ci;  /* size of array `base_ci' */
+  int minstack;  /* the collector does not shrink `stack' below this size */
+  int minci;  /* nor `base_ci' below this size (see `lua_reservestack') */
   unsigned short nCcalls;  /* number of nested C calls */
   unsigned short baseCcalls;  /* nested C calls when resuming coroutine */
   lu_byte hookmask;
@@ -124,6 +149,10 @@ struct lua_State {
   GCObject *gclist;
   struct lua_longjmp *errorJmp;  /* current error recover point */
   ptrdiff_t errfunc;  /* current error handling function (stack index) */
+  struct lua_State *resumer;  /* thread that resumed this one (`luaD_switch') */
+  struct lua_State *resuming;  /* thread asked for by `lua_resumek' */
+  lua_KFunction resumek;  /* continuation of that `lua_resumek' */
+  int nresumeargs;  /* number of arguments for `resuming' */
 };
 
 
@@ -19,29 +19,90 @@
 
 
 
+/*
+** A resize does not rehash all strings at once: the old array stays in
+** `ohash' and each call to `luaS_newlstr' moves a few of its buckets to
+** the new one (`omoved' counts them). Bucket `i' of the new array gets
+** strings only from old buckets congruent to `i' modulo `osize', so it
+** is cleared when the first of them moves (see `validbucket'); until
+** then its strings stay in the old array. Buckets do not move while the
+** collector sweeps them.
+*/
+#define STRMOVE		4  /* buckets moved by each call */
+
+
+static void movebucket (stringtable *tb, int i) {
+  GCObject *p = tb->ohash[i];
+  lu_byte *young = youngbuckets(tb->hash, tb->size);
+  int j;
+  for (j = i; j < tb->size; j += tb->osize)  /* buckets that get valid */
+    tb->hash[j] = NULL;
+  tb->ohash[i] = NULL;
+  while (p) {  /* for each node in the list */
+    GCObject *next = p->gch.next;  /* save next */
+    unsigned int h = gco2ts(p)->hash;
+    int h1 = lmod(h, tb->size);  /* new position */
+    GCObject **q = &tb->hash[h1];
+    lua_assert(cast_int(h%tb->size) == lmod(h, tb->size));
+    if (isold(p)) {  /* keep young strings before old ones */
+      while (*q != NULL && !isold(*q))
+        q = &(*q)->gch.next;
+    }
+    else
+      markyoung(young, h1);
+    p->gch.next = *q;  /* chain it */
+    *q = p;
+    p = next;
+  }
+}
+
+
+static void movebuckets (lua_State *L, stringtable *tb, int n) {
+  lua_assert(tb->ohash != NULL);
+  if (G(L)->gcstate == GCSsweepstring)
+    return;  /* cannot move strings during GC traverse */
+  for (; n > 0 && tb->omoved < tb->osize; n--)
+    movebucket(tb, tb->omoved++);
+  if (tb->omoved == tb->osize) {  /* old array is empty? */
+    luaM_freemem(L, tb->ohash, sizestrt(tb->osize));
+    tb->ohash = NULL;
+    tb->osize = tb->omoved = 0;
+  }
+}
+
+
+/*
+** returns the array (old or new) with the bucket for hash `h' and sets
+** `*size' to its size
+*/
+static GCObject **bucketarray (stringtable *tb, unsigned int h, int *size) {
+  if (tb->ohash != NULL && lmod(h, tb->osize) >= tb->omoved) {
+    *size = tb->osize;  /* bucket not moved yet */
+    return tb->ohash;
+  }
+  *size = tb->size;
+  return tb->hash;
+}
+
+
 void luaS_resize (lua_State *L, int newsize) {
   GCObject **newhash;
-  stringtable *tb;
-  int i;
+  stringtable *tb = &G(L)->strt;
   if (G(L)->gcstate == GCSsweepstring)
     return;  /* cannot resize during GC traverse */
-  newhash = luaM_newvector(L, newsize, GCObject *);
-  tb = &G(L)->strt;
-  for (i=0; i<newsize; i++) newhash[i] = NULL;
-  /* rehash */
-  for (i=0; i<tb->size; i++) {
-    GCObject *p = tb->hash[i];
-    while (p) {  /* for each node in the list */
-      GCObject *next = p->gch.next;  /* save next */
-      unsigned int h = gco2ts(p)->hash;
-      int h1 = lmod(h, newsize);  /* new position */
-      lua_assert(cast_int(h%newsize) == lmod(h, newsize));
-      p->gch.next = newhash[h1];  /* chain it */
-      newhash[h1] = p;
-      p = next;
-    }
+  if (tb->ohash != NULL)  /* previous resize not finished? */
+    movebuckets(L, tb, tb->osize);  /* finish it now */
+  newhash = cast(GCObject **, luaM_malloc(L, sizestrt(newsize)));
+  memset(youngbuckets(newhash, newsize), 0, sizeyoung(newsize));
+  if (tb->size > 0) {  /* move old strings step by step */
+    tb->ohash = tb->hash;
+    tb->osize = tb->size;
+    tb->omoved = 0;
+  }
+  else {  /* creating the table */
+    int i;
+    for (i=0; i<newsize; i++) newhash[i] = NULL;
   }
-  luaM_freearray(L, tb->hash, tb->size, TString *);
   tb->size = newsize;
   tb->hash = newhash;
 }
@@ -51,6 +112,8 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
                                        unsigned int h) {
   TString *ts;
   stringtable *tb;
+  GCObject **hash;
+  int size;
   if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))
     luaM_toobig(L);
   ts = cast(TString *, luaM_malloc(L, (l+1)*sizeof(char)+sizeof(TString)));
@@ -59,12 +122,15 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
   ts->tsv.marked = luaC_white(G(L));
   ts->tsv.tt = LUA_TSTRING;
   ts->tsv.reserved = 0;
+  ts->tsv.hashed = 1;
   memcpy(ts+1, str, l*sizeof(char));
   ((char *)(ts+1))[l] = '\0';  /* ending 0 */
   tb = &G(L)->strt;
-  h = lmod(h, tb->size);
-  ts->tsv.next = tb->hash[h];  /* chain new entry */
-  tb->hash[h] = obj2gco(ts);
+  hash = bucketarray(tb, h, &size);
+  h = lmod(h, size);
+  ts->tsv.next = hash[h];  /* chain new entry */
+  hash[h] = obj2gco(ts);
+  markyoung(youngbuckets(hash, size), h);
   tb->nuse++;
   if (tb->nuse > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
     luaS_resize(L, tb->size*2);  /* too crowded */
@@ -72,16 +138,74 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
 }
 
 
-TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
-  GCObject *o;
-  unsigned int h = cast(unsigned int, l);  /* seed */
-  size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
-  size_t l1;
-  for (l1=l; l1>=step; l1-=step)  /* compute hash */
-    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
-  for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];
-       o != NULL;
-       o = o->gch.next) {
+/*
+** long strings go straight to `rootgc', like other objects
+*/
+static TString *newlngstr (lua_State *L, const char *str, size_t l) {
+  TString *ts;
+  if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))
+    luaM_toobig(L);
+  ts = cast(TString *, luaM_malloc(L, (l+1)*sizeof(char)+sizeof(TString)));
+  ts->tsv.len = l;
+  ts->tsv.hash = G(L)->seed;  /* kept here until the hash is computed */
+  ts->tsv.reserved = 0;
+  ts->tsv.hashed = 0;
+  memcpy(ts+1, str, l*sizeof(char));
+  ((char *)(ts+1))[l] = '\0';  /* ending 0 */
+  luaC_link(L, obj2gco(ts), LUA_TSTRING);
+  return ts;
+}
+
+
+int luaS_eqlngstr (const TString *a, const TString *b) {
+  size_t len = a->tsv.len;
+  lua_assert(islong(a));
+  return (len == b->tsv.len) && (memcmp(getstr(a), getstr(b), len) == 0);
+}
+
+
+unsigned int luaS_hashlong (TString *ts) {
+  lua_assert(islong(ts) && !ts->tsv.hashed);
+  ts->tsv.hash = luaS_hash(getstr(ts), ts->tsv.len, ts->tsv.hash);
+  ts->tsv.hashed = 1;
+  return ts->tsv.hash;
+}
+
+
+/*
+** hash of all chars of a string, four at a time (the mixing steps are
+** those of MurmurHash3); with a random `seed', colliding keys cannot be
+** precomputed
+*/
+#define rotl(x,n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  lu_int32 h = cast(lu_int32, seed) ^ cast(lu_int32, l);
+  lu_int32 k;
+  size_t i;
+  for (i = 0; i + 4 <= l; i += 4) {
+    memcpy(&k, str + i, 4);
+    k *= 0xcc9e2d51; k = rotl(k, 15); k *= 0x1b873593;
+    h ^= k; h = rotl(h, 13); h = h*5 + 0xe6546b64;
+  }
+  k = 0;
+  switch (l & 3) {  /* remaining chars */
+    case 3: k ^= cast(lu_int32, cast(unsigned char, str[i+2])) << 16;
+    case 2: k ^= cast(lu_int32, cast(unsigned char, str[i+1])) << 8;
+    case 1: k ^= cast(unsigned char, str[i]);
+      k *= 0xcc9e2d51; k = rotl(k, 15); k *= 0x1b873593;
+      h ^= k;
+  }
+  h ^= h >> 16; h *= 0x85ebca6b;  /* final mix */
+  h ^= h >> 13; h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return cast(unsigned int, h);
+}
+
+
+static TString *findstr (lua_State *L, GCObject *o, const char *str,
+                                       size_t l) {
+  for (; o != NULL; o = o->gch.next) {
     TString *ts = rawgco2ts(o);
     if (ts->tsv.len == l && (memcmp(str, getstr(ts), l) == 0)) {
       /* string may be dead */
@@ -89,7 +213,24 @@ TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
       return ts;
     }
   }
-  return newlstr(L, str, l, h);  /* not found */
+  return NULL;
+}
+
+
+TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
+  stringtable *tb = &G(L)->strt;
+  GCObject **hash;
+  TString *ts;
+  unsigned int h;
+  int size;
+  if (l > LUAI_MAXSHORTLEN)
+    return newlngstr(L, str, l);
+  h = luaS_hash(str, l, G(L)->seed);
+  if (tb->ohash != NULL)  /* resizing? */
+    movebuckets(L, tb, STRMOVE);
+  hash = bucketarray(tb, h, &size);
+  ts = findstr(L, hash[lmod(h, size)], str, l);
+  return (ts != NULL) ? ts : newlstr(L, str, l, h);  /* not found? */
 }
 
 
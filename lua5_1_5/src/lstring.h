@@ -23,9 +23,34 @@
 
 #define luaS_fix(s)	l_setbit((s)->tsv.marked, FIXEDBIT)
 
+/*
+** strings longer than LUAI_MAXSHORTLEN are not in `strt': two of them
+** may have the same contents, and they get their hash only when needed
+*/
+#define islong(ts)	((ts)->tsv.len > LUAI_MAXSHORTLEN)
+#define eqstr(a,b)	((a) == (b) || (islong(a) && luaS_eqlngstr(a, b)))
+#define strhash(ts)	(((ts)->tsv.hashed) ? (ts)->tsv.hash : luaS_hashlong(ts))
+
+/*
+** the hash array of `strt' is followed by a bitmap of the buckets that
+** may hold young strings, so that a minor collection sweeps only them
+*/
+#define sizeyoung(n)	(((n)+7)/8)
+#define sizestrt(n)	((n)*sizeof(GCObject *) + sizeyoung(n))
+#define youngbuckets(h,n)	(cast(lu_byte *, (h) + (n)))
+#define markyoung(y,i)	((y)[(i)>>3] |= cast_byte(1 << ((i)&7)))
+
+/* during a resize, whether bucket `i' of the new array is in use yet */
+#define validbucket(tb,i)	((tb)->ohash == NULL || \
+				 lmod(i, (tb)->osize) < (tb)->omoved)
+
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, Table *e);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
+LUAI_FUNC int luaS_eqlngstr (const TString *a, const TString *b);
+LUAI_FUNC unsigned int luaS_hashlong (TString *ts);
+LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l,
+                                  unsigned int seed);
 
 
 #endif
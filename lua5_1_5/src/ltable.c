@@ -16,11 +16,17 @@
 ** in its main position (i.e. the `original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** (With LUA_USE_SWISSTABLE the hash part uses open addressing instead;
+** see `findnode'.)
 */
 
 #include <math.h>
 #include <string.h>
 
+#if defined(LUA_USE_SWISSTABLE) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define ltable_c
 #define LUA_CORE
 
@@ -32,6 +38,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lstring.h"
 #include "ltable.h"
 
 
@@ -49,7 +56,7 @@
 
 #define hashpow2(t,n)      (gnode(t, lmod((n), sizenode(t))))
   
-#define hashstr(t,str)  hashpow2(t, (str)->tsv.hash)
+#define hashstr(t,str)  hashpow2(t, strhash(str))
 #define hashboolean(t,p)        hashpow2(t, p)
 
 
@@ -69,15 +76,27 @@
 #define numints		cast_int(sizeof(lua_Number)/sizeof(int))
 
 
+#if defined(LUA_USE_SHAPES)
+#define numfields(t)	((t)->shape != NULL ? (t)->shape->nkeys : 0)
+#else
+#define numfields(t)	0
+#endif
+
+
 
 #define dummynode		(&dummynode_)
 
 static const Node dummynode_ = {
   {{NULL}, LUA_TNIL},  /* value */
-  {{{NULL}, LUA_TNIL, NULL}}  /* key */
+  {{{NULL}, LUA_TNIL}}  /* key */
 };
 
 
+#if !defined(LUA_USE_SWISSTABLE)
+
+#define freenodes(L,n,size)	luaM_freearray(L, n, size, Node)
+
+
 /*
 ** hash for lua_Numbers
 */
@@ -112,13 +131,216 @@ static Node *mainposition (const Table *t, const TValue *key) {
   }
 }
 
+#else
+
+/*
+** {=============================================================
+** Open-addressing hash part (LUA_USE_SWISSTABLE)
+** Each node has a control byte in `t->ctrl': CEMPTY if the node was
+** never used, otherwise 7 bits (`h2') of the hash of its key. A key is
+** searched in groups of GROUPSIZE control bytes, the first one starting
+** at the node given by its hash and each next one further away: all
+** bytes of a group are compared with `h2' at once (with SSE2 when
+** available) and only nodes that match get their keys compared. A
+** group with an empty node ends the search, so the hash part never
+** gets full (see `maxfill'). `ctrl' repeats its first GROUPSIZE bytes
+** after the last node, so that a group can start anywhere.
+** As with chained scatter, keys are never removed: a key with a nil
+** value stays in its node (so that `next' finds it) until a rehash.
+** ==============================================================
+*/
+
+#define GROUPSIZE	16
+#define CEMPTY		0x80
+#define h2(h)		cast_byte(((h) >> 25) & 0x7f)
+
+/* maximum number of keys in a hash part with `size' nodes */
+#define maxfill(size)	((size) <= 8 ? (size) - 1 : (size) - (size)/8)
+
+/* nodes and control bytes are allocated as one block */
+#define sizenodes(size)	(cast(size_t, size)*sizeof(Node) + (size) + GROUPSIZE)
+
+#define freenodes(L,n,size)	luaM_freemem(L, n, sizenodes(size))
+
+
+static const lu_byte dummyctrl[GROUPSIZE] = {
+  CEMPTY, CEMPTY, CEMPTY, CEMPTY, CEMPTY, CEMPTY, CEMPTY, CEMPTY,
+  CEMPTY, CEMPTY, CEMPTY, CEMPTY, CEMPTY, CEMPTY, CEMPTY, CEMPTY
+};
+
+
+/*
+** returns a mask with bit `i' set iff byte `i' of group `g' is `c'
+*/
+static unsigned int matchbyte (const lu_byte *g, int c) {
+#if defined(__SSE2__)
+  __m128i v = _mm_loadu_si128(cast(const __m128i *, g));
+  return cast(unsigned int,
+              _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(cast(char, c)))));
+#else
+  unsigned int m = 0;
+  int i;
+  for (i = 0; i < GROUPSIZE; i++)
+    if (g[i] == c) m |= 1u << i;
+  return m;
+#endif
+}
+
+
+#if defined(__GNUC__)
+#define firstbit(m)	__builtin_ctz(m)
+#define prefetch(p)	__builtin_prefetch(p)
+#else
+static int firstbit (unsigned int m) {
+  int i = 0;
+  while ((m & 1) == 0) { m >>= 1; i++; }
+  return i;
+}
+#define prefetch(p)	((void)(p))
+#endif
+
+
+/*
+** spreads all bits of `h' over the whole word (nodes are chosen by its
+** lower bits and `h2' by its higher bits)
+*/
+static unsigned int mixhash (unsigned int h) {
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+
+static unsigned int hashkey (const TValue *key) {
+  unsigned int h;
+  switch (ttype(key)) {
+    case LUA_TNUMBER: {
+      lua_Number n = nvalue(key);
+      unsigned int a[numints];
+      int i;
+      if (luai_numeq(n, 0))  /* avoid problems with -0 */
+        return 0;
+      memcpy(a, &n, sizeof(a));
+      for (i = 1; i < numints; i++) a[0] += a[i];
+      h = a[0];
+      break;
+    }
+    case LUA_TSTRING:
+      h = strhash(rawtsvalue(key));
+      break;
+    case LUA_TBOOLEAN:
+      h = bvalue(key);
+      break;
+    case LUA_TLIGHTUSERDATA:
+      h = IntPoint(pvalue(key));
+      break;
+    default:
+      h = IntPoint(gcvalue(key));
+      break;
+  }
+  return mixhash(h);
+}
+
+
+/*
+** returns the node with key `key' (or, if `dead' is true, with a dead
+** key for the same object), NULL if there is none
+*/
+static Node *findnode (const Table *t, const TValue *key, int dead) {
+  unsigned int h = hashkey(key);
+  int mask = sizenode(t) - 1;
+  int pos = lmod(h, sizenode(t));
+  int step = 0;
+  prefetch(gnode(t, pos));  /* `key' is most probably there */
+  for (;;) {
+    const lu_byte *g = t->ctrl + pos;
+    unsigned int m;
+    for (m = matchbyte(g, h2(h)); m != 0; m &= m - 1) {
+      Node *n = gnode(t, (pos + firstbit(m)) & mask);
+      if (luaO_rawequalObj(key2tval(n), key) ||
+          (dead && ttype(gkey(n)) == LUA_TDEADKEY && iscollectable(key) &&
+           gcvalue(gkey(n)) == gcvalue(key)))
+        return n;
+    }
+    if (matchbyte(g, CEMPTY) != 0)  /* `key' would be in this group */
+      return NULL;
+    step += GROUPSIZE;
+    pos = (pos + step) & mask;
+  }
+}
+
+
+/*
+** same as `findnode', specialized for strings
+*/
+static Node *findstr (const Table *t, TString *key) {
+  unsigned int h = mixhash(strhash(key));
+  int mask = sizenode(t) - 1;
+  int pos = lmod(h, sizenode(t));
+  int step = 0;
+  prefetch(gnode(t, pos));  /* `key' is most probably there */
+  for (;;) {
+    const lu_byte *g = t->ctrl + pos;
+    unsigned int m;
+    for (m = matchbyte(g, h2(h)); m != 0; m &= m - 1) {
+      Node *n = gnode(t, (pos + firstbit(m)) & mask);
+      if (ttisstring(gkey(n)) && eqstr(key, rawtsvalue(gkey(n))))
+        return n;
+    }
+    if (matchbyte(g, CEMPTY) != 0)
+      return NULL;
+    step += GROUPSIZE;
+    pos = (pos + step) & mask;
+  }
+}
+
+
+static void setctrl (Table *t, int i, int c) {
+  int size = sizenode(t);
+  int j;
+  t->ctrl[i] = cast_byte(c);
+  for (j = i; j < GROUPSIZE; j += size)  /* update its copies */
+    t->ctrl[size + j] = cast_byte(c);
+}
+
+/* }============================================================= */
+
+#endif
+
+
+#if defined(LUA_USE_SHAPES)
+
+#define NOSLOT		cast_byte(~0)
+
+/*
+** returns the slot of `key' in shape `s', -1 if `s' does not have it
+** (long strings are never fields, so comparing pointers is enough)
+*/
+static int shapeslot (const Shape *s, const TString *key) {
+  int size = twoto(s->lsizeindex);
+  int h = lmod(key->tsv.hash, size);
+  int i;
+  while ((i = s->index[h]) != NOSLOT) {
+    if (s->keys[i] == key) return i;
+    h = lmod(h + 1, size);
+  }
+  return -1;
+}
+
+#endif
+
 
 /*
 ** returns the index for `key' if `key' is an appropriate key to live in
 ** the array part of the table, -1 otherwise.
 */
 static int arrayindex (const TValue *key) {
-  if (ttisnumber(key)) {
+  if (ttisint(key))
+    return ivalue(key);
+  else if (ttisnumber(key)) {
     lua_Number n = nvalue(key);
     int k;
     lua_number2int(k, n);
@@ -131,8 +353,9 @@ static int arrayindex (const TValue *key) {
 
 /*
 ** returns the index of a `key' for table traversals. First goes all
-** elements in the array part, then elements in the hash part. The
-** beginning of a traversal is signalled by -1.
+** elements in the array part, then the fields of its shape, then
+** elements in the hash part. The beginning of a traversal is signalled
+** by -1.
 */
 static int findindex (lua_State *L, Table *t, StkId key) {
   int i;
@@ -140,7 +363,16 @@ static int findindex (lua_State *L, Table *t, StkId key) {
   i = arrayindex(key);
   if (0 < i && i <= t->sizearray)  /* is `key' inside array part? */
     return i-1;  /* yes; that's the index (corrected to C) */
+#if defined(LUA_USE_SHAPES)
+  else if (ttisstring(key) && t->shape != NULL) {  /* is it a field? */
+    i = shapeslot(t->shape, rawtsvalue(key));
+    if (i < 0)
+      luaG_runerror(L, "invalid key to " LUA_QL("next"));
+    return i + t->sizearray;  /* fields are numbered after array */
+  }
+#endif
   else {
+#if !defined(LUA_USE_SWISSTABLE)
     Node *n = mainposition(t, key);
     do {  /* check whether `key' is somewhere in the chain */
       /* key may be dead already, but it is ok to use it in `next' */
@@ -148,11 +380,20 @@ static int findindex (lua_State *L, Table *t, StkId key) {
             (ttype(gkey(n)) == LUA_TDEADKEY && iscollectable(key) &&
              gcvalue(gkey(n)) == gcvalue(key))) {
         i = cast_int(n - gnode(t, 0));  /* key index in hash table */
-        /* hash elements are numbered after array ones */
-        return i + t->sizearray;
+        /* hash elements are numbered after array ones and fields */
+        return i + t->sizearray + numfields(t);
       }
       else n = gnext(n);
     } while (n);
+#else
+    /* key may be dead already, but it is ok to use it in `next' */
+    Node *n = findnode(t, key, 1);
+    if (n != NULL) {
+      i = cast_int(n - gnode(t, 0));  /* key index in hash table */
+      /* hash elements are numbered after array ones and fields */
+      return i + t->sizearray + numfields(t);
+    }
+#endif
     luaG_runerror(L, "invalid key to " LUA_QL("next"));  /* key not found */
     return 0;  /* to avoid warnings */
   }
@@ -163,12 +404,22 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
   int i = findindex(L, t, key);  /* find original element */
   for (i++; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
-      setnvalue(key, cast_num(i+1));
+      setivalue(key, i+1);
       setobj2s(L, key+1, &t->array[i]);
       return 1;
     }
   }
-  for (i -= t->sizearray; i < sizenode(t); i++) {  /* then hash part */
+  i -= t->sizearray;
+#if defined(LUA_USE_SHAPES)
+  for (; i < numfields(t); i++) {  /* then fields */
+    if (!ttisnil(&t->fields[i])) {
+      setsvalue2s(L, key, t->shape->keys[i]);
+      setobj2s(L, key+1, &t->fields[i]);
+      return 1;
+    }
+  }
+#endif
+  for (i -= numfields(t); i < sizenode(t); i++) {  /* then hash part */
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       setobj2s(L, key, key2tval(gnode(t, i)));
       setobj2s(L, key+1, gval(gnode(t, i)));
@@ -269,6 +520,8 @@ static void setarrayvector (lua_State *L, Table *t, int size) {
 }
 
 
+#if !defined(LUA_USE_SWISSTABLE)
+
 static void setnodevector (lua_State *L, Table *t, int size) {
   int lsize;
   if (size == 0) {  /* no elements to hash part? */
@@ -293,12 +546,54 @@ static void setnodevector (lua_State *L, Table *t, int size) {
   t->lastfree = gnode(t, size);  /* all positions are free */
 }
 
+#else
 
+/* `size' is the number of keys the new hash part must hold */
+static void setnodevector (lua_State *L, Table *t, int size) {
+  int lsize;
+  if (size == 0) {  /* no elements to hash part? */
+    t->node = cast(Node *, dummynode);  /* use common `dummynode' */
+    t->ctrl = cast(lu_byte *, dummyctrl);
+    t->freeslots = 0;
+    lsize = 0;
+  }
+  else {
+    int i;
+    lsize = ceillog2(size);
+    while (maxfill(twoto(lsize)) < size) lsize++;
+    if (lsize > MAXBITS)
+      luaG_runerror(L, "table overflow");
+    size = twoto(lsize);
+    if (cast(size_t, size) > (MAX_SIZET - GROUPSIZE)/(sizeof(Node) + 1))
+      luaM_toobig(L);
+    t->node = cast(Node *, luaM_malloc(L, sizenodes(size)));
+    t->ctrl = cast(lu_byte *, t->node + size);
+    memset(t->ctrl, CEMPTY, size + GROUPSIZE);
+    for (i=0; i<size; i++) {
+      Node *n = gnode(t, i);
+      setnilvalue(gkey(n));
+      setnilvalue(gval(n));
+    }
+    t->freeslots = maxfill(size);
+  }
+  t->lsizenode = cast_byte(lsize);
+}
+
+#endif
+
+
+/*
+** Nodes change places here (and when `newkey' moves a colliding node).
+** The inline caches in lvm.c need no invalidation: they check that the
+** node at their slot still holds their key, so they simply miss.
+*/
 static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
   int i;
   int oldasize = t->sizearray;
   int oldhsize = t->lsizenode;
   Node *nold = t->node;  /* save old hash ... */
+  if (obj2gco(t) == G(L)->partial)  /* being traversed in pieces? */
+    G(L)->partialpos = 0;  /* entries will move: start again */
   if (nasize > oldasize)  /* array part must grow? */
     setarrayvector(L, t, nasize);
   /* create new hash part with appropriate size */
@@ -320,12 +615,16 @@ static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
       setobjt2t(L, luaH_set(L, t, key2tval(old)), gval(old));
   }
   if (nold != dummynode)
-    luaM_freearray(L, nold, twoto(oldhsize), Node);  /* free old array */
+    freenodes(L, nold, twoto(oldhsize));  /* free old array */
 }
 
 
 void luaH_resizearray (lua_State *L, Table *t, int nasize) {
+#if !defined(LUA_USE_SWISSTABLE)
   int nsize = (t->node == dummynode) ? 0 : sizenode(t);
+#else
+  int nsize = (t->node == dummynode) ? 0 : maxfill(sizenode(t));
+#endif
   resize(L, t, nasize, nsize);
 }
 
@@ -355,6 +654,177 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
 */
 
 
+
+#if defined(LUA_USE_SHAPES)
+
+/*
+** {=============================================================
+** Shapes
+** A table with only a few string keys (a record) does not keep them in
+** its hash part: they live in a shape, shared by all tables that got
+** the same keys in the same order, and the table keeps only their
+** values, in `fields'. Shapes form a tree rooted at `rootshape', where
+** each child adds one key to its parent. A table moves its fields to
+** its hash part for good when it would need a shape with more than
+** LUAI_MAXSHAPE keys, or a child of a shape that already has
+** LUAI_MAXSHAPEFANOUT children.
+** Shapes are counted by the tables and children that use them and are
+** freed when unused. The collector marks their keys in `atomic'.
+** ==============================================================
+*/
+
+#define sizeshape(n,lsi) \
+	(sizeof(Shape) + (n)*sizeof(TString *) + twoto(lsi)*sizeof(lu_byte))
+
+
+static Shape *newshape (lua_State *L, Shape *parent, TString *key) {
+  int n = (parent == NULL) ? 0 : parent->nkeys + 1;
+  int lsi = ceillog2(2*n + 1);  /* keep `index' at most half full */
+  Shape *s = cast(Shape *, luaM_malloc(L, sizeshape(n, lsi)));
+  int i;
+  s->parent = parent;
+  s->children = NULL;
+  s->sibling = NULL;
+  s->key = key;
+  s->keys = cast(TString **, s + 1);
+  s->index = cast(lu_byte *, s->keys + n);
+  s->nref = 0;
+  s->nkeys = cast_byte(n);
+  s->lsizeindex = cast_byte(lsi);
+  memset(s->index, NOSLOT, twoto(lsi));
+  for (i = 0; i < n; i++) {
+    TString *k = (i < n - 1) ? parent->keys[i] : key;
+    int h = lmod(k->tsv.hash, twoto(lsi));
+    while (s->index[h] != NOSLOT)
+      h = lmod(h + 1, twoto(lsi));
+    s->index[h] = cast_byte(i);
+    s->keys[i] = k;
+  }
+  if (parent != NULL) {  /* link it as first child of `parent' */
+    s->sibling = parent->children;
+    parent->children = s;
+    parent->nref++;
+  }
+  return s;
+}
+
+
+static void freeshape (lua_State *L, Shape *s) {
+  luaM_freemem(L, s, sizeshape(s->nkeys, s->lsizeindex));
+}
+
+
+/*
+** drops a reference to `s', freeing it (and then maybe its ancestors)
+** when nothing uses it anymore
+*/
+static void releaseshape (lua_State *L, Shape *s) {
+  while (--s->nref == 0 && s->parent != NULL) {
+    Shape *p = s->parent;
+    Shape **c = &p->children;
+    while (*c != s) c = &(*c)->sibling;
+    *c = s->sibling;  /* unlink `s' */
+    freeshape(L, s);
+    s = p;
+  }
+}
+
+
+/*
+** returns the child of `s' with key `key', creating it if needed, or
+** NULL if `s' already has too many children
+*/
+static Shape *getchild (lua_State *L, Shape *s, TString *key) {
+  Shape **c;
+  int n = 0;
+  for (c = &s->children; *c != NULL; c = &(*c)->sibling, n++) {
+    Shape *child = *c;
+    if (child->key == key) {
+      if (c != &s->children) {  /* move it to the front */
+        *c = child->sibling;
+        child->sibling = s->children;
+        s->children = child;
+      }
+      return child;
+    }
+  }
+  if (n >= LUAI_MAXSHAPEFANOUT)
+    return NULL;
+  return newshape(L, s, key);
+}
+
+
+/*
+** moves the fields of `t' to its hash part, with room for one more key
+*/
+static void unshape (lua_State *L, Table *t) {
+  Shape *s = t->shape;
+  TValue *fields = t->fields;
+  int i;
+  int nhsize = 1;  /* the new key */
+  for (i = 0; i < sizenode(t); i++)
+    if (!ttisnil(gval(gnode(t, i)))) nhsize++;
+  for (i = 0; i < s->nkeys; i++)
+    if (!ttisnil(&fields[i])) nhsize++;
+  resize(L, t, t->sizearray, nhsize);
+  t->shape = NULL;
+  t->fields = NULL;
+  for (i = 0; i < s->nkeys; i++) {
+    if (!ttisnil(&fields[i]))
+      setobjt2t(L, luaH_setstr(L, t, s->keys[i]), &fields[i]);
+  }
+  luaM_freearray(L, fields, t->sizefields, TValue);
+  t->sizefields = 0;
+  releaseshape(L, s);
+}
+
+
+/*
+** inserts a new string key into a table with a shape
+*/
+static TValue *addfield (lua_State *L, Table *t, TString *key) {
+  Shape *s = t->shape;
+  int n = s->nkeys;
+  if (n < LUAI_MAXSHAPE && !islong(key)) {
+    Shape *c;
+    if (n == t->sizefields) {  /* grow `fields' first, as it may fail */
+      int size = (n < 4) ? 4 : 2*n;
+      if (size > LUAI_MAXSHAPE) size = LUAI_MAXSHAPE;
+      luaM_reallocvector(L, t->fields, t->sizefields, size, TValue);
+      t->sizefields = size;
+    }
+    c = getchild(L, s, key);
+    if (c != NULL) {
+      c->nref++;
+      t->shape = c;
+      releaseshape(L, s);  /* (`c' still uses it) */
+      setnilvalue(&t->fields[n]);
+      return &t->fields[n];
+    }
+  }
+  unshape(L, t);  /* too many keys for a record (or a long one) */
+  return luaH_setstr(L, t, key);
+}
+
+
+void luaH_initshapes (lua_State *L) {
+  G(L)->rootshape = newshape(L, NULL, NULL);
+}
+
+
+void luaH_freeshapes (lua_State *L) {
+  Shape *s = G(L)->rootshape;
+  if (s != NULL) {
+    lua_assert(s->children == NULL);  /* all tables are gone */
+    freeshape(L, s);
+  }
+}
+
+/* }============================================================= */
+
+#endif
+
+
 Table *luaH_new (lua_State *L, int narray, int nhash) {
   Table *t = luaM_new(L, Table);
   luaC_link(L, obj2gco(t), LUA_TTABLE);
@@ -365,20 +835,42 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
   t->sizearray = 0;
   t->lsizenode = 0;
   t->node = cast(Node *, dummynode);
+#if defined(LUA_USE_SHAPES)
+  t->shape = NULL;
+  t->fields = NULL;
+  t->sizefields = 0;
+#endif
   setarrayvector(L, t, narray);
+#if defined(LUA_USE_SHAPES)
+  if (nhash <= LUAI_MAXSHAPE && G(L)->rootshape != NULL) {
+    t->fields = luaM_newvector(L, nhash, TValue);
+    t->sizefields = nhash;
+    t->shape = G(L)->rootshape;
+    t->shape->nref++;
+    nhash = 0;  /* its keys will (probably) be fields */
+  }
+#endif
   setnodevector(L, t, nhash);
   return t;
 }
 
 
 void luaH_free (lua_State *L, Table *t) {
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) {
+    luaM_freearray(L, t->fields, t->sizefields, TValue);
+    releaseshape(L, t->shape);
+  }
+#endif
   if (t->node != dummynode)
-    luaM_freearray(L, t->node, sizenode(t), Node);
+    freenodes(L, t->node, sizenode(t));
   luaM_freearray(L, t->array, t->sizearray, TValue);
   luaM_free(L, t);
 }
 
 
+#if !defined(LUA_USE_SWISSTABLE)
+
 static Node *getfreepos (Table *t) {
   while (t->lastfree-- > t->node) {
     if (ttisnil(gkey(t->lastfree)))
@@ -397,7 +889,12 @@ static Node *getfreepos (Table *t) {
 ** position), new key goes to an empty position. 
 */
 static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
-  Node *mp = mainposition(t, key);
+  Node *mp;
+#if defined(LUA_USE_SHAPES)
+  if (ttisstring(key) && t->shape != NULL)
+    return addfield(L, t, rawtsvalue(key));
+#endif
+  mp = mainposition(t, key);
   if (!ttisnil(gval(mp)) || mp == dummynode) {
     Node *othern;
     Node *n = getfreepos(t);  /* get a free place */
@@ -422,12 +919,56 @@ static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
       mp = n;
     }
   }
-  gkey(mp)->value = key->value; gkey(mp)->tt = key->tt;
+  gkey(mp)->value = key->value; gkey(mp)->tt = key->tt; setival(gkey(mp), key);
   luaC_barriert(L, t, key);
   lua_assert(ttisnil(gval(mp)));
   return gval(mp);
 }
 
+#else
+
+/*
+** inserts a new key into a hash table, in the first empty node of its
+** search sequence (see `findnode'). A dead node of the same key is
+** reused, so that `findindex' never finds one key in two nodes
+*/
+static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
+  unsigned int h, m;
+  int mask, pos, step = 0;
+  Node *n;
+#if defined(LUA_USE_SHAPES)
+  if (ttisstring(key) && t->shape != NULL)
+    return addfield(L, t, rawtsvalue(key));
+#endif
+  if (iscollectable(key) && (n = findnode(t, key, 1)) != NULL) {
+    lua_assert(ttype(gkey(n)) == LUA_TDEADKEY && ttisnil(gval(n)));
+    gkey(n)->value = key->value; gkey(n)->tt = key->tt; setival(gkey(n), key);
+    luaC_barriert(L, t, key);
+    return gval(n);
+  }
+  if (t->freeslots == 0) {  /* hash part is full? */
+    rehash(L, t, key);  /* grow table */
+    return luaH_set(L, t, key);  /* re-insert key into grown table */
+  }
+  h = hashkey(key);
+  mask = sizenode(t) - 1;
+  pos = lmod(h, sizenode(t));
+  while ((m = matchbyte(t->ctrl + pos, CEMPTY)) == 0) {
+    step += GROUPSIZE;
+    pos = (pos + step) & mask;
+  }
+  pos = (pos + firstbit(m)) & mask;
+  setctrl(t, pos, h2(h));
+  t->freeslots--;
+  n = gnode(t, pos);
+  gkey(n)->value = key->value; gkey(n)->tt = key->tt; setival(gkey(n), key);
+  luaC_barriert(L, t, key);
+  lua_assert(ttisnil(gval(n)));
+  return gval(n);
+}
+
+#endif
+
 
 /*
 ** search function for integers
@@ -437,6 +978,7 @@ const TValue *luaH_getnum (Table *t, int key) {
   if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray))
     return &t->array[key-1];
   else {
+#if !defined(LUA_USE_SWISSTABLE)
     lua_Number nk = cast_num(key);
     Node *n = hashnum(t, nk);
     do {  /* check whether `key' is somewhere in the chain */
@@ -445,6 +987,13 @@ const TValue *luaH_getnum (Table *t, int key) {
       else n = gnext(n);
     } while (n);
     return luaO_nilobject;
+#else
+    TValue k;
+    Node *n;
+    setnvalue(&k, cast_num(key));
+    n = findnode(t, &k, 0);
+    return (n != NULL) ? gval(n) : luaO_nilobject;
+#endif
   }
 }
 
@@ -453,13 +1002,58 @@ const TValue *luaH_getnum (Table *t, int key) {
 ** search function for strings
 */
 const TValue *luaH_getstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
+  Node *n;
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) {
+    int i = shapeslot(t->shape, key);
+    return (i >= 0) ? &t->fields[i] : luaO_nilobject;
+  }
+#endif
+#if !defined(LUA_USE_SWISSTABLE)
+  n = hashstr(t, key);
+  do {  /* check whether `key' is somewhere in the chain */
+    if (ttisstring(gkey(n)) && eqstr(key, rawtsvalue(gkey(n))))
+      return gval(n);  /* that's it */
+    else n = gnext(n);
+  } while (n);
+  return luaO_nilobject;
+#else
+  n = findstr(t, key);
+  return (n != NULL) ? gval(n) : luaO_nilobject;
+#endif
+}
+
+
+/*
+** search function for strings that also records in `slot' the node
+** where `key' was found (for the inline caches in lvm.c)
+*/
+const TValue *luaH_getstrslot (Table *t, TString *key, int *slot) {
+  Node *n;
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) {  /* slot is a field index */
+    int i = shapeslot(t->shape, key);
+    if (i < 0) return luaO_nilobject;
+    *slot = i;
+    return &t->fields[i];
+  }
+#endif
+#if !defined(LUA_USE_SWISSTABLE)
+  n = hashstr(t, key);
   do {  /* check whether `key' is somewhere in the chain */
-    if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key)
+    if (ttisstring(gkey(n)) && eqstr(key, rawtsvalue(gkey(n)))) {
+      *slot = cast_int(n - gnode(t, 0));
       return gval(n);  /* that's it */
+    }
     else n = gnext(n);
   } while (n);
   return luaO_nilobject;
+#else
+  n = findstr(t, key);
+  if (n == NULL) return luaO_nilobject;
+  *slot = cast_int(n - gnode(t, 0));
+  return gval(n);
+#endif
 }
 
 
@@ -473,12 +1067,15 @@ const TValue *luaH_get (Table *t, const TValue *key) {
     case LUA_TNUMBER: {
       int k;
       lua_Number n = nvalue(key);
+      if (ttisint(key))  /* already has its `int' value? */
+        return luaH_getnum(t, ivalue(key));
       lua_number2int(k, n);
       if (luai_numeq(cast_num(k), nvalue(key))) /* index is int? */
         return luaH_getnum(t, k);  /* use specialized version */
       /* else go through */
     }
     default: {
+#if !defined(LUA_USE_SWISSTABLE)
       Node *n = mainposition(t, key);
       do {  /* check whether `key' is somewhere in the chain */
         if (luaO_rawequalObj(key2tval(n), key))
@@ -486,6 +1083,10 @@ const TValue *luaH_get (Table *t, const TValue *key) {
         else n = gnext(n);
       } while (n);
       return luaO_nilobject;
+#else
+      Node *n = findnode(t, key, 0);
+      return (n != NULL) ? gval(n) : luaO_nilobject;
+#endif
     }
   }
 }
@@ -511,7 +1112,7 @@ TValue *luaH_setnum (lua_State *L, Table *t, int key) {
     return cast(TValue *, p);
   else {
     TValue k;
-    setnvalue(&k, cast_num(key));
+    setivalue(&k, key);
     return newkey(L, t, &k);
   }
 }
@@ -580,7 +1181,11 @@ int luaH_getn (Table *t) {
 #if defined(LUA_DEBUG)
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
+#if !defined(LUA_USE_SWISSTABLE)
   return mainposition(t, key);
+#else
+  return gnode(t, lmod(hashkey(key), sizenode(t)));
+#endif
 }
 
 int luaH_isdummy (Node *n) { return n == dummynode; }
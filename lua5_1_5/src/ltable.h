@@ -13,14 +13,26 @@
 #define gnode(t,i)	(&(t)->node[i])
 #define gkey(n)		(&(n)->i_key.nk)
 #define gval(n)		(&(n)->i_val)
+#if !defined(LUA_USE_SWISSTABLE)
 #define gnext(n)	((n)->i_key.nk.next)
+#endif
 
 #define key2tval(n)	(&(n)->i_key.tvk)
 
+/* node of value `v', which must be in the hash part */
+#define val2node(v)	cast(Node *, cast(char *, (v)) - offsetof(Node, i_val))
+
+#if defined(LUA_USE_SHAPES)
+#define sizefields(t)	((t)->sizefields)
+#else
+#define sizefields(t)	0
+#endif
+
 
 LUAI_FUNC const TValue *luaH_getnum (Table *t, int key);
 LUAI_FUNC TValue *luaH_setnum (lua_State *L, Table *t, int key);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getstrslot (Table *t, TString *key, int *slot);
 LUAI_FUNC TValue *luaH_setstr (lua_State *L, Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_set (lua_State *L, Table *t, const TValue *key);
@@ -29,6 +41,10 @@ LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, int nasize);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
 LUAI_FUNC int luaH_getn (Table *t);
+#if defined(LUA_USE_SHAPES)
+LUAI_FUNC void luaH_initshapes (lua_State *L);
+LUAI_FUNC void luaH_freeshapes (lua_State *L);
+#endif
 
 
 #if defined(LUA_DEBUG)
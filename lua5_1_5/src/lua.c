@@ -374,10 +374,19 @@ static int pmain (lua_State *L) {
 }
 
 
+static lua_State *newstate (void) {
+  const char *seed = getenv(LUA_SEED);
+  if (seed != NULL)  /* fixed seed for string hashes? */
+    return luaL_newstateseed((unsigned int)strtoul(seed, NULL, 0));
+  else
+    return lua_open();
+}
+
+
 int main (int argc, char **argv) {
   int status;
   struct Smain s;
-  lua_State *L = lua_open();  /* create state */
+  lua_State *L = newstate();  /* create state */
   if (L == NULL) {
     l_message(argv[0], "cannot create state: not enough memory");
     return EXIT_FAILURE;
@@ -51,6 +51,11 @@ typedef struct lua_State lua_State;
 
 typedef int (*lua_CFunction) (lua_State *L);
 
+/*
+** continuation of a C function that resumes a coroutine with `lua_resumek'
+*/
+typedef int (*lua_KFunction) (lua_State *L, int status);
+
 
 /*
 ** functions that read/write blocks when loading/dumping Lua chunks
@@ -59,6 +64,13 @@ typedef const char * (*lua_Reader) (lua_State *L, void *ud, size_t *sz);
 
 typedef int (*lua_Writer) (lua_State *L, const void* p, size_t sz, void* ud);
 
+/*
+** function that frees a chunk given to `lua_loadimage' once no function
+** loaded from it is alive (it must not call Lua). Names of locals and
+** upvalues of those functions are read from the chunk when first needed
+*/
+typedef void (*lua_Release) (void *ud, const void *p, size_t sz);
+
 
 /*
 ** prototype for memory-allocation functions
@@ -108,6 +120,8 @@ typedef LUA_INTEGER lua_Integer;
 ** state manipulation
 */
 LUA_API lua_State *(lua_newstate) (lua_Alloc f, void *ud);
+LUA_API lua_State *(lua_newstateseed) (lua_Alloc f, void *ud,
+                                       unsigned int seed);
 LUA_API void       (lua_close) (lua_State *L);
 LUA_API lua_State *(lua_newthread) (lua_State *L);
 
@@ -124,6 +138,7 @@ LUA_API void  (lua_remove) (lua_State *L, int idx);
 LUA_API void  (lua_insert) (lua_State *L, int idx);
 LUA_API void  (lua_replace) (lua_State *L, int idx);
 LUA_API int   (lua_checkstack) (lua_State *L, int sz);
+LUA_API int   (lua_reservestack) (lua_State *L, int nslots, int ncalls);
 
 LUA_API void  (lua_xmove) (lua_State *from, lua_State *to, int n);
 
@@ -166,6 +181,7 @@ LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
                                                       va_list argp);
 LUA_API const char *(lua_pushfstring) (lua_State *L, const char *fmt, ...);
 LUA_API void  (lua_pushcclosure) (lua_State *L, lua_CFunction fn, int n);
+LUA_API void  (lua_pushleaf) (lua_State *L, lua_CFunction fn);
 LUA_API void  (lua_pushboolean) (lua_State *L, int b);
 LUA_API void  (lua_pushlightuserdata) (lua_State *L, void *p);
 LUA_API int   (lua_pushthread) (lua_State *L);
@@ -203,6 +219,11 @@ LUA_API int   (lua_pcall) (lua_State *L, int nargs, int nresults, int errfunc);
 LUA_API int   (lua_cpcall) (lua_State *L, lua_CFunction func, void *ud);
 LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
                                         const char *chunkname);
+LUA_API int   (lua_loadopt) (lua_State *L, lua_Reader reader, void *dt,
+                                        const char *chunkname, int opt);
+LUA_API int   (lua_loadimage) (lua_State *L, const void *p, size_t sz,
+                               const char *chunkname, lua_Release release,
+                               void *ud);
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data);
 
@@ -212,6 +233,8 @@ LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data);
 */
 LUA_API int  (lua_yield) (lua_State *L, int nresults);
 LUA_API int  (lua_resume) (lua_State *L, int narg);
+LUA_API int  (lua_resumek) (lua_State *L, lua_State *co, int narg,
+                            lua_KFunction k);
 LUA_API int  (lua_status) (lua_State *L);
 
 /*
@@ -226,6 +249,9 @@ LUA_API int  (lua_status) (lua_State *L);
 #define LUA_GCSTEP		5
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
+#define LUA_GCGEN		8
+#define LUA_GCINC		9
+#define LUA_GCSTEPTIME		10
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
@@ -330,6 +356,12 @@ typedef struct lua_Debug lua_Debug;  /* activation record */
 typedef void (*lua_Hook) (lua_State *L, lua_Debug *ar);
 
 
+/*
+** `lua_getinfo' (with "n"), `lua_getlocal', `lua_setlocal',
+** `lua_getupvalue' and `lua_setupvalue' may raise a memory error for
+** functions loaded by `lua_loadimage', as they load names of locals
+** and upvalues
+*/
 LUA_API int lua_getstack (lua_State *L, int level, lua_Debug *ar);
 LUA_API int lua_getinfo (lua_State *L, const char *what, lua_Debug *ar);
 LUA_API const char *lua_getlocal (lua_State *L, const lua_Debug *ar, int n);
@@ -29,6 +29,10 @@
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int format=LUAC_FORMAT;		/* format of output (see lundump.h) */
+static int fusing=1;			/* emit fused opcodes? */
+static int optimizing=0;		/* optimize bytecodes? */
+static int showstats=0;		/* show optimizer statistics? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -55,11 +59,18 @@ static void usage(const char* message)
  "usage: %s [options] [filenames].\n"
  "Available options are:\n"
  "  -        process stdin\n"
+ "  -c       write a compact chunk (varints, shared strings)\n"
+ "  -F       do not fuse opcodes (stock 5.1 bytecode)\n"
  "  -l       list\n"
+ "  -m       write an image that loads without copying code (mmap)\n"
+ "  -n       strip names of locals and upvalues but keep line information\n"
+ "  -O       optimize (fold constants, remove dead code)\n"
  "  -o name  output to file " LUA_QL("name") " (default is \"%s\")\n"
  "  -p       parse only\n"
  "  -s       strip debug information\n"
+ "  -S       show what " LUA_QL("-O") " removes (implies " LUA_QL("-p") ")\n"
  "  -v       show version information\n"
+ "  -z       write a compact chunk compressed\n"
  "  --       stop handling options\n",
  progname,Output);
  exit(EXIT_FAILURE);
@@ -84,8 +95,20 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-"))			/* end of options; use stdin */
    break;
+  else if (IS("-c"))			/* compact */
+   format=LUAC_COMPACT;
   else if (IS("-l"))			/* list */
    ++listing;
+  else if (IS("-m"))			/* image for mapping */
+   format=LUAC_IMAGE;
+  else if (IS("-n"))			/* strip names only */
+  {
+   if (!stripping) stripping=LUAC_STRIPNAMES;
+  }
+  else if (IS("-F"))			/* no fused opcodes */
+   fusing=0;
+  else if (IS("-O"))			/* optimize */
+   optimizing=1;
   else if (IS("-o"))			/* output file */
   {
    output=argv[++i];
@@ -96,8 +119,15 @@ static int doargs(int argc, char* argv[])
    dumping=0;
   else if (IS("-s"))			/* strip debug information */
    stripping=1;
+  else if (IS("-S"))			/* optimizer statistics */
+  {
+   showstats=1;
+   dumping=0;
+  }
   else if (IS("-v"))			/* show version */
    ++version;
+  else if (IS("-z"))			/* compact and compressed */
+   format=LUAC_COMPRESSED;
   else					/* unknown option */
    usage(argv[i]);
  }
@@ -150,6 +180,63 @@ static int writer(lua_State* L, const void* p, size_t size, void* u)
  return (fwrite(p,size,1,(FILE*)u)!=1) && (size!=0);
 }
 
+static void count(const Proto* f, int* n)
+{
+ int pc,j;
+ for (pc=0; pc<f->sizecode; pc++)
+ {
+  Instruction i=f->code[pc];
+  ++n[GET_OPCODE(i)]; ++n[NUM_OPCODES];
+  if (GET_OPCODE(i)==OP_CLOSURE)		/* skip pseudo-instructions */
+   pc+=f->p[GETARG_Bx(i)]->nups;
+  else if (GET_OPCODE(i)==OP_SETLIST && GETARG_C(i)==0)
+   pc++;
+ }
+ for (j=0; j<f->sizep; j++) count(f->p[j],n);
+}
+
+static void load(lua_State* L, const char* filename, int opt, int* n)
+{
+ if (luaL_loadfileopt(L,filename,opt)!=0) fatal(lua_tostring(L,-1));
+ count(toproto(L,-1),n);
+ lua_pop(L,1);
+}
+
+static void statistics(lua_State* L, int argc, char* argv[])
+{
+ int plain[NUM_OPCODES+1],opt[NUM_OPCODES+1];
+ int i;
+ memset(plain,0,sizeof(plain));
+ memset(opt,0,sizeof(opt));
+ printf("%-32s %9s %9s %9s\n","file","plain","-O","removed");
+ for (i=0; i<argc; i++)
+ {
+  const char* filename=argv[i];
+  int p=plain[NUM_OPCODES],o=opt[NUM_OPCODES];
+  if (IS("-")) fatal(LUA_QL("-S") " cannot read stdin");
+  load(L,filename,0,plain);
+  load(L,filename,1,opt);
+  p=plain[NUM_OPCODES]-p; o=opt[NUM_OPCODES]-o;
+  printf("%-32s %9d %9d %9d\n",filename,p,o,p-o);
+ }
+ for (i=0; i<=NUM_OPCODES; i++)
+ {
+  if (plain[i]==opt[i]) continue;
+  printf("%-32s %9d %9d %9d",i<NUM_OPCODES ? luaP_opnames[i] : "total",
+         plain[i],opt[i],plain[i]-opt[i]);
+  if (plain[i]>0) printf("  (%.1f%%)",100.0*(plain[i]-opt[i])/plain[i]);
+  printf("\n");
+ }
+}
+
+static void loadall(lua_State* L, Proto* f)	/* what images left */
+{
+ int i;
+ luaU_checkbody(L,f);
+ luaU_checkdebug(L,f);
+ for (i=0; i<f->sizep; i++) loadall(L,f->p[i]);
+}
+
 struct Smain {
  int argc;
  char** argv;
@@ -163,19 +250,25 @@ static int pmain(lua_State* L)
  const Proto* f;
  int i;
  if (!lua_checkstack(L,argc)) fatal("too many input files");
+ G(L)->nofuse=!fusing;
+ if (showstats) statistics(L,argc,argv);
  for (i=0; i<argc; i++)
  {
   const char* filename=IS("-") ? NULL : argv[i];
-  if (luaL_loadfile(L,filename)!=0) fatal(lua_tostring(L,-1));
+  if (luaL_loadfileopt(L,filename,optimizing)!=0) fatal(lua_tostring(L,-1));
  }
  f=combine(L,argc);
- if (listing) luaU_print(f,listing>1);
+ if (listing)
+ {
+  loadall(L,(Proto*)f);
+  luaU_print(f,listing>1);
+ }
  if (dumping)
  {
   FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
   if (D==NULL) cannot("open");
   lua_lock(L);
-  luaU_dump(L,f,writer,D,stripping);
+  luaU_dump(L,f,writer,D,stripping,format);
   lua_unlock(L);
   if (ferror(D)) cannot("write");
   if (fclose(D)) cannot("close");
@@ -56,19 +56,33 @@
 #define LUA_USE_ISATTY
 #define LUA_USE_POPEN
 #define LUA_USE_ULONGJMP
+#define LUA_USE_MMAP
 #endif
 
+/*
+@@ LUA_USE_MMAP makes `luaL_loadimage' (and so `luaL_loadfile' for
+@* binary chunks) map files instead of reading them. Functions loaded
+@* from an image written by `luac -m' run their code in the mapping,
+@* which all processes that load the file share.
+** CHANGE it (undefine it) if your system has no mmap. A mapped file
+** must not change while functions loaded from it are alive.
+*/
+
 
 /*
 @@ LUA_PATH and LUA_CPATH are the names of the environment variables that
 @* Lua check to set its paths.
 @@ LUA_INIT is the name of the environment variable that Lua
 @* checks for initialization code.
+@@ LUA_SEED is the name of the environment variable that, when set,
+@* fixes the seed of string hashes of the state of the stand-alone
+@* interpreter (for reproducible benchmarks).
 ** CHANGE them if you want different names.
 */
 #define LUA_PATH        "LUA_PATH"
 #define LUA_CPATH       "LUA_CPATH"
 #define LUA_INIT	"LUA_INIT"
+#define LUA_SEED	"LUA_SEED"
 
 
 /*
@@ -313,6 +327,83 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 
 
+/*
+@@ LUAI_GCMINOR defines how much memory may grow, as a percentage, between
+@* two minor collections of the generational mode.
+@@ LUAI_GCMAJOR defines how much memory may grow after a major collection,
+@* as a percentage, before the generational mode does another one.
+** CHANGE them if you want the generational mode to use less memory
+** (lower values) or less time (higher values).
+*/
+#define LUAI_GCMINOR	20
+#define LUAI_GCMAJOR	100
+
+
+/*
+@@ luai_gcclock sets its argument to the current time in microseconds,
+@* as an unsigned long (only differences are used). It times the steps
+@* of `lua_gc(L, LUA_GCSTEPTIME, us)'.
+** CHANGE it if you have a better clock. The default uses a monotonic
+** clock with LUA_USE_POSIX (wall-clock time may jump) and otherwise
+** `clock', which measures processor time and may be coarse.
+*/
+#if defined(LUA_CORE)
+#if defined(LUA_USE_POSIX)
+#include <time.h>
+#define luai_gcclock(t)	{ struct timespec ts_; \
+  clock_gettime(CLOCK_MONOTONIC, &ts_); \
+  (t) = (unsigned long)ts_.tv_sec*1000000UL + \
+        (unsigned long)ts_.tv_nsec/1000UL; }
+#else
+#include <time.h>
+#define luai_gcclock(t)	\
+  ((t) = (unsigned long)clock() * (1000000UL/CLOCKS_PER_SEC))
+#endif
+#endif
+
+
+/*
+@@ luai_makeseed is a source of randomness for the seed of string hashes.
+** CHANGE it if you have a better source. The default uses the current
+** time; `lua_newstate' mixes it with a few addresses, which vary from run
+** to run on systems with address space randomization.
+*/
+#if defined(LUA_CORE)
+#include <time.h>
+#define luai_makeseed()		((unsigned int)time(NULL))
+#endif
+
+
+/*
+@@ LUA_USE_BGSWEEP makes a helper thread free the dead objects found by
+@* each incremental cycle while the interpreter goes on.
+** CHANGE it (define it) if you have POSIX threads, your allocation
+** function is thread-safe (the default one is) and you have a spare
+** core. Link with -lpthread. The string table and userdata are still
+** swept by the interpreter; the generational mode does not use it.
+*/
+/* #define LUA_USE_BGSWEEP */
+
+
+/*
+@@ LUA_USE_ARENA makes luaL_newstate use the arena allocator of lauxlib.c
+@* (see luaL_newarenastate) instead of plain realloc/free.
+** CHANGE it (define it) if your scripts allocate many small objects.
+** Memory freed by small objects is kept for reuse until the state is
+** closed.
+*/
+/* #define LUA_USE_ARENA */
+
+
+/*
+@@ LUA_USE_THREADPOOL makes the collector keep up to LUAI_THREADPOOL
+@* dead coroutines, with their stacks, for reuse by `lua_newthread'.
+** CHANGE it (define it) if your programs create many short-lived
+** coroutines. The pooled threads are freed when the state is closed.
+*/
+/* #define LUA_USE_THREADPOOL */
+
+
 
 /*
 @@ LUA_COMPAT_GETN controls compatibility with old getn behavior.
@@ -446,6 +537,22 @@
 #define LUAI_MAXCSTACK	8000
 
 
+/*
+@@ LUAI_THREADSTACK is the initial number of stack slots of a coroutine
+@* (must be at least LUA_MINSTACK+2).
+@@ LUAI_THREADCI is the initial number of CallInfo entries of a coroutine
+@* (must be at least 2).
+@@ LUAI_THREADPOOL is the maximum number of dead coroutines kept for
+@* reuse (see LUA_USE_THREADPOOL).
+** CHANGE them if you have many coroutines alive at the same time (lower
+** the first two) or create many of them in bursts (raise the last).
+** Both stacks grow on demand; the main thread starts with larger ones.
+*/
+#define LUAI_THREADSTACK	32
+#define LUAI_THREADCI		4
+#define LUAI_THREADPOOL		128
+
+
 
 /*
 ** {==================================================================
@@ -482,6 +589,47 @@
 #define LUAI_MAXUPVALUES	60
 
 
+/*
+@@ LUAI_MAXSHORTLEN is the maximum length of the strings that Lua
+@* interns in its string table.
+** Longer strings are created without looking for a copy, hashed only
+** when used as table keys, and compared by contents.
+** CHANGE it if your programs make many medium-sized strings that they
+** mostly compare or use as keys (raise it) or just pass along (lower it).
+*/
+#define LUAI_MAXSHORTLEN	40
+
+
+/*
+@@ LUA_USE_SHAPES makes tables keep their string keys in shared shapes.
+** With it, a table that gets only a few string keys (a record) stores
+** just their values, in slots given by a `shape' that all tables with
+** the same keys, added in the same order, share.
+** CHANGE it (define it, e.g., -DLUA_USE_SHAPES) if your scripts build
+** many objects with the same fields; it saves memory and makes field
+** access faster. Note that it changes the order in which `next'
+** traverses string keys.
+@@ LUAI_MAXSHAPE is the maximum number of string keys a table keeps in
+@* a shape before moving them to its hash part (must be smaller than 255).
+@@ LUAI_MAXSHAPEFANOUT is the maximum number of different keys that can
+@* extend a shape; tables adding yet another key also move to their hash
+@* part, as they look more like dictionaries than records.
+*/
+#define LUAI_MAXSHAPE		32
+#define LUAI_MAXSHAPEFANOUT	64
+
+
+/*
+@@ LUA_USE_SWISSTABLE makes the hash part of tables use open addressing.
+** Without it, tables use chained scatter, which follows a pointer for
+** each collision. With it, keys are searched by comparing a byte of
+** their hashes with a group of 16 nodes at a time (using SSE2 if the
+** compiler enables it), which uses caches better on large tables.
+** CHANGE it (define it, e.g., -DLUA_USE_SWISSTABLE) if your scripts use
+** large tables as maps. Note that it changes the order of `next'.
+*/
+
+
 /*
 @@ LUAL_BUFFERSIZE is the buffer size used by the lauxlib buffer system.
 */
@@ -511,6 +659,41 @@
 #define LUAI_UACNUMBER	double
 
 
+/*
+@@ LUA_USE_DUALNUM makes numbers with an integral value keep it also as
+@* an 'int', so that integer arithmetic, numeric 'for' loops and array
+@* indexing skip conversions between lua_Number and int.
+** CHANGE it (define it, e.g., -DLUA_USE_DUALNUM) if your scripts do
+** mostly counting and array indexing. Numbers still behave exactly as
+** before; lua_Number must represent every int exactly.
+*/
+
+
+/*
+@@ LUA_USE_JIT makes hot numeric `for' loops run as x86-64 machine code.
+** A loop gets compiled after LUAI_JITHOT iterations, for the types of
+** the values it used then; it goes back to the interpreter whenever
+** they change or it gets to an instruction the compiler does not
+** handle, such as a call. A function called LUAI_JITCALLS times gets
+** compiled whole, assuming no types; the interpreter runs what it does
+** not handle and goes back to it after calls. Line and count hooks keep
+** everything interpreted.
+** CHANGE it (define it) if your scripts spend their time in numeric
+** loops over numbers and tables. It needs an x86-64 POSIX system that
+** lets programs map memory as executable, and lua_Number as double.
+@@ LUAI_JITHOT is the number of iterations that makes a loop hot.
+@@ LUAI_JITCALLS is the number of calls that makes a function hot.
+*/
+/* #define LUA_USE_JIT */
+#define LUAI_JITHOT	64
+#define LUAI_JITCALLS	100
+
+#if defined(LUA_USE_JIT) && !(defined(__x86_64__) && \
+    defined(LUA_USE_POSIX) && defined(LUA_NUMBER_DOUBLE))
+#undef LUA_USE_JIT
+#endif
+
+
 /*
 @@ LUA_NUMBER_SCAN is the format for reading numbers.
 @@ LUA_NUMBER_FMT is the format for writing numbers.
@@ -585,6 +768,23 @@ union luai_Cast { double l_d; long l_l; };
 /* }================================================================== */
 
 
+/*
+@@ LUA_USE_JUMPTABLE controls how the interpreter dispatches opcodes.
+** When it is 1, `luaV_execute' uses a table of label addresses (the
+** "labels as values" extension of GCC and Clang) so that each opcode
+** jumps directly to the next one; when it is 0, it uses a `switch'.
+** CHANGE it (e.g., -DLUA_USE_JUMPTABLE=0) if you want the portable
+** `switch' even with GCC, or to 1 if your compiler has the extension.
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__) && !defined(LUA_ANSI)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+
 /*
 @@ LUAI_USER_ALIGNMENT_T is a type that requires maximum alignment.
 ** CHANGE it if your system requires alignments larger than double. (For
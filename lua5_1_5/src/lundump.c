@@ -14,9 +14,11 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstring.h"
+#include "ltable.h"
 #include "lundump.h"
 #include "lzio.h"
 
@@ -25,6 +27,13 @@ typedef struct {
  ZIO* Z;
  Mbuffer* b;
  const char* name;
+ Image* img;				/* chunk read instead of Z (or NULL) */
+ size_t pos;				/* bytes read so far */
+ int image;				/* vectors aligned? (LUAC_IMAGE) */
+ int map;				/* leave code and debug info in img? */
+ int compact;				/* LUAC_COMPACT encoding? */
+ Table* pool;				/* strings loaded so far (compact) */
+ int npool;				/* number of strings in pool */
 } LoadState;
 
 #ifdef LUAC_TRUST_BINARIES
@@ -47,8 +56,33 @@ static void error(LoadState* S, const char* why)
 
 static void LoadBlock(LoadState* S, void* b, size_t size)
 {
- size_t r=luaZ_read(S->Z,b,size);
- IF (r!=0, "unexpected end");
+ if (S->img!=NULL)
+ {
+  IF (size>S->img->size-S->pos, "unexpected end");
+  if (size>0) memcpy(b,S->img->p+S->pos,size);	/* b may be NULL then */
+ }
+ else
+ {
+  size_t r=luaZ_read(S->Z,b,size);
+  IF (r!=0, "unexpected end");
+ }
+ S->pos+=size;
+}
+
+/* skip the next `size' bytes of the image; return where they are */
+static const char* MapBlock(LoadState* S, size_t size)
+{
+ const char* p=S->img->p+S->pos;
+ IF (size>S->img->size-S->pos, "unexpected end");
+ S->pos+=size;
+ return p;
+}
+
+static void LoadAlign(LoadState* S)
+{
+ char pad[LUAC_IMAGEALIGN];
+ if (S->image)
+  LoadBlock(S,pad,(LUAC_IMAGEALIGN-S->pos%LUAC_IMAGEALIGN)%LUAC_IMAGEALIGN);
 }
 
 static int LoadChar(LoadState* S)
@@ -58,9 +92,55 @@ static int LoadChar(LoadState* S)
  return x;
 }
 
+/* LoadByte without the copy */
+static int NextByte(LoadState* S)
+{
+ int c;
+ if (S->img!=NULL)
+ {
+  IF (S->pos>=S->img->size, "unexpected end");
+  c=(unsigned char)S->img->p[S->pos];
+ }
+ else
+ {
+  c=zgetc(S->Z);
+  IF (c==EOZ, "unexpected end");
+ }
+ S->pos++;
+ return c;
+}
+
+/* see PutSize in ldump.c */
+static size_t LoadSize(LoadState* S)
+{
+ size_t x=0;
+ int c,shift=0;
+ do
+ {
+  IF (shift>=(int)sizeof(size_t)*CHAR_BIT, "bad integer");
+  c=NextByte(S);
+  x|=(size_t)(c&0x7F)<<shift;
+  shift+=7;
+ } while (c&0x80);
+ return x;
+}
+
+static int LoadSigned(LoadState* S)
+{
+ size_t x=LoadSize(S);
+ IF ((x>>1)>INT_MAX, "bad integer");
+ return (x&1) ? -cast_int(x>>1)-1 : cast_int(x>>1);
+}
+
 static int LoadInt(LoadState* S)
 {
  int x;
+ if (S->compact)
+ {
+  size_t y=LoadSize(S);
+  IF (y>INT_MAX, "bad integer");
+  return cast_int(y);
+ }
  LoadVar(S,x);
  IF (x<0, "bad integer");
  return x;
@@ -73,12 +153,38 @@ static lua_Number LoadNumber(LoadState* S)
  return x;
 }
 
+/* see DumpPooled in ldump.c */
+static TString* LoadPooled(LoadState* S)
+{
+ size_t i=LoadSize(S),size;
+ TString* ts;
+ if (i==0)
+  return NULL;
+ else if (i<=(size_t)S->npool)
+  return rawtsvalue(luaH_getnum(S->pool,cast_int(i)));
+ IF (i!=(size_t)S->npool+1, "bad string");
+ size=LoadSize(S);
+ if (S->img!=NULL)
+  ts=luaS_newlstr(S->L,MapBlock(S,size),size);
+ else
+ {
+  char* s=luaZ_openspace(S->L,S->b,size);
+  LoadBlock(S,s,size);
+  ts=luaS_newlstr(S->L,s,size);
+ }
+ setsvalue2n(S->L,luaH_setnum(S->L,S->pool,++S->npool),ts);
+ return ts;
+}
+
 static TString* LoadString(LoadState* S)
 {
  size_t size;
+ if (S->compact) return LoadPooled(S);
  LoadVar(S,size);
  if (size==0)
   return NULL;
+ else if (S->img!=NULL)
+  return luaS_newlstr(S->L,MapBlock(S,size),size-1);
  else
  {
   char* s=luaZ_openspace(S->L,S->b,size);
@@ -87,16 +193,58 @@ static TString* LoadString(LoadState* S)
  }
 }
 
+static void SkipName(LoadState* S)
+{
+ size_t size;
+ LoadVar(S,size);
+ IF (size==0, "bad name");		/* as LoadNames would find it */
+ MapBlock(S,size);
+}
+
 static void LoadCode(LoadState* S, Proto* f)
 {
  int n=LoadInt(S);
- f->code=luaM_newvector(S->L,n,Instruction);
- f->sizecode=n;
- LoadVector(S,f->code,n,sizeof(Instruction));
+ IF (n==0, "bad code");			/* there is always a return */
+ LoadAlign(S);
+ if (S->map)
+ {
+  f->code=(Instruction*)MapBlock(S,n*sizeof(Instruction));
+  f->sizecode=n;
+ }
+ else
+ {
+  f->code=luaM_newvector(S->L,n,Instruction);
+  f->sizecode=n;
+  LoadVector(S,f->code,n,sizeof(Instruction));
+ }
+ luaF_initcache(S->L,f);
 }
 
+static Proto* LoadHead(LoadState* S, TString* p);
 static Proto* LoadFunction(LoadState* S, TString* p);
 
+/*
+** make the nested functions of f stubs, with only what is before their
+** code (see luaU_loadbody); images have a table of where they start and
+** where the last one ends
+*/
+static void LoadStubs(LoadState* S, Proto* f)
+{
+ size_t table=S->pos,offset;
+ int i;
+ for (i=0; i<=f->sizep; i++)
+ {
+  S->pos=table+i*sizeof(size_t);
+  LoadVar(S,offset);
+  IF (offset>S->img->size, "bad offset");
+  S->pos=offset;
+  if (i==f->sizep) break;
+  f->p[i]=LoadHead(S,f->source);
+  f->p[i]->body=S->img->p+S->pos;
+  S->L->top--;
+ }
+}
+
 static void LoadConstants(LoadState* S, Proto* f)
 {
  int i,n;
@@ -117,11 +265,19 @@ static void LoadConstants(LoadState* S, Proto* f)
    	setbvalue(o,LoadChar(S)!=0);
 	break;
    case LUA_TNUMBER:
-	setnvalue(o,LoadNumber(S));
+	luaO_setnumber(o,LoadNumber(S));
+	break;
+   case LUAC_TINT:
+	IF (!S->compact, "bad constant");
+	luaO_setnumber(o,cast_num(LoadSigned(S)));
 	break;
    case LUA_TSTRING:
-	setsvalue2n(S->L,o,LoadString(S));
+   {
+	TString* ts=LoadString(S);
+	IF (ts==NULL, "bad constant");
+	setsvalue2n(S->L,o,ts);
 	break;
+   }
    default:
 	error(S,"bad constant");
 	break;
@@ -131,23 +287,46 @@ static void LoadConstants(LoadState* S, Proto* f)
  f->p=luaM_newvector(S->L,n,Proto*);
  f->sizep=n;
  for (i=0; i<n; i++) f->p[i]=NULL;
- for (i=0; i<n; i++) f->p[i]=LoadFunction(S,f->source);
+ if (S->map)
+  LoadStubs(S,f);
+ else
+ {
+  size_t offset;
+  if (S->image) for (i=0; i<=n; i++) LoadVar(S,offset);	/* not needed */
+  for (i=0; i<n; i++) f->p[i]=LoadFunction(S,f->source);
+ }
 }
 
-static void LoadDebug(LoadState* S, Proto* f)
+/* check the names of locals and upvalues; return how many there are */
+static int SkipNames(LoadState* S, Proto* f)
 {
- int i,n;
+ int i,n,m;
  n=LoadInt(S);
- f->lineinfo=luaM_newvector(S->L,n,int);
- f->sizelineinfo=n;
- LoadVector(S,f->lineinfo,n,sizeof(int));
+ for (i=0; i<n; i++)
+ {
+  SkipName(S);
+  LoadInt(S);
+  LoadInt(S);
+ }
+ m=LoadInt(S);
+ IF (m>f->nups, "bad code");
+ for (i=0; i<m; i++) SkipName(S);
+ return n+m;
+}
+
+static void LoadNames(LoadState* S, Proto* f)
+{
+ int i,n;
  n=LoadInt(S);
  f->locvars=luaM_newvector(S->L,n,LocVar);
  f->sizelocvars=n;
  for (i=0; i<n; i++) f->locvars[i].varname=NULL;
  for (i=0; i<n; i++)
  {
-  f->locvars[i].varname=LoadString(S);
+  TString* ts=LoadString(S);
+  IF (ts==NULL, "bad name");
+  f->locvars[i].varname=ts;
+  luaC_objbarrier(S->L,f,ts);
   f->locvars[i].startpc=LoadInt(S);
   f->locvars[i].endpc=LoadInt(S);
  }
@@ -155,15 +334,58 @@ static void LoadDebug(LoadState* S, Proto* f)
  f->upvalues=luaM_newvector(S->L,n,TString*);
  f->sizeupvalues=n;
  for (i=0; i<n; i++) f->upvalues[i]=NULL;
- for (i=0; i<n; i++) f->upvalues[i]=LoadString(S);
+ for (i=0; i<n; i++)
+ {
+  TString* ts=LoadString(S);
+  IF (ts==NULL, "bad name");
+  f->upvalues[i]=ts;
+  luaC_objbarrier(S->L,f,ts);
+ }
 }
 
-static Proto* LoadFunction(LoadState* S, TString* p)
+static void LoadDebug(LoadState* S, Proto* f)
 {
- Proto* f;
- if (++S->L->nCcalls > LUAI_MAXCCALLS) error(S,"code too deep");
- f=luaF_newproto(S->L);
+ int n=LoadInt(S);
+ LoadAlign(S);
+ if (S->compact)
+ {
+  int i,last=f->linedefined;
+  f->lineinfo=luaM_newvector(S->L,n,int);
+  f->sizelineinfo=n;
+  for (i=0; i<n; i++)
+  {
+   int d=LoadSigned(S);
+   IF ((d<0) ? last<INT_MIN-d : last>INT_MAX-d, "bad offset");
+   f->lineinfo[i]=last+=d;
+  }
+  LoadNames(S,f);
+ }
+ else if (S->map)
+ {
+  f->lineinfo=(n>0) ? (int*)MapBlock(S,n*sizeof(int)) : NULL;
+  f->sizelineinfo=n;
+  f->debug=S->img->p+S->pos;		/* names wait for luaU_loaddebug */
+  if (SkipNames(S,f)==0) f->debug=NULL;
+ }
+ else
+ {
+  f->lineinfo=luaM_newvector(S->L,n,int);
+  f->sizelineinfo=n;
+  LoadVector(S,f->lineinfo,n,sizeof(int));
+  LoadNames(S,f);
+ }
+}
+
+/* load what is before the code of a function and leave it on the stack */
+static Proto* LoadHead(LoadState* S, TString* p)
+{
+ Proto* f=luaF_newproto(S->L);
  setptvalue2s(S->L,S->L->top,f); incr_top(S->L);
+ if (S->map)
+ {
+  f->image=S->img;
+  S->img->nref++;
+ }
  f->source=LoadString(S); if (f->source==NULL) f->source=p;
  f->linedefined=LoadInt(S);
  f->lastlinedefined=LoadInt(S);
@@ -171,22 +393,105 @@ static Proto* LoadFunction(LoadState* S, TString* p)
  f->numparams=LoadByte(S);
  f->is_vararg=LoadByte(S);
  f->maxstacksize=LoadByte(S);
+ return f;
+}
+
+static void LoadBody(LoadState* S, Proto* f)
+{
  LoadCode(S,f);
  LoadConstants(S,f);
  LoadDebug(S,f);
  IF (!luaG_checkcode(f), "bad code");
+}
+
+static Proto* LoadFunction(LoadState* S, TString* p)
+{
+ Proto* f;
+ if (++S->L->nCcalls > LUAI_MAXCCALLS) error(S,"code too deep");
+ f=LoadHead(S,p);
+ LoadBody(S,f);
  S->L->top--;
  S->L->nCcalls--;
  return f;
 }
 
-static void LoadHeader(LoadState* S)
+/*
+** unpack the rest of a compressed chunk (see Compress in ldump.c) into
+** a userdata and read from there
+*/
+static void LoadCompressed(LoadState* S, Image* unpacked)
+{
+ size_t n=LoadSize(S),i=0;
+ Udata* u=luaS_newudata(S->L,n,hvalue(gt(S->L)));
+ char* b=cast(char*,u+1);
+ setuvalue(S->L,S->L->top,u); incr_top(S->L);
+ while (i<n)
+ {
+  size_t t=LoadSize(S),len=t>>1;
+  if (t&1)
+  {
+   size_t d=LoadSize(S);
+   len+=LUAC_LZMIN;
+   IF (d==0 || d>i || len>n-i, "bad match");
+   for (; len>0; len--,i++) b[i]=b[i-d];
+  }
+  else
+  {
+   IF (len>n-i, "bad literal");
+   LoadBlock(S,b+i,len);
+   i+=len;
+  }
+ }
+ unpacked->p=b;
+ unpacked->size=n;
+ S->img=unpacked;
+ S->pos=0;
+}
+
+static void LoadHeader(LoadState* S, Image* unpacked)
 {
  char h[LUAC_HEADERSIZE];
  char s[LUAC_HEADERSIZE];
+ int format;
  luaU_header(h);
  LoadBlock(S,s,LUAC_HEADERSIZE);
+ format=(unsigned char)s[LUAC_FORMATPOS]&~LUAC_FUSED;
+ if (format<=LUAC_COMPRESSED) h[LUAC_FORMATPOS]=s[LUAC_FORMATPOS];
  IF (memcmp(h,s,LUAC_HEADERSIZE)!=0, "bad header");
+ S->image=(format==LUAC_IMAGE);
+ S->map=S->image && S->img!=NULL && IntPoint(S->img->p)%LUAC_IMAGEALIGN==0;
+ S->compact=(format==LUAC_COMPACT || format==LUAC_COMPRESSED);
+ if (S->compact)
+ {
+  S->pool=luaH_new(S->L,0,0);
+  S->npool=0;
+  sethvalue2s(S->L,S->L->top,S->pool); incr_top(S->L);
+ }
+ if (format==LUAC_COMPRESSED) LoadCompressed(S,unpacked);
+}
+
+static void SetName(LoadState* S, const char* name)
+{
+ if (*name=='@' || *name=='=')
+  S->name=name+1;
+ else if (*name==LUA_SIGNATURE[0])
+  S->name="binary string";
+ else
+  S->name=name;
+}
+
+static Proto* LoadChunk(LoadState* S, const char* name)
+{
+ lua_State* L=S->L;
+ ptrdiff_t top=savestack(L,L->top);
+ Image unpacked;
+ Proto* f;
+ SetName(S,name);
+ S->pos=0;
+ LoadHeader(S,&unpacked);
+ f=LoadFunction(S,luaS_newliteral(L,"=?"));
+ L->top=restorestack(L,top);		/* pool and unpacked chunk */
+ return f;
 }
 
 /*
@@ -195,17 +500,101 @@ static void LoadHeader(LoadState* S)
 Proto* luaU_undump (lua_State* L, ZIO* Z, Mbuffer* buff, const char* name)
 {
  LoadState S;
- if (*name=='@' || *name=='=')
-  S.name=name+1;
- else if (*name==LUA_SIGNATURE[0])
-  S.name="binary string";
- else
-  S.name=name;
  S.L=L;
  S.Z=Z;
  S.b=buff;
- LoadHeader(&S);
- return LoadFunction(&S,luaS_newliteral(L,"=?"));
+ S.img=NULL;
+ return LoadChunk(&S,name);
+}
+
+/*
+** load precompiled chunk from memory that stays valid until released;
+** functions in an aligned image (luac -m) keep their code and line
+** information there, load the names of locals and upvalues only if
+** they are asked for and nested functions only when a closure needs
+** them. *loader gets the copy of img whose reference is dropped by the
+** caller when the load ends
+*/
+Proto* luaU_undumpimage (lua_State* L, const Image* img, Image** loader, const char* name)
+{
+ LoadState S;
+ S.L=L;
+ S.Z=NULL;
+ S.b=NULL;
+ S.img=*loader=luaM_new(L,Image);
+ *S.img=*img;
+ S.img->nref=1;
+ return LoadChunk(&S,name);
+}
+
+/*
+** load the names left in the image of f; what an error leaves behind
+** is freed by the next call
+*/
+void luaU_loaddebug (lua_State* L, Proto* f)
+{
+ LoadState S;
+ luaM_freearray(L,f->locvars,f->sizelocvars,LocVar);
+ f->locvars=NULL; f->sizelocvars=0;
+ luaM_freearray(L,f->upvalues,f->sizeupvalues,TString*);
+ f->upvalues=NULL; f->sizeupvalues=0;
+ S.L=L;
+ S.Z=NULL;
+ S.b=NULL;
+ S.name="image";
+ S.img=f->image;
+ S.pos=f->debug-f->image->p;
+ S.image=S.map=1;
+ S.compact=0;
+ LoadNames(&S,f);
+ f->debug=NULL;
+}
+
+/*
+** load the body of stub f (see LoadStubs); it is loaded into a new
+** function first, so that an error leaves f as it was
+*/
+void luaU_loadbody (lua_State* L, Proto* f)
+{
+ LoadState S;
+ Proto* b;
+ int i;
+ S.L=L;
+ S.Z=NULL;
+ S.b=NULL;
+ SetName(&S,getstr(f->source));
+ S.img=f->image;
+ S.pos=f->body-f->image->p;
+ S.image=S.map=1;
+ S.compact=0;
+ b=luaF_newproto(L);
+ setptvalue2s(L,L->top,b); incr_top(L);
+ b->image=f->image;
+ b->image->nref++;
+ b->source=f->source;
+ b->linedefined=f->linedefined;
+ b->lastlinedefined=f->lastlinedefined;
+ b->nups=f->nups;
+ b->numparams=f->numparams;
+ b->is_vararg=f->is_vararg;
+ b->maxstacksize=f->maxstacksize;
+ LoadBody(&S,b);
+ f->code=b->code; f->sizecode=b->sizecode;
+ f->icache=b->icache; f->sizeicache=b->sizeicache;
+ f->k=b->k; f->sizek=b->sizek;
+ f->p=b->p; f->sizep=b->sizep;
+ f->lineinfo=b->lineinfo; f->sizelineinfo=b->sizelineinfo;
+ f->debug=b->debug;
+ b->code=NULL; b->sizecode=0;		/* b goes with the next collection */
+ b->icache=NULL; b->sizeicache=0;
+ b->k=NULL; b->sizek=0;
+ b->p=NULL; b->sizep=0;
+ b->lineinfo=NULL; b->sizelineinfo=0;
+ L->top--;
+ for (i=0; i<f->sizek; i++)		/* f may be black already */
+  if (iscollectable(&f->k[i])) luaC_objbarrier(L,f,gcvalue(&f->k[i]));
+ for (i=0; i<f->sizep; i++) luaC_objbarrier(L,f,f->p[i]);
+ f->body=NULL;
 }
 
 /*
@@ -13,11 +13,26 @@
 /* load one chunk; from lundump.c */
 LUAI_FUNC Proto* luaU_undump (lua_State* L, ZIO* Z, Mbuffer* buff, const char* name);
 
+/* load one chunk from an image (see lua_loadimage); from lundump.c */
+LUAI_FUNC Proto* luaU_undumpimage (lua_State* L, const Image* img, Image** loader, const char* name);
+
+/* load the names left in an image; from lundump.c */
+LUAI_FUNC void luaU_loaddebug (lua_State* L, Proto* f);
+
+#define luaU_checkdebug(L,f)	{ if ((f)->debug) luaU_loaddebug(L,f); }
+
+/* load the body of a function left in an image; from lundump.c */
+LUAI_FUNC void luaU_loadbody (lua_State* L, Proto* f);
+
+#define luaU_checkbody(L,f)	{ if ((f)->body) luaU_loadbody(L,f); }
+
 /* make header; from lundump.c */
 LUAI_FUNC void luaU_header (char* h);
 
-/* dump one chunk; from ldump.c */
-LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip);
+/* dump one chunk in format LUAC_FORMAT, LUAC_IMAGE, LUAC_COMPACT or
+   LUAC_COMPRESSED; strip is 0 (keep debug information), 1 (strip it)
+   or LUAC_STRIPNAMES; from ldump.c */
+LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip, int format);
 
 #ifdef luac_c
 /* print one chunk; from print.c */
@@ -30,6 +45,34 @@ LUAI_FUNC void luaU_print (const Proto* f, int full);
 /* for header of binary files -- this is the official format */
 #define LUAC_FORMAT		0
 
+/* for header of binary files -- vectors aligned for mapping (luac -m) */
+#define LUAC_IMAGE		1
+
+/* for header of binary files -- varints, delta lines, shared strings (luac -c) */
+#define LUAC_COMPACT		2
+
+/* for header of binary files -- LUAC_COMPACT and LZ-compressed (luac -z) */
+#define LUAC_COMPRESSED		3
+
+/* strip only names of locals and upvalues, keeping line information */
+#define LUAC_STRIPNAMES		2
+
+/* tag of constants kept as integers in compact chunks */
+#define LUAC_TINT		(LUA_TNUMBER|0x10)
+
+/* shortest match in compressed chunks */
+#define LUAC_LZMIN		4
+
+/* for header of binary files -- flag of chunks using fused opcodes,
+   which stock Lua 5.1 cannot run */
+#define LUAC_FUSED		0x10
+
+/* where the format is in the header (after the signature and version) */
+#define LUAC_FORMATPOS		(sizeof(LUA_SIGNATURE))
+
+/* alignment of code and line information in images */
+#define LUAC_IMAGEALIGN		8
+
 /* size of header of binary files */
 #define LUAC_HEADERSIZE		12
 
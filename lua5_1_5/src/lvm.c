@@ -18,12 +18,14 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lundump.h"
 #include "lvm.h"
 
 
@@ -77,14 +79,31 @@ static void traceexec (lua_State *L, const Instruction *pc) {
 }
 
 
+/*
+** A Lua metamethod called by the VM does not get a `luaV_execute' of its
+** own: `callTMres' and `callTM' only push its frame and the VM goes on
+** with it (see `ProtectTM'); when it returns `luaV_finishcall' ends the
+** instruction. Hooks and the C API (where `L->ci' is not the Lua function
+** running the instruction) still call it here; so do leaves, which run
+** over the frame of their caller with `L->base' above its base.
+*/
+#define pushTM(L,f,k)	((k) && ttisfunction(f) && !clvalue(f)->c.isC && \
+                         f_isLua(L->ci) && L->base == L->ci->base && \
+                         L->allowhook)
+
+
 static void callTMres (lua_State *L, StkId res, const TValue *f,
-                        const TValue *p1, const TValue *p2) {
+                        const TValue *p1, const TValue *p2, int k) {
   ptrdiff_t result = savestack(L, res);
   setobj2s(L, L->top, f);  /* push function */
   setobj2s(L, L->top+1, p1);  /* 1st argument */
   setobj2s(L, L->top+2, p2);  /* 2nd argument */
   luaD_checkstack(L, 3);
   L->top += 3;
+  if (pushTM(L, f, k)) {
+    luaD_precall(L, L->top - 3, 1);
+    return;
+  }
   luaD_call(L, L->top - 3, 1);
   res = restorestack(L, result);
   L->top--;
@@ -101,7 +120,10 @@ static void callTM (lua_State *L, const TValue *f, const TValue *p1,
   setobj2s(L, L->top+3, p3);  /* 3th argument */
   luaD_checkstack(L, 4);
   L->top += 4;
-  luaD_call(L, L->top - 4, 0);
+  if (pushTM(L, f, 1))
+    luaD_precall(L, L->top - 4, 0);
+  else
+    luaD_call(L, L->top - 4, 0);
 }
 
 
@@ -122,7 +144,7 @@ void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
     else if (ttisnil(tm = luaT_gettmbyobj(L, t, TM_INDEX)))
       luaG_typeerror(L, t, "index");
     if (ttisfunction(tm)) {
-      callTMres(L, val, tm, t, key);
+      callTMres(L, val, tm, t, key, 1);
       return;
     }
     t = tm;  /* else repeat with `tm' */ 
@@ -168,7 +190,7 @@ static int call_binTM (lua_State *L, const TValue *p1, const TValue *p2,
   if (ttisnil(tm))
     tm = luaT_gettmbyobj(L, p2, event);  /* try second operand */
   if (ttisnil(tm)) return 0;
-  callTMres(L, res, tm, p1, p2);
+  callTMres(L, res, tm, p1, p2, 1);
   return 1;
 }
 
@@ -188,14 +210,14 @@ static const TValue *get_compTM (lua_State *L, Table *mt1, Table *mt2,
 
 
 static int call_orderTM (lua_State *L, const TValue *p1, const TValue *p2,
-                         TMS event) {
+                         TMS event, int k) {
   const TValue *tm1 = luaT_gettmbyobj(L, p1, event);
   const TValue *tm2;
   if (ttisnil(tm1)) return -1;  /* no metamethod? */
   tm2 = luaT_gettmbyobj(L, p2, event);
   if (!luaO_rawequalObj(tm1, tm2))  /* different metamethods? */
     return -1;
-  callTMres(L, L->top, tm1, p1, p2);
+  callTMres(L, L->top, tm1, p1, p2, k);
   return !l_isfalse(L->top);
 }
 
@@ -230,7 +252,7 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
     return luai_numlt(nvalue(l), nvalue(r));
   else if (ttisstring(l))
     return l_strcmp(rawtsvalue(l), rawtsvalue(r)) < 0;
-  else if ((res = call_orderTM(L, l, r, TM_LT)) != -1)
+  else if ((res = call_orderTM(L, l, r, TM_LT, 1)) != -1)
     return res;
   return luaG_ordererror(L, l, r);
 }
@@ -244,10 +266,10 @@ static int lessequal (lua_State *L, const TValue *l, const TValue *r) {
     return luai_numle(nvalue(l), nvalue(r));
   else if (ttisstring(l))
     return l_strcmp(rawtsvalue(l), rawtsvalue(r)) <= 0;
-  else if ((res = call_orderTM(L, l, r, TM_LE)) != -1)  /* first try `le' */
+  else if ((res = call_orderTM(L, l, r, TM_LE, 1)) != -1)  /* first try `le' */
     return res;
-  else if ((res = call_orderTM(L, r, l, TM_LT)) != -1)  /* else try `lt' */
-    return !res;
+  else if ((res = call_orderTM(L, r, l, TM_LT, 0)) != -1)  /* else try `lt' */
+    return !res;  /* (called here, as the VM cannot negate its result) */
   return luaG_ordererror(L, l, r);
 }
 
@@ -260,6 +282,7 @@ int luaV_equalval (lua_State *L, const TValue *t1, const TValue *t2) {
     case LUA_TNUMBER: return luai_numeq(nvalue(t1), nvalue(t2));
     case LUA_TBOOLEAN: return bvalue(t1) == bvalue(t2);  /* true must be 1 !! */
     case LUA_TLIGHTUSERDATA: return pvalue(t1) == pvalue(t2);
+    case LUA_TSTRING: return eqstr(rawtsvalue(t1), rawtsvalue(t2));
     case LUA_TUSERDATA: {
       if (uvalue(t1) == uvalue(t2)) return 1;
       tm = get_compTM(L, uvalue(t1)->metatable, uvalue(t2)->metatable,
@@ -274,7 +297,7 @@ int luaV_equalval (lua_State *L, const TValue *t1, const TValue *t2) {
     default: return gcvalue(t1) == gcvalue(t2);
   }
   if (tm == NULL) return 0;  /* no TM? */
-  callTMres(L, L->top, tm, t1, t2);  /* call TM */
+  callTMres(L, L->top, tm, t1, t2, 1);  /* call TM */
   return !l_isfalse(L->top);
 }
 
@@ -284,8 +307,12 @@ void luaV_concat (lua_State *L, int total, int last) {
     StkId top = L->base + last + 1;
     int n = 2;  /* number of elements handled in this pass (at least 2) */
     if (!(ttisstring(top-2) || ttisnumber(top-2)) || !tostring(L, top-1)) {
+      ptrdiff_t ci = saveci(L, L->ci);
+      L->top = top;  /* the metamethod goes right after its operands */
       if (!call_binTM(L, top-2, top-1, top-2, TM_CONCAT))
         luaG_concaterror(L, top-2, top-1);
+      if (saveci(L, L->ci) != ci)  /* pushed its frame? */
+        return;  /* `luaV_finishcall' goes on */
     } else if (tsvalue(top-1)->len == 0)  /* second op is empty? */
       (void)tostring(L, top - 2);  /* result is first op (as string) */
     else {
@@ -338,11 +365,35 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 
 
 
+/*
+** t[key] for a string `key' through an inline cache: `slot' is the node
+** (or field, for tables with a shape) where `key' was found the last
+** time, which is still right while that node holds `key' (tables built
+** alike share it). Resizes or moved nodes just make it miss.
+*/
+static const TValue *getcached (Table *t, TString *key, int *slot) {
+  int s = *slot;
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) {  /* slot is a field index */
+    if (s < t->shape->nkeys && t->shape->keys[s] == key)
+      return &t->fields[s];
+  }
+  else
+#endif
+  if (s < sizenode(t)) {
+    Node *n = gnode(t, s);
+    if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key)
+      return gval(n);
+  }
+  return luaH_getstrslot(t, key, slot);
+}
+
+
 /*
 ** some macros for common tasks in `luaV_execute'
 */
 
-#define runtime_check(L, c)	{ if (!(c)) break; }
+#define runtime_check(L, c)	{ if (!(c)) vmbreak; }
 
 #define RA(i)	(base+GETARG_A(i))
 /* to be used after possible stack reallocation */
@@ -357,10 +408,67 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 
 #define dojump(L,pc,i)	{(pc) += (i); luai_threadyield(L);}
 
+/* inline cache of the current instruction */
+#define icache(cl,pc)	(&(cl)->p->icache[pcRel(pc, (cl)->p)])
+
 
 #define Protect(x)	{ L->savedpc = pc; {x;}; base = L->base; }
 
 
+#if defined(LUA_USE_JIT)
+/* back jump of OP_FORLOOP: counts it and runs hot loops natively */
+#define jitloop(hot) \
+  if (++*(hot) >= LUAI_JITHOT) { \
+    if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) *(hot) = 0; \
+    else Protect(pc = luaJ_forloop(L, cl, base, hot)); }
+/* goes on in the native code of the function, if it has some */
+#define jitcall() \
+  if (cl->p->jitfunc != NULL && \
+      !(L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT))) \
+    Protect(pc = luaJ_call(L, cl, base, pc));
+#else
+#define jitloop(hot)	((void)0)
+#define jitcall()	((void)0)
+#endif
+
+/* for code that may push the frame of a metamethod (see `pushTM') */
+#define ProtectTM(x)	{ L->savedpc = pc; {x;}; \
+    if (L->savedpc != pc) { nexeccalls++; goto reentry; } \
+    base = L->base; }
+
+
+/*
+** `int' arithmetic for LUA_USE_DUALNUM: each macro stores the result in
+** `r' and is false when it does not fit in an `int' (or when it would be
+** -0, which only a `lua_Number' can hold)
+*/
+#define iadd(r,a,b)	((r) = cast_int(cast(unsigned int, a) + \
+                                        cast(unsigned int, b)), \
+                         (((a) ^ (r)) & ((b) ^ (r))) >= 0)
+#define isub(r,a,b)	((r) = cast_int(cast(unsigned int, a) - \
+                                        cast(unsigned int, b)), \
+                         (((a) ^ (b)) & ((a) ^ (r))) >= 0)
+#define ismall(a)	(cast(unsigned int, a) + 46340u <= 92680u)
+#define imul(r,a,b)	(ismall(a) && ismall(b) && ((r) = (a) * (b), \
+                         (r) != 0 || ((a) | (b)) >= 0))
+
+
+#define arith_opi(op,iop,tm) { \
+        TValue *rb = RKB(i); \
+        TValue *rc = RKC(i); \
+        int ir; \
+        if (ttisint(rb) && ttisint(rc) && iop(ir, ivalue(rb), ivalue(rc))) { \
+          setivalue(ra, ir); \
+        } \
+        else if (ttisnumber(rb) && ttisnumber(rc)) { \
+          lua_Number nb = nvalue(rb), nc = nvalue(rc); \
+          setnvalue(ra, op(nb, nc)); \
+        } \
+        else \
+          ProtectTM(Arith(L, ra, rb, rc, tm)); \
+      }
+
+
 #define arith_op(op,tm) { \
         TValue *rb = RKB(i); \
         TValue *rc = RKC(i); \
@@ -369,153 +477,308 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
           setnvalue(ra, op(nb, nc)); \
         } \
         else \
-          Protect(Arith(L, ra, rb, rc, tm)); \
+          ProtectTM(Arith(L, ra, rb, rc, tm)); \
       }
 
 
 
-void luaV_execute (lua_State *L, int nexeccalls) {
+/*
+** fetch the next instruction and check hooks; `ra' is recomputed here
+** because several calls may realloc the stack and invalidate it
+*/
+#define vmfetch()	{ \
+    i = *pc++; \
+    if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) && \
+        (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) { \
+      traceexec(L, pc); \
+      if (L->status == LUA_YIELD) {  /* did hook yield? */ \
+        L->savedpc = pc - 1; \
+        goto stopped; \
+      } \
+      base = L->base; \
+    } \
+    ra = RA(i); \
+    lua_assert(base == L->base && L->base == L->ci->base); \
+    lua_assert(base <= L->top && L->top <= L->stack + L->stacksize); \
+    lua_assert(L->top == L->ci->top || luaG_checkopenop(i)); }
+
+
+/*
+** opcode dispatch: with LUA_USE_JUMPTABLE each handler ends by fetching
+** the next instruction and jumping straight to its label, so every opcode
+** gets its own indirect branch; otherwise a plain `switch' is used
+*/
+#if LUA_USE_JUMPTABLE
+
+#define vmdispatch(o)	goto *disptab[o];
+#define vmcase(l)	L_##l:
+#define vmbreak		{ vmfetch(); vmdispatch(GET_OPCODE(i)); }
+
+#else
+
+#define vmdispatch(o)	switch(o)
+#define vmcase(l)	case l:
+#define vmbreak		continue
+
+#endif
+
+
+/*
+** finish a fused opcode: run the next instruction, which must be `l',
+** without dispatching it. Hooks need to see every instruction, so when
+** they are on the next instruction goes through the normal path.
+*/
+#define vmfuse(l)	{ \
+    if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) vmbreak; \
+    i = *pc++; \
+    ra = RA(i); \
+    lua_assert(GET_OPCODE(i) == l); \
+    goto F_##l; }
+
+#define vmfusedcase(l)	vmcase(l) F_##l:
+
+
+
+/*
+** a call made by the Lua function in `L->ci' completed out of line (it
+** returned to another `luaV_execute' iteration, or was resumed after a
+** yield or a coroutine switch): finish the instruction that made it, with
+** the results of the call still where `luaD_poscall' left them. Returns 1
+** if that pushed the frame of another metamethod.
+*/
+int luaV_finishcall (lua_State *L) {
+  CallInfo *ci = L->ci;
+  StkId base = L->base;
+  const Instruction *pc = L->savedpc;
+  Instruction i = *(pc - 1);
+  lua_assert(isLua(ci));
+  switch (GET_OPCODE(i)) {
+    case OP_CALL: {
+      if (GETARG_C(i) != 0)  /* fixed number of results? */
+        L->top = ci->top;
+      break;
+    }
+    case OP_TAILCALL: break;
+    case OP_TFORLOOP: {
+      StkId cb = base + GETARG_A(i) + 3;
+      L->top = ci->top;
+      if (!ttisnil(cb)) {  /* continue loop? */
+        setobjs2s(L, cb-1, cb);  /* save control variable */
+        pc += GETARG_sBx(*pc);  /* jump back */
+      }
+      L->savedpc = pc + 1;
+      break;
+    }
+    case OP_GETGLOBAL: case OP_GETTABLE: case OP_SELF: case OP_GETTABLECALL:
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+    case OP_POW: case OP_UNM: case OP_LEN: {
+      setobjs2s(L, base + GETARG_A(i), L->top - 1);
+      L->top = ci->top;
+      break;
+    }
+    case OP_EQ: case OP_LT: case OP_LE: {
+      int res = !l_isfalse(L->top - 1);
+      L->top = ci->top;
+      if (res == GETARG_A(i))
+        pc += GETARG_sBx(*pc);
+      L->savedpc = pc + 1;
+      break;
+    }
+    case OP_CONCAT: {
+      StkId top = L->top - 1;  /* top when the metamethod was called */
+      int b = GETARG_B(i);
+      int last = cast_int(top - base) - 2;  /* last operand still left */
+      setobjs2s(L, top - 2, top);  /* put its result in place */
+      if (last > b) {  /* still something to concatenate? */
+        ptrdiff_t c = saveci(L, ci);
+        luaV_concat(L, last - b + 1, last);
+        if (saveci(L, L->ci) != c)
+          return 1;
+      }
+      L->top = L->ci->top;
+      setobjs2s(L, L->base + GETARG_A(i), L->base + b);
+      luaC_checkGC(L);
+      break;
+    }
+    default: {  /* `__newindex' has no results */
+      lua_assert(GET_OPCODE(i) == OP_SETGLOBAL ||
+                 GET_OPCODE(i) == OP_SETTABLE);
+      L->top = ci->top;
+      break;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Runs the last `nexeccalls' Lua calls of `L'; returns 0 when they finish
+** or the thread yields. When a C function asks for a coroutine with
+** `lua_resumek' and there is no `sw' it returns the number of calls still
+** to run, for `luaD_switch'; under a switch it goes on with the coroutine,
+** and with the resumer when that stops.
+*/
+int luaV_execute (lua_State *L, int nexeccalls, Switch *sw) {
   LClosure *cl;
   StkId base;
   TValue *k;
   const Instruction *pc;
+  Instruction i;
+  StkId ra;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
+  if (sw != NULL) {  /* called by `luaD_switch'? */
+    if (L->resuming != NULL) goto newthread;
+    else goto stopped;  /* a coroutine failed */
+  }
  reentry:  /* entry point */
   lua_assert(isLua(L->ci));
   pc = L->savedpc;
   cl = &clvalue(L->ci->func)->l;
   base = L->base;
   k = cl->p->k;
+  jitcall();
   /* main loop of interpreter */
   for (;;) {
-    const Instruction i = *pc++;
-    StkId ra;
-    if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) &&
-        (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) {
-      traceexec(L, pc);
-      if (L->status == LUA_YIELD) {  /* did hook yield? */
-        L->savedpc = pc - 1;
-        return;
-      }
-      base = L->base;
-    }
-    /* warning!! several calls may realloc the stack and invalidate `ra' */
-    ra = RA(i);
-    lua_assert(base == L->base && L->base == L->ci->base);
-    lua_assert(base <= L->top && L->top <= L->stack + L->stacksize);
-    lua_assert(L->top == L->ci->top || luaG_checkopenop(i));
-    switch (GET_OPCODE(i)) {
-      case OP_MOVE: {
+    vmfetch();
+    vmdispatch (GET_OPCODE(i)) {
+      vmcase(OP_MOVE) {
         setobjs2s(L, ra, RB(i));
-        continue;
+        vmbreak;
       }
-      case OP_LOADK: {
+      vmcase(OP_LOADK) {
         setobj2s(L, ra, KBx(i));
-        continue;
+        vmbreak;
       }
-      case OP_LOADBOOL: {
+      vmcase(OP_LOADBOOL) {
         setbvalue(ra, GETARG_B(i));
         if (GETARG_C(i)) pc++;  /* skip next instruction (if C) */
-        continue;
+        vmbreak;
       }
-      case OP_LOADNIL: {
+      vmcase(OP_LOADNIL) {
         TValue *rb = RB(i);
         do {
           setnilvalue(rb--);
         } while (rb >= ra);
-        continue;
+        vmbreak;
       }
-      case OP_GETUPVAL: {
+      vmcase(OP_GETUPVAL) {
         int b = GETARG_B(i);
         setobj2s(L, ra, cl->upvals[b]->v);
-        continue;
+        vmbreak;
       }
-      case OP_GETGLOBAL: {
+      vmcase(OP_GETGLOBAL) {
         TValue g;
         TValue *rb = KBx(i);
         sethvalue(L, &g, cl->env);
         lua_assert(ttisstring(rb));
-        Protect(luaV_gettable(L, &g, rb, ra));
-        continue;
+        ProtectTM(luaV_gettable(L, &g, rb, ra));
+        vmbreak;
       }
-      case OP_GETTABLE: {
-        Protect(luaV_gettable(L, RB(i), RKC(i), ra));
-        continue;
+      vmfusedcase(OP_GETTABLE) {
+        TValue *rb = RB(i);
+        TValue *rc = RKC(i);
+        if (ttistable(rb) && ttisstring(rc)) {
+          const TValue *res = getcached(hvalue(rb), rawtsvalue(rc),
+                                        icache(cl, pc));
+          if (!ttisnil(res)) {  /* else it may need `__index' */
+            setobj2s(L, ra, res);
+            vmbreak;
+          }
+        }
+        ProtectTM(luaV_gettable(L, rb, rc, ra));
+        vmbreak;
       }
-      case OP_SETGLOBAL: {
+      vmcase(OP_SETGLOBAL) {
         TValue g;
         sethvalue(L, &g, cl->env);
         lua_assert(ttisstring(KBx(i)));
-        Protect(luaV_settable(L, &g, KBx(i), ra));
-        continue;
+        ProtectTM(luaV_settable(L, &g, KBx(i), ra));
+        vmbreak;
       }
-      case OP_SETUPVAL: {
+      vmcase(OP_SETUPVAL) {
         UpVal *uv = cl->upvals[GETARG_B(i)];
         setobj(L, uv->v, ra);
         luaC_barrier(L, uv, ra);
-        continue;
+        vmbreak;
       }
-      case OP_SETTABLE: {
-        Protect(luaV_settable(L, ra, RKB(i), RKC(i)));
-        continue;
+      vmcase(OP_SETTABLE) {
+        ProtectTM(luaV_settable(L, ra, RKB(i), RKC(i)));
+        vmbreak;
       }
-      case OP_NEWTABLE: {
+      vmcase(OP_NEWTABLE) {
         int b = GETARG_B(i);
         int c = GETARG_C(i);
         sethvalue(L, ra, luaH_new(L, luaO_fb2int(b), luaO_fb2int(c)));
         Protect(luaC_checkGC(L));
-        continue;
+        vmbreak;
       }
-      case OP_SELF: {
+      vmcase(OP_SELF) {
         StkId rb = RB(i);
+        TValue *rc = RKC(i);
         setobjs2s(L, ra+1, rb);
-        Protect(luaV_gettable(L, rb, RKC(i), ra));
-        continue;
+        if (ttistable(rb) && ttisstring(rc)) {
+          Table *h = hvalue(rb);
+          const TValue *res = luaH_getstr(h, rawtsvalue(rc));
+          if (ttisnil(res) && h->metatable != NULL) {  /* try its class */
+            const TValue *tm = fasttm(L, h->metatable, TM_INDEX);
+            if (tm != NULL && ttistable(tm))
+              res = getcached(hvalue(tm), rawtsvalue(rc), icache(cl, pc));
+          }
+          if (!ttisnil(res)) {
+            setobj2s(L, ra, res);
+            vmbreak;
+          }
+        }
+        ProtectTM(luaV_gettable(L, rb, rc, ra));
+        vmbreak;
       }
-      case OP_ADD: {
-        arith_op(luai_numadd, TM_ADD);
-        continue;
+      vmcase(OP_ADD) {
+        arith_opi(luai_numadd, iadd, TM_ADD);
+        vmbreak;
       }
-      case OP_SUB: {
-        arith_op(luai_numsub, TM_SUB);
-        continue;
+      vmcase(OP_SUB) {
+        arith_opi(luai_numsub, isub, TM_SUB);
+        vmbreak;
       }
-      case OP_MUL: {
-        arith_op(luai_nummul, TM_MUL);
-        continue;
+      vmcase(OP_MUL) {
+        arith_opi(luai_nummul, imul, TM_MUL);
+        vmbreak;
       }
-      case OP_DIV: {
+      vmcase(OP_DIV) {
         arith_op(luai_numdiv, TM_DIV);
-        continue;
+        vmbreak;
       }
-      case OP_MOD: {
+      vmcase(OP_MOD) {
         arith_op(luai_nummod, TM_MOD);
-        continue;
+        vmbreak;
       }
-      case OP_POW: {
+      vmcase(OP_POW) {
         arith_op(luai_numpow, TM_POW);
-        continue;
+        vmbreak;
       }
-      case OP_UNM: {
+      vmcase(OP_UNM) {
         TValue *rb = RB(i);
         if (ttisnumber(rb)) {
           lua_Number nb = nvalue(rb);
           setnvalue(ra, luai_numunm(nb));
         }
         else {
-          Protect(Arith(L, ra, rb, rb, TM_UNM));
+          ProtectTM(Arith(L, ra, rb, rb, TM_UNM));
         }
-        continue;
+        vmbreak;
       }
-      case OP_NOT: {
+      vmcase(OP_NOT) {
         int res = l_isfalse(RB(i));  /* next assignment may change this value */
         setbvalue(ra, res);
-        continue;
+        vmbreak;
       }
-      case OP_LEN: {
+      vmcase(OP_LEN) {
         const TValue *rb = RB(i);
         switch (ttype(rb)) {
           case LUA_TTABLE: {
-            setnvalue(ra, cast_num(luaH_getn(hvalue(rb))));
+            setivalue(ra, luaH_getn(hvalue(rb)));
             break;
           }
           case LUA_TSTRING: {
@@ -523,71 +786,99 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             break;
           }
           default: {  /* try metamethod */
-            Protect(
+            ProtectTM(
               if (!call_binTM(L, rb, luaO_nilobject, ra, TM_LEN))
                 luaG_typeerror(L, rb, "get length of");
             )
           }
         }
-        continue;
+        vmbreak;
       }
-      case OP_CONCAT: {
+      vmcase(OP_CONCAT) {
         int b = GETARG_B(i);
         int c = GETARG_C(i);
-        Protect(luaV_concat(L, c-b+1, c); luaC_checkGC(L));
+        ProtectTM(luaV_concat(L, c-b+1, c));
+        L->top = L->ci->top;  /* `luaV_concat' may move it */
+        Protect(luaC_checkGC(L));
         setobjs2s(L, RA(i), base+b);
-        continue;
+        vmbreak;
       }
-      case OP_JMP: {
+      vmcase(OP_JMP) {
         dojump(L, pc, GETARG_sBx(i));
-        continue;
+        vmbreak;
       }
-      case OP_EQ: {
+      vmcase(OP_EQ) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
-        Protect(
-          if (equalobj(L, rb, rc) == GETARG_A(i))
-            dojump(L, pc, GETARG_sBx(*pc));
-        )
+        int res;
+        ProtectTM(res = equalobj(L, rb, rc));
+        if (res == GETARG_A(i))
+          dojump(L, pc, GETARG_sBx(*pc));
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_LT: {
-        Protect(
-          if (luaV_lessthan(L, RKB(i), RKC(i)) == GETARG_A(i))
-            dojump(L, pc, GETARG_sBx(*pc));
-        )
+      vmcase(OP_LT) {
+        int res;
+        ProtectTM(res = luaV_lessthan(L, RKB(i), RKC(i)));
+        if (res == GETARG_A(i))
+          dojump(L, pc, GETARG_sBx(*pc));
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_LE: {
-        Protect(
-          if (lessequal(L, RKB(i), RKC(i)) == GETARG_A(i))
-            dojump(L, pc, GETARG_sBx(*pc));
-        )
+      vmcase(OP_LE) {
+        int res;
+        ProtectTM(res = lessequal(L, RKB(i), RKC(i)));
+        if (res == GETARG_A(i))
+          dojump(L, pc, GETARG_sBx(*pc));
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_TEST: {
+      vmcase(OP_TEST) {
         if (l_isfalse(ra) != GETARG_C(i))
           dojump(L, pc, GETARG_sBx(*pc));
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_TESTSET: {
+      vmcase(OP_TESTSET) {
         TValue *rb = RB(i);
         if (l_isfalse(rb) != GETARG_C(i)) {
           setobjs2s(L, ra, rb);
           dojump(L, pc, GETARG_sBx(*pc));
         }
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_CALL: {
+      vmfusedcase(OP_CALL) {
         int b = GETARG_B(i);
         int nresults = GETARG_C(i) - 1;
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
         L->savedpc = pc;
+        if (isleaf(ra) && !(L->hookmask & (LUA_MASKCALL | LUA_MASKRET))) {
+          /* leaf C function: call it over this frame (see `lua_pushleaf') */
+          ptrdiff_t rar = savestack(L, ra);
+          StkId firstresult;
+          int n;
+          luaD_checkstack(L, LUA_MINSTACK);
+          ra = restorestack(L, rar);
+          L->base = ra + 1;
+          if (L->ci->top < L->top + LUA_MINSTACK)  /* never below the frame */
+            L->ci->top = L->top + LUA_MINSTACK;
+          lua_unlock(L);
+          n = (*clvalue(ra)->c.f)(L);
+          lua_lock(L);
+          lua_assert(n >= 0 && n <= L->top - L->base);
+          base = L->base = L->ci->base;  /* stack may have been reallocated */
+          L->ci->top = base + cl->p->maxstacksize;
+          ra = restorestack(L, rar);
+          firstresult = L->top - n;
+          for (n = nresults; n != 0 && firstresult < L->top; n--)
+            setobjs2s(L, ra++, firstresult++);
+          while (n-- > 0)
+            setnilvalue(ra++);
+          L->top = (nresults >= 0) ? L->ci->top : ra;
+          jitcall();
+          vmbreak;
+        }
         switch (luaD_precall(L, ra, nresults)) {
           case PCRLUA: {
             nexeccalls++;
@@ -597,18 +888,47 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             /* it was a C function (`precall' called it); adjust results */
             if (nresults >= 0) L->top = L->ci->top;
             base = L->base;
-            continue;
+            jitcall();
+            vmbreak;
+          }
+          case PCRSWITCH: {
+            if (sw == NULL)  /* no switch running here? */
+              return nexeccalls;  /* let `luaD_switch' start one */
+            goto newthread;
           }
           default: {
-            return;  /* yield */
+            goto stopped;  /* yield */
           }
         }
       }
-      case OP_TAILCALL: {
+      vmcase(OP_TAILCALL) {
         int b = GETARG_B(i);
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
         L->savedpc = pc;
         lua_assert(GETARG_C(i) - 1 == LUA_MULTRET);
+        if (ttisfunction(ra) && !clvalue(ra)->c.isC &&
+            !clvalue(ra)->l.p->is_vararg && !(L->hookmask & LUA_MASKCALL) &&
+            L->ci->func+1 + clvalue(ra)->l.p->maxstacksize <= L->stack_last) {
+          /* fixed-arity Lua function: build its frame over this one */
+          CallInfo *ci = L->ci;
+          Proto *p = clvalue(ra)->l.p;
+          StkId func = ci->func;
+          StkId lim = ra + 1 + p->numparams;  /* end of used arguments */
+          int aux;
+          if (L->openupval) luaF_close(L, base);
+          if (L->top < lim) lim = L->top;
+          for (aux = 0; ra+aux < lim; aux++)  /* move function and args */
+            setobjs2s(L, func+aux, ra+aux);
+          L->base = ci->base = ci->func + 1;
+          ci->top = ci->base + p->maxstacksize;
+          for (func += aux; func < ci->top; func++)
+            setnilvalue(func);  /* missing arguments and locals */
+          L->top = ci->top;
+          L->savedpc = ci->savedpc = p->code;
+          ci->tailcalls++;  /* one more call lost */
+          luaJ_count(L, p);
+          goto reentry;
+        }
         switch (luaD_precall(L, ra, LUA_MULTRET)) {
           case PCRLUA: {
             /* tail call: put new frame in place of previous one */
@@ -629,44 +949,72 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           }
           case PCRC: {  /* it was a C function (`precall' called it) */
             base = L->base;
-            continue;
+            vmbreak;
+          }
+          case PCRSWITCH: {
+            if (sw == NULL)  /* no switch running here? */
+              return nexeccalls;  /* let `luaD_switch' start one */
+            goto newthread;
           }
           default: {
-            return;  /* yield */
+            goto stopped;  /* yield */
           }
         }
       }
-      case OP_RETURN: {
+      vmcase(OP_RETURN) {
         int b = GETARG_B(i);
         if (b != 0) L->top = ra+b-1;
         if (L->openupval) luaF_close(L, base);
         L->savedpc = pc;
         b = luaD_poscall(L, ra);
         if (--nexeccalls == 0)  /* was previous function running `here'? */
-          return;  /* no: return */
+          goto stopped;  /* no: return */
         else {  /* yes: continue its execution */
-          if (b) L->top = L->ci->top;
           lua_assert(isLua(L->ci));
-          lua_assert(GET_OPCODE(*((L->ci)->savedpc - 1)) == OP_CALL);
+          if (GET_OPCODE(*(L->savedpc - 1)) == OP_CALL) {
+            if (b) L->top = L->ci->top;
+          }
+          else if (luaV_finishcall(L))  /* pushed another metamethod? */
+            nexeccalls++;
           goto reentry;
         }
       }
-      case OP_FORLOOP: {
-        lua_Number step = nvalue(ra+2);
-        lua_Number idx = luai_numadd(nvalue(ra), step); /* increment index */
-        lua_Number limit = nvalue(ra+1);
-        if (luai_numlt(0, step) ? luai_numle(idx, limit)
-                                : luai_numle(limit, idx)) {
-          dojump(L, pc, GETARG_sBx(i));  /* jump back */
-          setnvalue(ra, idx);  /* update internal index... */
-          setnvalue(ra+3, idx);  /* ...and external index */
+      vmcase(OP_FORLOOP) {
+#if defined(LUA_USE_JIT)
+        int *hot = icache(cl, pc);  /* unused as a cache here */
+#endif
+        if (ttisint(ra)) {  /* loop over `int's? (see OP_FORPREP) */
+          int step = ivalue(ra+2);
+          int limit = ivalue(ra+1);
+          int idx;
+          /* on overflow `idx' would be past `limit' anyway */
+          if (iadd(idx, ivalue(ra), step) &&
+              (0 < step ? idx <= limit : limit <= idx)) {
+            dojump(L, pc, GETARG_sBx(i));  /* jump back */
+            setivalue(ra, idx);  /* update internal index... */
+            setivalue(ra+3, idx);  /* ...and external index */
+            jitloop(hot);
+          }
+        }
+        else {
+          lua_Number step = nvalue(ra+2);
+          lua_Number idx = luai_numadd(nvalue(ra), step); /* increment index */
+          lua_Number limit = nvalue(ra+1);
+          if (luai_numlt(0, step) ? luai_numle(idx, limit)
+                                  : luai_numle(limit, idx)) {
+            dojump(L, pc, GETARG_sBx(i));  /* jump back */
+            setnvalue(ra, idx);  /* update internal index... */
+            setnvalue(ra+3, idx);  /* ...and external index */
+            jitloop(hot);
+          }
         }
-        continue;
+        vmbreak;
       }
-      case OP_FORPREP: {
+      vmcase(OP_FORPREP) {
         const TValue *init = ra;
         const TValue *plimit = ra+1;
         const TValue *pstep = ra+2;
+        int idx;
         L->savedpc = pc;  /* next steps may throw errors */
         if (!tonumber(init, ra))
           luaG_runerror(L, LUA_QL("for") " initial value must be a number");
@@ -674,27 +1022,50 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           luaG_runerror(L, LUA_QL("for") " limit must be a number");
         else if (!tonumber(pstep, ra+2))
           luaG_runerror(L, LUA_QL("for") " step must be a number");
-        setnvalue(ra, luai_numsub(nvalue(ra), nvalue(pstep)));
+        if (ttisint(init) && ttisint(plimit) && ttisint(pstep) &&
+            isub(idx, ivalue(init), ivalue(pstep))) {
+          setivalue(ra, idx);  /* all `int's: loop keeps them */
+        }
+        else {
+          setnvalue(ra, luai_numsub(nvalue(ra), nvalue(pstep)));
+        }
         dojump(L, pc, GETARG_sBx(i));
-        continue;
+        vmbreak;
       }
-      case OP_TFORLOOP: {
+      vmcase(OP_TFORLOOP) {
         StkId cb = ra + 3;  /* call base */
         setobjs2s(L, cb+2, ra+2);
         setobjs2s(L, cb+1, ra+1);
         setobjs2s(L, cb, ra);
         L->top = cb+3;  /* func. + 2 args (state and index) */
-        Protect(luaD_call(L, cb, GETARG_C(i)));
-        L->top = L->ci->top;
-        cb = RA(i) + 3;  /* previous call may change the stack */
-        if (!ttisnil(cb)) {  /* continue loop? */
-          setobjs2s(L, cb-1, cb);  /* save control variable */
-          dojump(L, pc, GETARG_sBx(*pc));  /* jump back */
+        L->savedpc = pc;
+        switch (luaD_precall(L, cb, GETARG_C(i))) {
+          case PCRLUA: {
+            nexeccalls++;
+            goto reentry;  /* `luaV_finishcall' ends the loop step */
+          }
+          case PCRC: {
+            L->top = L->ci->top;
+            base = L->base;
+            cb = RA(i) + 3;  /* previous call may change the stack */
+            if (!ttisnil(cb)) {  /* continue loop? */
+              setobjs2s(L, cb-1, cb);  /* save control variable */
+              dojump(L, pc, GETARG_sBx(*pc));  /* jump back */
+            }
+            pc++;
+            vmbreak;
+          }
+          case PCRSWITCH: {
+            if (sw == NULL)  /* no switch running here? */
+              return nexeccalls;  /* let `luaD_switch' start one */
+            goto newthread;
+          }
+          default: {
+            goto stopped;  /* yield */
+          }
         }
-        pc++;
-        continue;
       }
-      case OP_SETLIST: {
+      vmcase(OP_SETLIST) {
         int n = GETARG_B(i);
         int c = GETARG_C(i);
         int last;
@@ -714,17 +1085,21 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           setobj2t(L, luaH_setnum(L, h, last--), val);
           luaC_barriert(L, h, val);
         }
-        continue;
+        vmbreak;
       }
-      case OP_CLOSE: {
+      vmcase(OP_CLOSE) {
         luaF_close(L, ra);
-        continue;
+        vmbreak;
       }
-      case OP_CLOSURE: {
+      vmcase(OP_CLOSURE) {
         Proto *p;
         Closure *ncl;
         int nup, j;
         p = cl->p->p[GETARG_Bx(i)];
+        if (p->body) {  /* still in a mapped image? */
+          Protect(luaU_loadbody(L, p));
+          ra = RA(i);
+        }
         nup = p->nups;
         ncl = luaF_newLclosure(L, nup, cl->env);
         ncl->l.p = p;
@@ -738,9 +1113,9 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         }
         setclvalue(L, ra, ncl);
         Protect(luaC_checkGC(L));
-        continue;
+        vmbreak;
       }
-      case OP_VARARG: {
+      vmcase(OP_VARARG) {
         int b = GETARG_B(i) - 1;
         int j;
         CallInfo *ci = L->ci;
@@ -759,9 +1134,47 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             setnilvalue(ra + j);
           }
         }
-        continue;
+        vmbreak;
+      }
+      vmcase(OP_GETTABLECALL) {
+        TValue *rb = RB(i);
+        TValue *rc = RKC(i);
+        const TValue *res = luaO_nilobject;
+        if (ttistable(rb) && ttisstring(rc))
+          res = getcached(hvalue(rb), rawtsvalue(rc), icache(cl, pc));
+        if (!ttisnil(res)) {
+          setobj2s(L, ra, res);
+        }
+        else
+          ProtectTM(luaV_gettable(L, rb, rc, ra));
+        vmfuse(OP_CALL);
+      }
+      vmcase(OP_MOVECALL) {
+        setobjs2s(L, ra, RB(i));
+        vmfuse(OP_CALL);
+      }
+      vmcase(OP_GETUPVALTABLE) {
+        int b = GETARG_B(i);
+        setobj2s(L, ra, cl->upvals[b]->v);
+        vmfuse(OP_GETTABLE);
       }
     }
   }
+ newthread:  /* `L' asked to resume a coroutine */
+  if (L == sw->L) sw->nexeccalls = nexeccalls;
+  L = luaD_switchin(L, sw->errorJmp);
+  if (L->resuming != NULL) goto newthread;  /* a C function doing the same */
+  if (L->status == LUA_YIELD || L->ci == L->base_ci) goto stopped;
+  nexeccalls = cast_int(L->ci - L->base_ci);
+  goto reentry;
+ stopped:  /* `L' yielded or finished its calls here */
+  if (sw == NULL || L == sw->L) return 0;
+  L = luaD_switchback(L);  /* its resumer, after the continuation ran */
+  if (L->resuming != NULL) goto newthread;
+  if (L->status == LUA_YIELD) goto stopped;  /* the continuation yielded */
+  nexeccalls = (L == sw->L) ? sw->nexeccalls : cast_int(L->ci - L->base_ci);
+  if (nexeccalls == 0) goto stopped;
+  luaV_finishcall(L);
+  goto reentry;
 }
 
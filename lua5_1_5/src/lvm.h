@@ -30,7 +30,8 @@ LUAI_FUNC void luaV_gettable (lua_State *L, const TValue *t, TValue *key,
                                             StkId val);
 LUAI_FUNC void luaV_settable (lua_State *L, const TValue *t, TValue *key,
                                             StkId val);
-LUAI_FUNC void luaV_execute (lua_State *L, int nexeccalls);
+LUAI_FUNC int luaV_finishcall (lua_State *L);
+LUAI_FUNC int luaV_execute (lua_State *L, int nexeccalls, Switch *sw);
 LUAI_FUNC void luaV_concat (lua_State *L, int total, int last);
 
 #endif
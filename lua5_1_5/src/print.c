@@ -102,7 +102,7 @@ static void PrintCode(const Proto* f)
     if (o==OP_JMP) printf("%d",sbx); else printf("%d %d",a,sbx);
     break;
   }
-  switch (o)
+  switch (getBaseOp(o))
   {
    case OP_LOADK:
     printf("\t; "); PrintConstant(f,bx);
@@ -0,0 +1,26 @@
+-- bgimage.lua: functions loaded from an image die while the loader
+-- brings in nested ones from the same image. With LUA_USE_BGSWEEP the
+-- dead ones must be freed by the interpreter, not the helper thread,
+-- as both update the image's reference count; build with
+-- -fsanitize=thread to check.
+--
+-- usage: lua bgimage.lua   (with luac next to lua, e.g. in ../src)
+
+local luac = string.gsub(arg and arg[-1] or "lua", "lua$", "luac")
+local src, img = os.tmpname(), os.tmpname()
+local body = "return 1"
+for i = 1, 12 do body = "return function () " .. body .. " end" end
+local f = assert(io.open(src, "w"))
+f:write("local junk = {} for i = 1, 20 do junk[i] = {} end\n", body)
+f:close()
+assert(os.execute(luac .. " -m -o " .. img .. " " .. src) == 0)
+collectgarbage("setpause", 100) collectgarbage("setstepmul", 400)
+for i = 1, 3000 do
+  local g = assert(loadfile(img))()  -- the main function is garbage now
+  local junk = {} for j = 1, 100 do junk[j] = {j} end
+  while type(g) == "function" do g = g() end
+  assert(g == 1)
+end
+collectgarbage("setpause", 200) collectgarbage("setstepmul", 200)
+os.remove(src) os.remove(img)
+print "bgimage ok"
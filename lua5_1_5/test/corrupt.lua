@@ -0,0 +1,55 @@
+-- corrupt.lua: loading and running corrupted binary chunks is safe.
+-- Sets each byte of an image (luac -m) and of a compact chunk (luac -c)
+-- to 0 in turn. Loading may fail, and so may calling what was loaded
+-- (nested functions of an image are loaded when first needed). What
+-- does load must have its names of locals and upvalues (a hook asks
+-- for them on every line: with LUA_USE_MMAP, loadfile maps the image
+-- and reads names only then), and the collector must still find
+-- everything left in memory intact.
+--
+-- usage: lua corrupt.lua   (with luac next to lua, e.g. in ../src)
+
+local luac = string.gsub(arg and arg[-1] or "lua", "lua$", "luac")
+local src, out = os.tmpname(), os.tmpname()
+local f = assert(io.open(src, "w"))
+f:write([[
+local up = "up"
+local function named(alpha, beta)
+  local gamma = alpha .. beta .. "k"
+  debug.getlocal(1, 1) debug.getlocal(1, 2) debug.getlocal(1, 3)
+  return function () return gamma, up, 1.5, true end
+end
+return named("a", "b")()
+]])
+f:close()
+for _, o in ipairs{"-m", "-c"} do
+  assert(os.execute(luac .. " " .. o .. " -o " .. out .. " " .. src) == 0)
+  local h = assert(io.open(out, "rb"))
+  local s = h:read("*a")
+  h:close()
+  for n = 13, #s do
+    local t = s:sub(1, n - 1) .. "\0" .. s:sub(n + 1)
+    h = assert(io.open(out, "wb"))
+    h:write(t)
+    h:close()
+    local fn = loadfile(out)
+    if fn then
+      local bad
+      debug.sethook(function ()
+        local f = debug.getinfo(2, "f").func
+        for i = 1, 10 do
+          local ok, err = pcall(debug.getlocal, 3, i)
+          if not ok then bad = err end
+          ok, err = pcall(debug.getupvalue, f, i)
+          if not ok then bad = err end
+        end
+      end, "l")
+      pcall(fn)
+      debug.sethook()
+      assert(not bad, bad)
+    end
+    collectgarbage()
+  end
+end
+os.remove(src) os.remove(out)
+print "corrupt ok"
@@ -0,0 +1,29 @@
+-- deadkeys.lua: a traversal visits every key once after keys were
+-- removed, collected and set again. With LUA_USE_SWISSTABLE a key set
+-- again used to go to a new node behind the dead one of the same key,
+-- and `next' resumed from the dead node. Where it failed depends on
+-- the hash seed, so run it under several values of LUA_SEED.
+--
+-- usage: lua deadkeys.lua
+
+local keys = {}
+for i = 1, 40 do keys[i] = "key" .. i end  -- keep the strings alive
+for round = 1, 50 do
+  local t = {}
+  for i = 1, 40 do t[keys[i]] = i end
+  for i = 1, 20 do t[keys[i]] = nil end
+  collectgarbage()  -- removed keys become dead
+  for i = 1, 10 do t[keys[i]] = i end
+  local n, seen = 0, {}
+  for k in pairs(t) do
+    assert(not seen[k], "key visited twice")
+    seen[k] = true
+    n = n + 1
+    assert(n <= 30, "traversal does not end")
+  end
+  assert(n == 30, n)
+  for k in pairs(t) do t[k] = nil end  -- clearing while traversing
+  collectgarbage()
+  assert(next(t) == nil)
+end
+print "deadkeys ok"
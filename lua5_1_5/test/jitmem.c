@@ -0,0 +1,70 @@
+/*
+** jitmem.c: running out of memory while compiling (LUA_USE_JIT).
+** Fails one allocation at a time while hot functions and loops get
+** compiled; the calls must go on in the interpreter, with no error,
+** and run as before afterwards. Without LUA_USE_JIT it checks nothing
+** more than that the code runs.
+**
+** usage: cc -I../src -o jitmem jitmem.c ../src/liblua.a -lm -ldl && ./jitmem
+**        (build ../src first; add the MYCFLAGS used there)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+static int countdown;  /* allocations until one fails (0: none fails) */
+
+
+static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  (void)ud; (void)osize;
+  if (nsize == 0) {
+    free(ptr);
+    return NULL;
+  }
+  if (countdown > 0 && --countdown == 0)
+    return NULL;
+  return realloc(ptr, nsize);
+}
+
+
+static const char *const setup =
+  "function f (x) local s = 0 for i = 1, 10 do s = s + x end return s end\n"
+  "function g (n) local s = 0 for i = 1, n do s = s + i end return s end\n";
+
+static const char *const hot =
+  "for i = 1, 300 do assert(f(i) == 10 * i) end\n"
+  "assert(g(1000) == 500500)\n";
+
+
+static int run (int n) {
+  int status;
+  lua_State *L = lua_newstate(l_alloc, NULL);
+  if (L == NULL) return 1;
+  luaL_openlibs(L);
+  status = luaL_dostring(L, setup) || luaL_loadstring(L, hot);
+  if (status == 0) {
+    countdown = n;
+    status = lua_pcall(L, 0, 0, 0);
+    countdown = 0;
+  }
+  if (status == 0)  /* again, with whatever got compiled */
+    status = luaL_dostring(L, hot);
+  if (status)
+    fprintf(stderr, "jitmem %d: %s\n", n, lua_tostring(L, -1));
+  lua_close(L);
+  return status;
+}
+
+
+int main (void) {
+  int n;
+  for (n = 1; n <= 20; n++)
+    if (run(n)) return 1;
+  printf("jitmem ok\n");
+  return 0;
+}
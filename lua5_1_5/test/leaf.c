@@ -0,0 +1,120 @@
+/*
+** leaf.c: leaf C functions (see lua_pushleaf) called from Lua code.
+** Checks argument and result passing, allocation in a leaf while the
+** collector runs over a big caller frame, and Lua metamethods run
+** from a leaf.
+**
+** usage: cc -I../src -o leaf leaf.c ../src/liblua.a -lm -ldl && ./leaf
+**        (build ../src first; add the MYCFLAGS used there)
+*/
+
+#include <stdio.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+static int add (lua_State *L) {
+  lua_pushnumber(L, luaL_checknumber(L, 1) + luaL_checknumber(L, 2));
+  return 1;
+}
+
+
+static int many (lua_State *L) {
+  int i, n = (int)lua_tointeger(L, 1);
+  luaL_checkstack(L, n, "too many results");
+  for (i = 1; i <= n; i++) lua_pushinteger(L, i);
+  return n;
+}
+
+
+static int nargs (lua_State *L) {
+  lua_pushinteger(L, lua_gettop(L));
+  return 1;
+}
+
+
+static int fresh (lua_State *L) {  /* allocates: the collector may run */
+  lua_pushfstring(L, "s%d", (int)luaL_checkinteger(L, 1));
+  return 1;
+}
+
+
+static int getx (lua_State *L) {  /* may call __index */
+  lua_getfield(L, 1, "x");
+  lua_pushinteger(L, lua_gettop(L));
+  return 2;
+}
+
+
+static int setx (lua_State *L) {  /* may call __newindex */
+  lua_settop(L, 2);
+  lua_setfield(L, 1, "x");
+  lua_pushinteger(L, lua_gettop(L));
+  return 1;
+}
+
+
+static const luaL_Reg leaves[] = {
+  {"add", add},
+  {"many", many},
+  {"nargs", nargs},
+  {"fresh", fresh},
+  {"getx", getx},
+  {"setx", setx},
+  {NULL, NULL}
+};
+
+
+static const char *const test =
+  "local L = leaf\n"
+  "assert(L.add(1, 2) == 3)\n"
+  "local a, b, c = L.many(2) assert(a == 1 and b == 2 and c == nil)\n"
+  "assert(select('#', L.many(500)) == 500)\n"
+  "assert(L.nargs() == 0 and L.nargs(1, nil, 3) == 3)\n"
+  "assert(L.nargs(L.many(40)) == 40)\n"
+  "local ok, e = pcall(function () return L.add(1, {}) end)\n"
+  "assert(not ok and e:find('bad argument'))\n"
+  /* collections in a leaf called low in a big frame keep the frame */
+  "local names, values = {}, {}\n"
+  "for i = 1, 180 do names[i] = 'v' .. i values[i] = '\\'v' .. i .. '\\'' end\n"
+  "local f = assert(loadstring('local fresh, t = ..., {}\\n' ..\n"
+  "  'for i = 1, 20000 do t[i % 100] = fresh(i) end\\n' ..\n"
+  "  'local ' .. table.concat(names, ', ') .. ' = ' ..\n"
+  "  table.concat(values, ', ') .. '\\n return t, v180, v90'))\n"
+  "collectgarbage('setpause', 50) collectgarbage('setstepmul', 1000)\n"
+  "for k = 1, 5 do\n"
+  "  local t, v180, v90 = f(L.fresh)\n"
+  "  assert(t[1] == 's19901' and v180 == 'v180' and v90 == 'v90')\n"
+  "end\n"
+  "collectgarbage('setpause', 200) collectgarbage('setstepmul', 200)\n"
+  /* Lua metamethods run from a leaf */
+  "local seen\n"
+  "local obj = setmetatable({}, {\n"
+  "  __index = function (t, k) return k .. '!' end,\n"
+  "  __newindex = function (t, k, v) seen = v end})\n"
+  "local function get () local a, b = 1, 2 local x, n = L.getx(obj) return a, b, x, n end\n"
+  "local a, b, x, n = get()\n"
+  "assert(a == 1 and b == 2 and x == 'x!' and n == 2, tostring(x))\n"
+  "local function set () local a, b = 1, 2 local n = L.setx(obj, 42) return a, b, n end\n"
+  "a, b, n = set()\n"
+  "assert(a == 1 and b == 2 and n == 1 and seen == 42)\n"
+  "for i = 1, 1000 do assert(L.getx(obj) == 'x!') end\n"
+  "return 'ok'\n";
+
+
+int main (void) {
+  int status;
+  lua_State *L = luaL_newstate();
+  luaL_openlibs(L);
+  luaL_registerleaf(L, "leaf", leaves);
+  lua_pop(L, 1);
+  status = luaL_dostring(L, test);
+  if (status)
+    fprintf(stderr, "leaf: %s\n", lua_tostring(L, -1));
+  else
+    printf("leaf %s\n", lua_tostring(L, -1));
+  lua_close(L);
+  return status;
+}
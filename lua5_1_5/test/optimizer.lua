@@ -0,0 +1,59 @@
+-- optimizer.lua: `luac -O' changes neither results nor errors. It folds
+-- constants, but zero keeps its sign (-0 and 0 are one constant, so
+-- neither is folded) and errors in arithmetic still name the local that
+-- holds a value of the wrong type. It removes dead branches, but a
+-- closure in one is followed by pseudo-instructions for its upvalues,
+-- and removing it must not take the live code after the branch with it.
+-- Each case is compiled with and without -O and must give the same
+-- results and messages.
+--
+-- usage: lua optimizer.lua   (with luac next to lua, e.g. in ../src)
+
+local cases = {
+-- constants
+[[local a = 0 return 1 / -a]],
+[[local a, b = 0, -1 return 1 / (a * b), 1 / (b * a), 1 / (a / b)]],
+[[local z = 0 local m = -z return 1 / m, 1 / (m + 0), 1 / (z - 0)]],
+[[local a = 0 return 1 / -0, 1 / (0 * -1), a]],
+[[local n = 0.4 n = not n n = 10 / n return n]],
+[[local s = "x" local t = {} return s + 1]],
+[[local b = true return -b]],
+[[local u return u * 2]],
+-- dead code
+[[local n = 0
+  if false then local f = function () return n end f() end
+  n = n + 1 return n]],
+[[local a, b = 1, 2
+  if false then local f = function () return a + b end a = f() end
+  b = b * 10 return a, b]],
+[[local D = false local x, y = "x", "y"
+  if D then local function g() x = y return x end g() else y = x .. y end
+  local function h() return x .. y end return h()]],
+[[local n = 0
+  while false do local f = function () n = n + 1 end f() end
+  for i = 1, 3 do n = n + i end return n]],
+}
+
+local function pack(...) return {n = select('#', ...), ...} end
+local function same(a, b)
+  if a.n ~= b.n then return false end
+  for i = 1, a.n do
+    local x, y = a[i], b[i]
+    if type(x) == "number" and x == 0 and y == 0 then x, y = 1 / x, 1 / y end
+    if x ~= y then return false end
+  end
+  return true
+end
+
+local luac = string.gsub(arg and arg[-1] or "lua", "lua$", "luac")
+local src, out = os.tmpname(), os.tmpname()
+for i, c in ipairs(cases) do
+  local f = assert(io.open(src, "w")) f:write(c) f:close()
+  assert(os.execute(luac .. " -O -o " .. out .. " " .. src) == 0)
+  local r1 = pack(pcall(assert(loadfile(src))))
+  local r2 = pack(pcall(assert(loadfile(out))))
+  assert(same(r1, r2), "case " .. i .. ": " .. tostring(r1[2]) ..
+         " ~= " .. tostring(r2[2]))
+end
+os.remove(src) os.remove(out)
+print "optimizer ok"
@@ -0,0 +1,30 @@
+-- truncated.lua: loading a truncated binary chunk fails cleanly.
+-- Loads every prefix of a dumped chunk; each must fail with an error
+-- and leave no memory behind (a function whose code was allocated but
+-- not counted used to leak it).
+--
+-- usage: lua truncated.lua
+
+local function chunk(a, b)
+  local t = {}
+  for i = a, b do t[#t + 1] = string.format("%d:%s", i, "x") end
+  local function inner(s) return s .. table.concat(t, ",") end
+  return inner("<"), #t
+end
+local s = string.dump(chunk)
+assert(loadstring(s)(1, 3) == "<1:x,2:x,3:x")
+
+local function round()
+  for n = 1, #s - 1 do
+    local f, err = loadstring(s:sub(1, n), "=truncated")
+    assert(f == nil and err:find("precompiled chunk"), n)
+  end
+end
+round()
+collectgarbage() collectgarbage()
+local before = collectgarbage("count")
+for i = 1, 20 do round() end
+collectgarbage() collectgarbage()
+local after = collectgarbage("count")
+assert(after < before + 1, string.format("%.1f KB leaked", after - before))
+print "truncated ok"